@@ -14,13 +14,28 @@
     #define LIB_CLOSE(handle) FreeLibrary((HMODULE)handle)
 #endif
 
-bool control_attach(void* /* handle */, const ControlFns& fns) {
+bool control_attach(void* /* handle */, const ControlFns& fns, std::vector<BootLib>& libs) {
     std::cout << "Resolved control plugin functions (Attach/Detach/Invoke)" << std::endl;
 
     // Pass control's own Invoke as the dispatch function
     // Plugins call dispatch(addr, payload, opts) → control routes to appropriate plugin
     char err_buf[256] = {0};
-    if (!fns.attach(fns.invoke, err_buf, sizeof(err_buf))) {
+    bool attached = false;
+    if (fns.attach_ex) {
+        // Control takes ownership of the handles boot already opened
+        std::vector<libshandoff> handoff;
+        for (const auto& lib : libs) handoff.push_back({lib.path.c_str(), lib.handle, lib.info});
+        attached = fns.attach_ex(fns.invoke, handoff.data(), handoff.size(), nullptr, err_buf, sizeof(err_buf));
+        if (!attached) {
+            for (const auto& lib : libs) LIB_CLOSE(lib.handle);
+        }
+    } else {
+        for (const auto& lib : libs) LIB_CLOSE(lib.handle);
+        attached = fns.attach(fns.invoke, err_buf, sizeof(err_buf));
+    }
+    libs.clear();
+
+    if (!attached) {
         std::cerr << "Error: Control plugin Attach failed: " << err_buf << std::endl;
         return false;
     }
@@ -1,5 +1,7 @@
 #pragma once
 
-struct ControlFns;
+#include "boot.h"
+#include <vector>
 
-bool control_attach(void* handle, const ControlFns& fns);
+// Attaches control, handing it libs when it supports AttachEx and closing them otherwise
+bool control_attach(void* handle, const ControlFns& fns, std::vector<BootLib>& libs);
@@ -21,6 +21,15 @@ bool control_bind(void* handle, ControlFns* fns) {
     fns->detach = (DetachFn)LIB_SYM(handle, "Detach");
     fns->invoke = (InvokeFn)LIB_SYM(handle, "Invoke");
 
+    fns->invoke2 = (Invoke2Fn)LIB_SYM(handle, "Invoke2");
+    fns->release = (ReleaseFn)LIB_SYM(handle, "Release");
+    if (!fns->invoke2 || !fns->release) {
+        fns->invoke2 = nullptr;
+        fns->release = nullptr;
+    }
+
+    fns->attach_ex = (AttachExFn)LIB_SYM(handle, "AttachEx");
+
     if (!fns->attach || !fns->detach || !fns->invoke) {
         std::cerr << "Error: Control plugin missing required functions" << std::endl;
         LIB_CLOSE(handle);
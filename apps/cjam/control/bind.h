@@ -2,15 +2,44 @@
 
 #include <cstddef>
 
+struct libsinfo {
+    const char* plugin_type;
+    const char* product;
+    const char* description_long;
+    const char* description_short;
+    unsigned long plugin_id;
+};
+
+// A library boot already opened and reported, handed to control through AttachEx
+struct libshandoff {
+    const char* path;
+    void* handle;
+    libsinfo info;
+};
+
+// Owned result from Invoke2, handed back to Release
+struct libsresult {
+    const char* data;
+    std::size_t size;
+    void* owner;
+};
+
 using DispatchFn = const char* (*)(const char* address, const char* payload, const char* options);
 using AttachFn = bool (*)(DispatchFn dispatch, char* err_buf, std::size_t err_cap);
 using DetachFn = bool (*)(char* err_buf, std::size_t err_cap);
 using InvokeFn = const char* (*)(const char* address, const char* payload, const char* options);
+using Invoke2Fn = bool (*)(const char* address, const char* payload, const char* options, libsresult* out);
+using ReleaseFn = void (*)(libsresult* result);
+using AttachExFn = bool (*)(DispatchFn dispatch, const libshandoff* libs, std::size_t count,
+                            const char* options, char* err_buf, std::size_t err_cap);
 
 struct ControlFns {
     AttachFn attach;
     DetachFn detach;
     InvokeFn invoke;
+    Invoke2Fn invoke2;  // optional reentrant entry point
+    ReleaseFn release;
+    AttachExFn attach_ex;  // optional; takes over the libraries boot opened
 };
 
 bool control_bind(void* handle, ControlFns* fns);
@@ -1,9 +1,16 @@
 #include "boot.h"
+#include <cstdint>
 #include <cstring>
 #include <filesystem>
+#include <fstream>
 #include <iostream>
+#include <sstream>
 #include <string>
 
+#if !defined(_WIN32)
+    #include <sys/stat.h>
+#endif
+
 #if defined(__APPLE__)
     #include <dlfcn.h>
     #define LIB_EXT ".dylib"
@@ -27,28 +34,67 @@
     #define LIB_CLOSE(handle) FreeLibrary((HMODULE)handle)
 #endif
 
-using DispatchFn = const char* (*)(const char* address, const char* payload, const char* options);
-using AttachFn = bool (*)(DispatchFn dispatch, char* err_buf, std::size_t err_cap);
-using DetachFn = bool (*)(char* err_buf, std::size_t err_cap);
-using InvokeFn = const char* (*)(const char* address, const char* payload, const char* options);
+using ReportFn = bool (*)(char* err_buf, std::size_t err_cap, libsinfo* out);
 
-struct libsinfo {
-    const char* plugin_type;
-    const char* product;
-    const char* description_long;
-    const char* description_short;
-    unsigned long plugin_id;
-};
+// Reads control's plugins.manifest (format in libs/control/manifest.h) and opens the
+// control plugin it lists, provided the file is unchanged. Nothing else gets probed;
+// control loads the other libraries itself.
+static void* control_from_manifest(const std::filesystem::path& exe_dir) {
+    std::ifstream in(exe_dir / "plugins.manifest");
+    std::string line;
+    if (!std::getline(in, line) || line != "# jam plugin manifest v3") return nullptr;
 
-using ReportFn = bool (*)(char* err_buf, std::size_t err_cap, libsinfo* out);
+    while (std::getline(in, line)) {
+        std::vector<std::string> parts;
+        std::istringstream fields(line);
+        for (std::string part; std::getline(fields, part, '\t');) parts.push_back(part);
+        if (parts.size() < 6 || parts[4] != "plugin" || parts[5] != "control") continue;
 
-void* control_boot(char** argv) {
+        std::filesystem::path path = exe_dir / parts[0];
+        std::error_code ec;
+        std::uint64_t size = std::filesystem::file_size(path, ec);
+        if (ec) return nullptr;
+        auto mtime = std::filesystem::last_write_time(path, ec).time_since_epoch().count();
+        if (ec) return nullptr;
+        std::uint64_t inode = 0;
+#if !defined(_WIN32)
+        struct stat st;
+        if (stat(path.c_str(), &st) != 0) return nullptr;
+        inode = std::uint64_t(st.st_ino);
+#endif
+        if (parts[1] != std::to_string(inode) || parts[2] != std::to_string(mtime) ||
+            parts[3] != std::to_string(size)) {
+            std::cout << "HOST: Manifest entry for " << parts[0] << " is stale" << std::endl;
+            return nullptr;
+        }
+
+        void* handle = LIB_LOAD(path.string().c_str());
+        if (!handle) return nullptr;
+        ReportFn report = (ReportFn)LIB_SYM(handle, "Report");
+        libsinfo desc = {};
+        char err_buf[256] = {0};
+        if (!report || !report(err_buf, sizeof(err_buf), &desc) ||
+            !desc.plugin_type || strcmp(desc.plugin_type, "control") != 0) {
+            LIB_CLOSE(handle);
+            return nullptr;
+        }
+        std::cout << "HOST: " << parts[0] << " identified as control plugin (from manifest)" << std::endl;
+        return handle;
+    }
+    return nullptr;
+}
+
+void* control_boot(char** argv, std::vector<BootLib>& libs) {
     std::filesystem::path exe_path = std::filesystem::canonical(argv[0]);
     std::filesystem::path exe_dir = exe_path.parent_path();
 
     std::cout << "HOST: Discovering control plugin..." << std::endl;
+    if (void* control = control_from_manifest(exe_dir)) return control;
+
     std::cout << "HOST: Scanning directory: " << exe_dir << std::endl;
     
+    void* control = nullptr;
+    
     for (const auto& entry : std::filesystem::directory_iterator(exe_dir)) {
         if (!entry.is_regular_file()) continue;
         
@@ -101,16 +147,28 @@ void* control_boot(char** argv) {
         
         // Check if it's the control plugin
         if (desc.plugin_type && strcmp(desc.plugin_type, "control") == 0) {
+            if (control) {
+                std::cout << "HOST: " << filename << " is a second control plugin, ignoring" << std::endl;
+                LIB_CLOSE(handle);
+                continue;
+            }
             std::cout << "HOST: " << filename << " identified as control plugin"
                       << " (type=" << desc.plugin_type
                       << ", id=0x" << std::hex << desc.plugin_id << std::dec << ")" << std::endl;
-            return handle;
+            control = handle;
+            continue;
         }
         
-        std::cout << "HOST: " << filename << " is not control plugin (type=" << desc.plugin_type << ")" << std::endl;
-        LIB_CLOSE(handle);
+        // Keep it open; control adopts it instead of loading it again
+        std::cout << "HOST: " << filename << " is not control plugin (type="
+                  << (desc.plugin_type ? desc.plugin_type : "null") << ")" << std::endl;
+        libs.push_back({entry.path().string(), handle, desc});
     }
     
-    std::cerr << "Error: No control plugin found in " << exe_dir << std::endl;
-    return nullptr;
+    if (!control) {
+        for (const auto& lib : libs) LIB_CLOSE(lib.handle);
+        libs.clear();
+        std::cerr << "Error: No control plugin found in " << exe_dir << std::endl;
+    }
+    return control;
 }
@@ -1,3 +1,16 @@
 #pragma once
 
-void* control_boot(char** argv);
+#include "bind.h"
+#include <string>
+#include <vector>
+
+// A non-control library boot opened and reported along the way
+struct BootLib {
+    std::string path;
+    void* handle;
+    libsinfo info;
+};
+
+// Returns the control plugin's handle. Every other valid plugin stays open and lands in
+// libs, so control can adopt it instead of opening it again.
+void* control_boot(char** argv, std::vector<BootLib>& libs);
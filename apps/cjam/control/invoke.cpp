@@ -1,9 +1,20 @@
 #include "invoke.h"
 #include "bind.h"
 #include <iostream>
+#include <string>
+
+bool control_invoke(const ControlFns& fns) {
+    // Prefer the reentrant entry point; the result is ours until released
+    if (fns.invoke2) {
+        libsresult result = {};
+        bool handled = fns.invoke2("control.run", "{}", "{}", &result);
+        std::cout << "Control plugin result: "
+                  << (result.data ? std::string(result.data, result.size) : std::string("null")) << std::endl;
+        fns.release(&result);
+        return handled;
+    }
 
-const char* control_invoke(const ControlFns& fns) {
     const char* result = fns.invoke("control.run", "{}", "{}");
     std::cout << "Control plugin result: " << (result ? result : "null") << std::endl;
-    return result;
+    return result != nullptr;
 }
@@ -2,4 +2,4 @@
 
 struct ControlFns;
 
-const char* control_invoke(const ControlFns& fns);
+bool control_invoke(const ControlFns& fns);
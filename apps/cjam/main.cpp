@@ -4,17 +4,19 @@
 #include "control/invoke.h"
 #include "control/detach.h"
 #include <iostream>
+#include <vector>
 
 int main(int /* argc */, char** argv) {
     std::cout << "=== MINIMAL HOST ===" << std::endl;
 
-    void* handle = control_boot(argv);
+    std::vector<BootLib> libs;
+    void* handle = control_boot(argv, libs);
     if (!handle) return 1;
 
     ControlFns fns;
     if (!control_bind(handle, &fns)) return 1;
     
-    if (!control_attach(handle, fns)) return 1;
+    if (!control_attach(handle, fns, libs)) return 1;
 
     control_invoke(fns);
     control_detach(handle, fns);
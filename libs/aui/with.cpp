@@ -5,3 +5,8 @@ handler_list aui_with() {
         // AUI plugin has no addresses yet - placeholder
     };
 }
+
+const handler_table& aui_table() {
+    static const handler_table table(aui_with());
+    return table;
+}
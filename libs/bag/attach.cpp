@@ -1,10 +1,18 @@
 #include "contract.h"
+#include <cstdlib>
 #include <iostream>
 
 DispatchFn g_dispatch = nullptr;
+const libshost* g_host = nullptr;
+bool g_log_calls = false;
 
 extern "C" bool Attach(DispatchFn dispatch, char* /* err_buf */, std::size_t /* err_cap */) {
     g_dispatch = dispatch;
+    g_log_calls = std::getenv(kLogCallsEnv) != nullptr;
     std::cout << "BAG: Attach() called" << std::endl;
     return true;
 }
+
+extern "C" void Services(const libshost* host) {
+    g_host = host;
+}
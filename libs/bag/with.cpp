@@ -9,3 +9,8 @@ handler_list bag_with() {
         list_with(),
     };
 }
+
+const handler_table& bag_table() {
+    static const handler_table table(bag_with());
+    return table;
+}
@@ -1,11 +1,19 @@
 #include "contract.h"
+#include <cstdlib>
 #include <iostream>
 
 // Store dispatch callback from host
 DispatchFn g_dispatch = nullptr;
+const libshost* g_host = nullptr;
+bool g_log_calls = false;
 
 extern "C" bool Attach(DispatchFn dispatch, char* /* err_buf */, std::size_t /* err_cap */) {
     g_dispatch = dispatch;
+    g_log_calls = std::getenv(kLogCallsEnv) != nullptr;
     std::cout << "CLI: Attach() called" << std::endl;
     return true;
 }
+
+extern "C" void Services(const libshost* host) {
+    g_host = host;
+}
@@ -1,34 +1,128 @@
 #include "contract.h"
 #include "handler.h"
+#include "task.h"
+#include <cstring>
 #include <iostream>
+#include <string>
 
-handler_list cli_with();
+extern bool g_log_calls;
+
+const handler_table& cli_table();
+
+// Runs one handler into response; touches no shared state.
+// payload is payload_len bytes; binary payloads need not be NUL-terminated.
+static void cli_run(const handler_def& handler, const char* payload, std::size_t payload_len, bool binary,
+                    const char* options, std::string& response) {
+    std::string err;
+    try {
+        if (handler.bytes) {
+            response = handler.bytes(std::string_view(payload ? payload : "", payload_len), options, err);
+        } else if (handler.co) {
+            response = sync_wait(handler.co(std::string(payload ? payload : "", payload_len), options ? options : ""));
+        } else if (binary && payload) {
+            // Text handlers expect a NUL-terminated payload
+            std::string text(payload, payload_len);
+            response = std::any_cast<std::string>(handler.fun(text.c_str(), options, err));
+        } else {
+            response = std::any_cast<std::string>(handler.fun(payload, options, err));
+        }
+    } catch (const std::exception& ex) {
+        response = R"({"success":false,"error":")" + std::string(ex.what()) + R"("})";
+    }
+}
+
+// Looks up the handler for address and runs it
+static bool cli_call(const char* address, const char* payload, std::size_t payload_len, bool binary,
+                     const char* options, std::string& response) {
+    if (g_log_calls) {
+        std::cout << "CLI: Invoke called\n";
+        std::cout << "CLI: address='" << (address ? address : "null") << "'\n";
+        if (binary) {
+            std::cout << "CLI: payload=<" << payload_len << " bytes>\n";
+        } else {
+            std::cout << "CLI: payload='" << (payload ? payload : "null") << "'\n";
+        }
+        std::cout << "CLI: pptions='" << (options ? options : "null") << "'\n";
+    }
+    
+    if (const handler_def* handler = cli_table().find(address ? address : "")) {
+        cli_run(*handler, payload, payload_len, binary, options, response);
+        return true;
+    }
+    
+    response = R"({"success":false,"error":"handler not found"})";
+    return false;
+}
+
+static bool cli_call_owned(const char* address, const char* payload, std::size_t payload_len, bool binary,
+                           const char* options, libsresult* out) {
+    if (!out) return false;
+    
+    auto* response = new std::string();
+    bool handled = cli_call(address, payload, payload_len, binary, options, *response);
+    out->data = response->c_str();
+    out->size = response->size();
+    out->owner = response;
+    return handled;
+}
 
 extern "C" const char* Invoke(const char* address, 
                               const char* payload, 
                               const char* options) {
+    // Legacy entry point: the result is valid until the next Invoke on this thread
+    thread_local std::string response;
+    cli_call(address, payload, payload ? std::strlen(payload) : 0, false, options, response);
+    return response.c_str();
+}
 
-    std::cout << "CLI: Invoke called" << std::endl;
-    std::cout << "CLI: address='" << (address ? address : "null") << "'" << std::endl;
-    std::cout << "CLI: payload='" << (payload ? payload : "null") << "'" << std::endl;
-    std::cout << "CLI: pptions='" << (options ? options : "null") << "'" << std::endl;
-    
-    handler_list handlers = cli_with();
+extern "C" bool Invoke2(const char* address, const char* payload, const char* options, libsresult* out) {
+    return cli_call_owned(address, payload, payload ? std::strlen(payload) : 0, false, options, out);
+}
+
+extern "C" bool InvokeBytes(const char* address, const char* payload, std::size_t payload_len,
+                            const char* options, libsresult* out) {
+    return cli_call_owned(address, payload, payload_len, true, options, out);
+}
+
+extern "C" long ResolveHandler(const char* address) {
+    return cli_table().index_of(address ? address : "");
+}
+
+extern "C" bool InvokeHandler(long index, const char* payload, std::size_t payload_len,
+                              const char* options, libsresult* out) {
+    if (!out) return false;
     
-    for (const auto& handler : handlers) {
-        if (handler.sid == address) {
-            std::string err;
-            try {
-                std::any result = handler.fun(payload, options, err);
-                static std::string response;
-                response = std::any_cast<std::string>(result);
-                return response.c_str();
-            } catch (const std::exception& ex) {
-                static std::string response = R"({"success":false,"error":")" + std::string(ex.what()) + R"("})";
-                return response.c_str();
-            }
-        }
+    auto* response = new std::string();
+    const handler_def* handler = cli_table().at(index);
+    if (handler) {
+        cli_run(*handler, payload, payload_len, true, options, *response);
+    } else {
+        *response = R"({"success":false,"error":"handler not found"})";
     }
-    
-    return R"({"success":false,"error":"handler not found"})";
+    out->data = response->c_str();
+    out->size = response->size();
+    out->owner = response;
+    return handler != nullptr;
+}
+
+extern "C" bool InvokeDeferred(const char* address, const char* payload, std::size_t payload_len,
+                               const char* options, CompletionFn callback, void* user_data) {
+    const handler_def* handler = cli_table().find(address ? address : "");
+    if (!handler) return false;
+
+    if (handler->co) {
+        handler_spawn(*handler, payload, payload_len, options, callback, user_data);
+        return true;
+    }
+    std::string response;
+    cli_run(*handler, payload, payload_len, true, options, response);
+    libsresult result = {response.c_str(), response.size(), nullptr};
+    callback(true, &result, user_data);
+    return true;
+}
+
+extern "C" void Release(libsresult* result) {
+    if (!result) return;
+    delete static_cast<std::string*>(result->owner);
+    *result = {};
 }
@@ -5,3 +5,8 @@ handler_list cli_with() {
         // CLI plugin has no addresses yet - placeholder
     };
 }
+
+const handler_table& cli_table() {
+    static const handler_table table(cli_with());
+    return table;
+}
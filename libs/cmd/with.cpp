@@ -5,3 +5,8 @@ handler_list cmd_with() {
         // CMD plugin has no addresses yet - placeholder
     };
 }
+
+const handler_table& cmd_table() {
+    static const handler_table table(cmd_with());
+    return table;
+}
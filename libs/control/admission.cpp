@@ -0,0 +1,348 @@
+#include "admission.h"
+#include "deadline.h"
+#include "json.h"
+#include "reactor.h"
+#include "registry.h"
+#include "timer.h"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+
+enum class waiter_state { waiting, granted, shed, expired };
+
+// A queued call. One queued by its own thread sleeps on wake; one queued by
+// admission_enqueue is handed its ticket through resume by whoever settles it. Only
+// touched under the gate's lock.
+struct waiter {
+    std::condition_variable wake;
+    waiter_state state = waiter_state::waiting;
+    std::size_t priority = 0;
+    std::chrono::steady_clock::time_point since;
+
+    admission_resume resume;
+    call_context context;              // checked by the expiry timer
+    timer_id expiry = 0;
+    const char* expired = nullptr;     // why, for an expired one
+};
+
+using waiter_ptr = std::shared_ptr<waiter>;
+
+constexpr std::size_t kClasses = 3;
+
+// How often a queued call looks at its deadline and cancel tokens
+constexpr auto kRecheck = std::chrono::milliseconds(10);
+
+}
+
+struct admission_gate {
+    std::mutex lock;
+    admission_limit limit;
+    std::size_t running = 0;
+    std::size_t waiting_count = 0;
+    std::deque<waiter_ptr> waiting[kClasses];
+    std::uint64_t admitted = 0;
+    std::uint64_t queued = 0;
+    std::uint64_t shed = 0;
+
+    // Wakes a waiter, or keeps a queued one for settle(); caller holds lock
+    static void notify(const waiter_ptr& next, std::vector<waiter_ptr>& settled) {
+        if (next->resume) {
+            settled.push_back(next);
+        } else {
+            next->wake.notify_one();
+        }
+    }
+
+    // Caller holds lock
+    void grant(std::vector<waiter_ptr>& settled) {
+        while (running < limit.concurrency && waiting_count > 0) {
+            for (auto& queue : waiting) {
+                if (queue.empty()) continue;
+                waiter_ptr next = std::move(queue.front());
+                queue.pop_front();
+                --waiting_count;
+                ++running;
+                ++admitted;
+                next->state = waiter_state::granted;
+                notify(next, settled);
+                break;
+            }
+        }
+    }
+
+    // Turns away the newest waiter of the lowest class below priority; caller holds lock
+    bool displace_below(call_priority priority, std::vector<waiter_ptr>& settled) {
+        for (std::size_t c = kClasses; c-- > std::size_t(priority) + 1;) {
+            if (waiting[c].empty()) continue;
+            waiter_ptr victim = std::move(waiting[c].back());
+            waiting[c].pop_back();
+            --waiting_count;
+            ++shed;
+            victim->state = waiter_state::shed;
+            notify(victim, settled);
+            return true;
+        }
+        return false;
+    }
+
+    // Takes a slot for a call of priority, setting admitted_now, or else makes room for it
+    // in the queue. Returns why the call is turned away, null if it may go on or queue;
+    // caller holds lock.
+    const char* enter(call_priority priority, bool may_wait, bool& admitted_now, std::vector<waiter_ptr>& settled) {
+        admitted_now = running < limit.concurrency;
+        if (admitted_now) {
+            ++running;
+            ++admitted;
+            return nullptr;
+        }
+        if (!may_wait || (waiting_count >= limit.queue && !displace_below(priority, settled))) {
+            ++shed;
+            return "overloaded";
+        }
+        return nullptr;
+    }
+
+    void push(const waiter_ptr& self, call_priority priority) {
+        self->priority = std::size_t(priority);
+        self->since = std::chrono::steady_clock::now();
+        waiting[self->priority].push_back(self);
+        ++waiting_count;
+        ++queued;
+    }
+
+    // Hands queued calls their tickets, without the lock; resume only passes them on
+    static void settle(const std::shared_ptr<admission_gate>& gate, std::vector<waiter_ptr>& settled) {
+        for (auto& next : settled) {
+            if (next->expiry) timer_cancel(next->expiry);
+            std::shared_ptr<admission_ticket> ticket(new admission_ticket());
+            ticket->waited_ = std::chrono::steady_clock::now() - next->since;
+            if (next->state == waiter_state::granted) {
+                ticket->gate_ = gate;
+            } else {
+                ticket->refused_ = next->state == waiter_state::shed ? "overloaded" : next->expired;
+            }
+            next->resume(std::move(ticket));
+        }
+        settled.clear();
+    }
+
+    // Turns a queued call away once its deadline passes or it is cancelled, from the timer
+    static void watch_expiry(const std::shared_ptr<admission_gate>& gate, const waiter_ptr& self) {
+        const call_context& context = self->context;
+        bool deadline = context.deadline != deadline_clock::time_point::max();
+        if (!deadline && context.tokens.empty()) return;
+
+        // Tokens are polled; a deadline alone needs one look when it comes
+        auto left = std::chrono::ceil<std::chrono::milliseconds>(
+            std::max(context.deadline, deadline_clock::now()) - deadline_clock::now());
+        auto delay = context.tokens.empty() ? left : std::min<std::chrono::milliseconds>(left, kRecheck);
+        auto period = context.tokens.empty() ? std::chrono::milliseconds(0) : kRecheck;
+        self->expiry = timer_schedule(delay, period, std::make_shared<const std::function<void()>>(
+            [gate, weak = std::weak_ptr<waiter>(self)] {
+                waiter_ptr queued = weak.lock();
+                if (!queued) return;
+                std::vector<waiter_ptr> settled;
+                {
+                    std::lock_guard<std::mutex> lock(gate->lock);
+                    if (queued->state != waiter_state::waiting) return;
+                    const char* reason = call_interrupted(queued->context);
+                    if (!reason) return;
+                    auto& queue = gate->waiting[queued->priority];
+                    queue.erase(std::find(queue.begin(), queue.end(), queued));
+                    --gate->waiting_count;
+                    queued->state = waiter_state::expired;
+                    queued->expired = reason;
+                    settled.push_back(queued);
+                }
+                settle(gate, settled);
+            }));
+    }
+};
+
+namespace {
+
+std::atomic<bool> g_any{false};
+std::shared_mutex g_gates_lock;
+std::unordered_map<std::string, std::shared_ptr<admission_gate>, route_hash, std::equal_to<>> g_gates;
+
+std::atomic<std::uint64_t> g_version{1};  // bumped under g_gates_lock when a limit is set or lifted
+
+// The gate this thread last found for each handle, good while the version holds. A lifted
+// gate stays here until the thread's next call through the handle drops it.
+struct site_gate {
+    std::uint64_t version = 0;
+    std::shared_ptr<admission_gate> gate;
+};
+thread_local std::vector<site_gate> t_sites;
+
+std::shared_ptr<admission_gate> find_gate(std::string_view address) {
+    if (!g_any.load(std::memory_order_acquire)) return nullptr;
+    std::shared_lock<std::shared_mutex> lock(g_gates_lock);
+    auto it = g_gates.find(address);
+    return it == g_gates.end() ? nullptr : it->second;
+}
+
+std::shared_ptr<admission_gate> find_gate(std::string_view address, std::size_t site) {
+    if (site == 0 || !g_any.load(std::memory_order_acquire)) return find_gate(address);
+    if (site > t_sites.size()) t_sites.resize(site);
+    site_gate& cached = t_sites[site - 1];
+    if (cached.version != g_version.load(std::memory_order_acquire)) {
+        std::shared_lock<std::shared_mutex> lock(g_gates_lock);
+        auto it = g_gates.find(address);
+        cached.gate = it == g_gates.end() ? nullptr : it->second;
+        cached.version = g_version.load(std::memory_order_relaxed);
+    }
+    return cached.gate;
+}
+
+}
+
+void admission_set(std::string_view address, admission_limit limit) {
+    std::unique_lock<std::shared_mutex> table(g_gates_lock);
+    auto it = g_gates.find(address);
+    std::shared_ptr<admission_gate> target;
+    if (limit.concurrency == 0) {
+        if (it == g_gates.end()) return;
+        // The calls queued on it or holding one of its slots keep the gate until they finish
+        target = std::move(it->second);
+        g_gates.erase(it);
+        g_version.fetch_add(1, std::memory_order_release);
+        g_any.store(!g_gates.empty(), std::memory_order_release);
+        limit.concurrency = std::numeric_limits<std::size_t>::max();  // everyone still queued goes ahead
+    } else {
+        if (it == g_gates.end()) {
+            it = g_gates.try_emplace(std::string(address), std::make_shared<admission_gate>()).first;
+            g_version.fetch_add(1, std::memory_order_release);
+            g_any.store(true, std::memory_order_release);
+        }
+        target = it->second;
+    }
+    table.unlock();
+
+    std::vector<waiter_ptr> settled;
+    {
+        std::lock_guard<std::mutex> lock(target->lock);
+        target->limit = limit;
+        target->grant(settled);
+    }
+    admission_gate::settle(target, settled);
+}
+
+bool admission_limited(std::string_view address) {
+    return find_gate(address) != nullptr;
+}
+
+std::string admission_report() {
+    std::map<std::string, std::shared_ptr<admission_gate>> gates;
+    {
+        std::shared_lock<std::shared_mutex> lock(g_gates_lock);
+        gates.insert(g_gates.begin(), g_gates.end());
+    }
+
+    std::string out = "[";
+    for (const auto& [address, entry] : gates) {
+        std::lock_guard<std::mutex> lock(entry->lock);
+        if (out.size() > 1) out += ",";
+        out += R"({"address":")" + json_escape(address) + R"(","concurrency":)" +
+               std::to_string(entry->limit.concurrency) + R"(,"queue":)" + std::to_string(entry->limit.queue) +
+               R"(,"running":)" + std::to_string(entry->running) + R"(,"waiting":)" +
+               std::to_string(entry->waiting_count) + R"(,"admitted":)" + std::to_string(entry->admitted) +
+               R"(,"queued":)" + std::to_string(entry->queued) + R"(,"shed":)" + std::to_string(entry->shed) + "}";
+    }
+    out += "]";
+    return out;
+}
+
+admission_ticket::admission_ticket(std::string_view address, std::size_t site) {
+    std::shared_ptr<admission_gate> target = find_gate(address, site);
+    if (!target) return;
+
+    std::vector<waiter_ptr> settled;  // a queued call this one displaced
+    std::unique_lock<std::mutex> lock(target->lock);
+    call_priority priority = call_current_priority();
+    bool admitted = false;
+    // A reactor loop can't wait: the call that frees the slot may be queued behind it
+    refused_ = target->enter(priority, !reactor_on_loop(), admitted, settled);
+    if (admitted) {
+        gate_ = std::move(target);
+        return;
+    }
+    if (refused_) return;
+
+    auto self = std::make_shared<waiter>();
+    target->push(self, priority);
+    if (!settled.empty()) {
+        lock.unlock();
+        admission_gate::settle(target, settled);
+        lock.lock();
+    }
+
+    auto deadline = call_deadline();
+    while (self->state == waiter_state::waiting) {
+        self->wake.wait_until(lock, std::min(deadline, std::chrono::steady_clock::now() + kRecheck));
+        if (self->state != waiter_state::waiting) break;
+        if (const char* reason = call_interrupted()) {
+            auto& queue = target->waiting[self->priority];
+            queue.erase(std::find(queue.begin(), queue.end(), self));
+            --target->waiting_count;
+            refused_ = reason;
+            break;
+        }
+    }
+    waited_ = std::chrono::steady_clock::now() - self->since;
+
+    if (self->state == waiter_state::granted) {
+        gate_ = std::move(target);
+    } else if (self->state == waiter_state::shed) {
+        refused_ = "overloaded";
+    }
+}
+
+admission_ticket::~admission_ticket() {
+    if (!gate_) return;
+    std::vector<waiter_ptr> settled;
+    {
+        std::lock_guard<std::mutex> lock(gate_->lock);
+        --gate_->running;
+        gate_->grant(settled);
+    }
+    admission_gate::settle(gate_, settled);
+}
+
+std::shared_ptr<admission_ticket> admission_enqueue(std::string_view address, admission_resume resume) {
+    std::shared_ptr<admission_ticket> ticket(new admission_ticket());
+    std::shared_ptr<admission_gate> target = find_gate(address);
+    if (!target) return ticket;
+
+    std::vector<waiter_ptr> settled;
+    {
+        std::lock_guard<std::mutex> lock(target->lock);
+        call_priority priority = call_current_priority();
+        bool admitted = false;
+        ticket->refused_ = target->enter(priority, true, admitted, settled);
+        if (admitted) {
+            ticket->gate_ = std::move(target);
+            return ticket;
+        }
+        if (ticket->refused_) return ticket;
+
+        auto self = std::make_shared<waiter>();
+        self->resume = std::move(resume);
+        self->context = call_current();
+        target->push(self, priority);
+        admission_gate::watch_expiry(target, self);
+    }
+    admission_gate::settle(target, settled);
+    return nullptr;
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+
+// Admission control. An address can be given a concurrency limit and a bounded queue;
+// calls beyond the limit wait in the queue, interactive before normal before bulk and
+// first come first served within a class. A call that finds the queue full displaces the
+// newest waiter of a lower class if there is one and is otherwise shed at once with an
+// "overloaded" error. Waiting ends early at the call's deadline or when it is cancelled.
+// Addresses without a limit are admitted without any locking.
+//
+// A synchronous dispatch queues on the thread it was made on, so a handler must not wait
+// on a limited address that its own call already holds every slot of. On a reactor loop
+// it doesn't queue at all and is shed instead. Asynchronous dispatch never waits: its
+// calls queue on the gate without a thread (admission_enqueue).
+
+struct admission_limit {
+    std::size_t concurrency = 0;  // 0 removes the limit
+    std::size_t queue = 0;        // waiters allowed beyond the running calls
+};
+
+void admission_set(std::string_view address, admission_limit limit);
+
+// True while address has a limit
+bool admission_limited(std::string_view address);
+
+// JSON array with each limited address: its limit, running and waiting calls, and how
+// many calls were admitted, queued and shed
+std::string admission_report();
+
+struct admission_gate;
+class admission_ticket;
+using admission_resume = std::function<void(std::shared_ptr<admission_ticket> ticket)>;
+
+// Holds a slot for address for the scope of the object, taken under the current call's
+// priority and deadline (see deadline.h). site is the handle (see handles.h) the call came
+// through, 0 for none: each thread keeps the gate it found for a handle until a limit is
+// set or lifted.
+class admission_ticket {
+public:
+    explicit admission_ticket(std::string_view address, std::size_t site = 0);
+    ~admission_ticket();
+    admission_ticket(const admission_ticket&) = delete;
+    admission_ticket& operator=(const admission_ticket&) = delete;
+
+    // Why the call was not admitted ("overloaded", "deadline exceeded" or "cancelled"),
+    // null once it holds a slot or when the address has no limit
+    const char* refused() const { return refused_; }
+
+    // Time spent queued before the slot was granted or the call turned away
+    std::chrono::steady_clock::duration waited() const { return waited_; }
+
+private:
+    friend struct admission_gate;
+    friend std::shared_ptr<admission_ticket> admission_enqueue(std::string_view, admission_resume);
+    admission_ticket() = default;
+
+    std::shared_ptr<admission_gate> gate_;  // keeps the gate of a lifted limit for its calls
+    const char* refused_ = nullptr;
+    std::chrono::steady_clock::duration waited_{};
+};
+
+// The ticket for a call that must not hold its thread while it waits. Returns it at once
+// when the call is admitted or turned away without queueing. Otherwise the call is queued
+// with the current call's limits and null is returned; resume later gets the ticket, on
+// the thread whose ticket freed the slot or on the timer thread at the deadline, so it
+// must hand the call to an executor rather than run it.
+std::shared_ptr<admission_ticket> admission_enqueue(std::string_view address, admission_resume resume);
@@ -1,10 +1,71 @@
 #include "contract.h"
+#include "registry.h"
+#include "pool.h"
+#include "json.h"
+#include "stats.h"
+#include "trace.h"
+#include "cache.h"
+#include "admission.h"
+#include "reactor.h"
+#include "timer.h"
+#include "watchdog.h"
+#include <cstdlib>
 #include <iostream>
 
 DispatchFn g_dispatch = nullptr;
+bool g_log_calls = false;
 
 extern "C" bool Attach(DispatchFn dispatch, char* /* err_buf */, std::size_t /* err_cap */) {
     g_dispatch = dispatch;
+    g_log_calls = std::getenv(kLogCallsEnv) != nullptr;
+    control_pool_open();
+    timer_open();
     std::cout << "CONTROL: Attach() called" << std::endl;
     return true;
 }
+
+extern "C" bool AttachEx(DispatchFn dispatch, const libshandoff* libs, std::size_t count,
+                         const char* options, char* err_buf, std::size_t err_cap) {
+    if (!Attach(dispatch, err_buf, err_cap)) return false;
+    std::string_view settings = options ? options : "";
+    control_set_lazy(json_bool(settings, "lazy", true));
+    g_log_calls = json_bool(settings, "log_calls", g_log_calls);
+    stats_enable(json_bool(settings, "stats", true));
+    stats_enable_cpu(json_bool(settings, "cpu_stats", false));
+    stats_enable_heap(json_bool(settings, "memstats", false));
+    if (long long cache_mb = json_int(settings, "cache_mb", -1); cache_mb >= 0) {
+        cache_set_capacity(std::size_t(cache_mb) << 20);
+    }
+    stats_dump_every(std::chrono::milliseconds(json_int(settings, "stats_dump_ms", 0)));
+    // {"limits":{"llm.query":{"concurrency":2,"queue":16}}}, as control.limit takes them
+    if (auto limits = json_find(settings, "limits")) {
+        json_object_each(*limits, [](std::string_view address, std::string_view limit) {
+            long long concurrency = json_int(limit, "concurrency", 0);
+            long long queue = json_int(limit, "queue", 0);
+            if (concurrency > 0 && queue >= 0) admission_set(address, {std::size_t(concurrency), std::size_t(queue)});
+        });
+    }
+    // {"budgets":{"*":{"wall_ms":5000},"llm.query":{"cpu_ms":2000,"action":"cancel"}}}, as
+    // control.watchdog takes them
+    if (auto budgets = json_find(settings, "budgets")) {
+        json_object_each(*budgets, [](std::string_view address, std::string_view budget) {
+            watchdog_set(address, watchdog_parse(budget));
+        });
+    }
+    // InvokeAsync on one pinned loop per core instead of the shared pool; "reactor_cores"
+    // defaults to one per hardware thread. The pool stays open for batches and discovery.
+    if (auto executor = json_find(settings, "executor"); executor && json_text(*executor) == "reactor") {
+        long long cores = json_int(settings, "reactor_cores", 0);
+        reactor_start(cores > 0 ? std::size_t(cores) : 0);
+    }
+    // Traces from the start, written out at Detach
+    if (auto path = json_find(settings, "trace")) {
+        std::string error;
+        if (!trace_start(json_text(*path), kTraceCapacity, error)) {
+            std::cout << "CONTROL: Not tracing: " << error << std::endl;
+        }
+    }
+    control_adopt(libs, count);
+    std::cout << "CONTROL: Host handed over " << count << " libraries" << std::endl;
+    return true;
+}
@@ -0,0 +1,124 @@
+// Benchmark InvokeAsync throughput on the shared pool vs the thread-per-core reactor.
+// Loads libcontrol, discovers the plugins in the working directory and keeps a window of
+// asynchronous calls in flight from a few submitting threads, once per executor. Run it
+// from dist:
+//
+//   bench_executor [libcontrol path] [address ...]
+//
+// Control logs every dispatch to stdout, so the results go to stderr.
+#include "contract.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <dlfcn.h>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__APPLE__)
+static const char* kDefaultLibrary = "./libcontrol.dylib";
+#else
+static const char* kDefaultLibrary = "./libcontrol.so";
+#endif
+
+using AttachExFn = bool (*)(DispatchFn, const libshandoff*, std::size_t, const char*, char*, std::size_t);
+using DetachFn = bool (*)(char*, std::size_t);
+using InvokeFn = const char* (*)(const char*, const char*, const char*);
+using InvokeAsyncFn = bool (*)(const char*, const char*, const char*, CompletionFn, void*);
+
+constexpr std::size_t kCalls = 200000;
+constexpr std::size_t kWindow = 256;  // per submitting thread
+constexpr std::size_t kSubmitters = 2;
+
+struct control_api {
+    AttachExFn attach;
+    DetachFn detach;
+    InvokeFn invoke;
+    InvokeAsyncFn invoke_async;
+};
+
+struct submitter {
+    std::atomic<std::size_t> done{0};
+    std::atomic<std::size_t> failed{0};
+};
+
+static void on_done(bool handled, const libsresult* result, void* user_data) {
+    auto* self = static_cast<submitter*>(user_data);
+    std::string_view response = result && result->data ? std::string_view(result->data, result->size) : "";
+    if (!handled || response.find(R"("success":false)") != std::string_view::npos) {
+        self->failed.fetch_add(1, std::memory_order_relaxed);
+    }
+    self->done.fetch_add(1, std::memory_order_release);
+}
+
+static void run(const control_api& api, const char* label, const char* settings,
+                const std::vector<std::string>& addresses) {
+    char err[256] = {0};
+    if (!api.attach(api.invoke, nullptr, 0, settings, err, sizeof(err))) {
+        std::cerr << label << ": attach failed: " << err << std::endl;
+        return;
+    }
+    api.invoke("control.run", "{}", "{}");
+
+    std::vector<submitter> submitters(kSubmitters);
+    std::size_t per_thread = kCalls / kSubmitters;
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (std::size_t t = 0; t < kSubmitters; ++t) {
+        threads.emplace_back([&, t] {
+            submitter& self = submitters[t];
+            for (std::size_t sent = 0; sent < per_thread; ++sent) {
+                while (sent - self.done.load(std::memory_order_acquire) >= kWindow) std::this_thread::yield();
+                const std::string& address = addresses[(sent + t) % addresses.size()];
+                if (!api.invoke_async(address.c_str(), "{}", nullptr, on_done, &self)) {
+                    self.failed.fetch_add(1, std::memory_order_relaxed);
+                    self.done.fetch_add(1, std::memory_order_release);
+                }
+            }
+            while (self.done.load(std::memory_order_acquire) < per_thread) std::this_thread::yield();
+        });
+    }
+    for (auto& thread : threads) thread.join();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::size_t failed = 0;
+    for (const auto& self : submitters) failed += self.failed.load();
+    std::cerr << label << ": " << std::size_t(double(per_thread * kSubmitters) / seconds) << " calls/s"
+              << " (" << failed << " failed)" << std::endl;
+    std::cerr << "  " << api.invoke("control.pool", "{}", "{}") << std::endl;
+
+    api.detach(err, sizeof(err));
+}
+
+int main(int argc, char** argv) {
+    const char* library = argc > 1 ? argv[1] : kDefaultLibrary;
+    std::vector<std::string> addresses;
+    for (int i = 2; i < argc; ++i) addresses.push_back(argv[i]);
+    if (addresses.empty()) addresses = {"efs.list", "log.write"};
+
+    void* handle = dlopen(library, RTLD_NOW);
+    if (!handle) {
+        std::cerr << "cannot load " << library << ": " << dlerror() << std::endl;
+        return 1;
+    }
+    control_api api = {
+        reinterpret_cast<AttachExFn>(dlsym(handle, "AttachEx")),
+        reinterpret_cast<DetachFn>(dlsym(handle, "Detach")),
+        reinterpret_cast<InvokeFn>(dlsym(handle, "Invoke")),
+        reinterpret_cast<InvokeAsyncFn>(dlsym(handle, "InvokeAsync")),
+    };
+    if (!api.attach || !api.detach || !api.invoke || !api.invoke_async) {
+        std::cerr << library << " is not control" << std::endl;
+        return 1;
+    }
+
+    std::cerr << "=== InvokeAsync throughput, " << kCalls << " calls, " << kSubmitters << " submitters ===" << std::endl;
+    run(api, "pool", R"({"stats":false})", addresses);
+    std::string reactor = R"({"stats":false,"executor":"reactor","reactor_cores":)" +
+                          std::to_string(std::max(1u, std::thread::hardware_concurrency())) + "}";
+    run(api, "reactor", reactor.c_str(), addresses);
+
+    dlclose(handle);
+    return 0;
+}
@@ -0,0 +1,126 @@
+// Benchmark handler lookup + call: per-request handler_list rebuild vs static handler_table,
+// then a request/response round trip through handler_def::fun vs a typed handler
+#include "handler.h"
+#include "typed.h"
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// The pre-table layout: owning strings and std::function, rebuilt on every request
+struct legacy_def {
+    std::string sid;
+    std::string tag;
+    std::function<std::any(const char*, const char*, std::string&)> fun;
+};
+
+static std::any bench_handle(const char* /* payload */, const char* /* options */, std::string& /* err */) {
+    return std::string(R"({"success":true})");
+}
+
+static const char* kSids[] = {
+    "bench.alpha", "bench.bravo", "bench.charlie", "bench.delta",
+    "bench.echo", "bench.foxtrot", "bench.golf", "bench.hotel",
+};
+
+static std::vector<legacy_def> legacy_with() {
+    std::vector<legacy_def> list;
+    for (const char* sid : kSids) list.push_back({sid, "bench", bench_handle});
+    return list;
+}
+
+static handler_list bench_with() {
+    handler_list list;
+    for (const char* sid : kSids) list.push_back({sid, "bench", bench_handle});
+    return list;
+}
+
+// The same read-style handler written both ways
+static std::any any_read(const char* payload, const char* /* options */, std::string& /* err */) {
+    std::string path;
+    std::string p(payload);
+    std::size_t pos = p.find("\"path\":");
+    if (pos != std::string::npos) {
+        pos = p.find('"', pos + 7);
+        std::size_t end = p.find('"', pos + 1);
+        if (pos != std::string::npos && end != std::string::npos) path = p.substr(pos + 1, end - pos - 1);
+    }
+    return std::string(R"({"success":true,"name":")" + path + R"(","size":)" + std::to_string(path.size()) + "}");
+}
+
+struct bench_request {
+    std::string path;
+
+    static constexpr auto fields() { return std::tuple{typed_field{"path", &bench_request::path}}; }
+};
+
+struct bench_response {
+    std::string name;
+    long size = 0;
+
+    static constexpr auto fields() {
+        return std::tuple{typed_field{"name", &bench_response::name}, typed_field{"size", &bench_response::size}};
+    }
+};
+
+static bench_response typed_read(const bench_request& request, std::string& /* err */) {
+    return {request.path, long(request.path.size())};
+}
+
+template <typename Fn>
+static double per_call_ns(int iterations, Fn&& fn) {
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i) fn(i);
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    return std::chrono::duration<double, std::nano>(elapsed).count() / iterations;
+}
+
+int main() {
+    constexpr int kIterations = 1000000;
+    constexpr int kSidCount = sizeof(kSids) / sizeof(kSids[0]);
+    std::size_t sink = 0;
+
+    double legacy = per_call_ns(kIterations, [&](int i) {
+        const char* address = kSids[i % kSidCount];
+        std::vector<legacy_def> handlers = legacy_with();
+        for (const auto& handler : handlers) {
+            if (handler.sid == address) {
+                std::string err;
+                sink += std::any_cast<std::string>(handler.fun("{}", "{}", err)).size();
+                break;
+            }
+        }
+    });
+
+    static const handler_table table(bench_with());
+    double tabled = per_call_ns(kIterations, [&](int i) {
+        const char* address = kSids[i % kSidCount];
+        if (const handler_def* handler = table.find(address)) {
+            std::string err;
+            sink += std::any_cast<std::string>(handler->fun("{}", "{}", err)).size();
+        }
+    });
+
+    const char* payload = R"({"path":"assets/config/settings.json"})";
+    handler_def any_def = {.sid = "bench.read", .tag = "bench", .fun = any_read};
+    double boxed = per_call_ns(kIterations, [&](int) {
+        std::string err;
+        sink += std::any_cast<std::string>(any_def.fun(payload, nullptr, err)).size();
+    });
+
+    handler_def typed_def = typed_handler<typed_read>("bench.read", "bench");
+    double typed = per_call_ns(kIterations, [&](int) {
+        std::string err;
+        sink += typed_def.bytes(payload, nullptr, err).size();
+    });
+
+    std::cout << "=== HANDLER DISPATCH (" << kSidCount << " handlers, " << kIterations << " calls) ===" << std::endl;
+    std::cout << "rebuild + linear scan: " << legacy << " ns/call" << std::endl;
+    std::cout << "static handler_table:  " << tabled << " ns/call" << std::endl;
+    std::cout << "=== REQUEST ROUND TRIP (" << kIterations << " calls) ===" << std::endl;
+    std::cout << "fun + std::any:        " << boxed << " ns/call" << std::endl;
+    std::cout << "typed_handler:         " << typed << " ns/call" << std::endl;
+    std::cout << "(checksum " << sink << ")" << std::endl;
+    return 0;
+}
@@ -0,0 +1,397 @@
+#include "bus.h"
+#include "deadline.h"
+#include "json.h"
+#include "pool.h"
+#include "reactor.h"
+#include "registry.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace {
+
+constexpr std::size_t kDefaultCapacity = 1024;
+
+// Events per Deliver call, and batches a drain runs before it yields its pool thread
+constexpr std::size_t kBatch = 64;
+constexpr std::size_t kBatchesPerDrain = 16;
+
+// How often a blocked publisher looks at its deadline and cancel tokens
+constexpr auto kRecheck = std::chrono::milliseconds(10);
+
+// How long unsubscribing waits for a delivery in progress
+constexpr auto kGracePeriod = std::chrono::milliseconds(2000);
+
+std::size_t round_up_pow2(std::size_t n) {
+    std::size_t size = 1;
+    while (size < n) size <<= 1;
+    return size;
+}
+
+struct counter {
+    std::atomic<std::uint64_t> value{0};
+
+    void add(std::uint64_t n = 1) { value.fetch_add(n, std::memory_order_relaxed); }
+    std::uint64_t get() const { return value.load(std::memory_order_relaxed); }
+};
+
+}
+
+struct bus_subscription {
+    // Bounded multi-producer multi-consumer ring: publishers push, the drain pops, and a
+    // publisher dropping the oldest event pops too. Each cell's sequence says whose turn it
+    // is, so neither side takes a lock. Popping swaps strings with the cell, so buffers
+    // circulate instead of being allocated per event.
+    struct cell {
+        std::atomic<std::size_t> sequence{0};
+        std::string data;
+    };
+
+    std::uint64_t id = 0;
+    std::string topic;
+    std::string owner;
+    libsoverflow overflow = LIBS_DROP_OLDEST;
+    DeliverFn deliver = nullptr;
+    void* user_data = nullptr;
+    PluginDeliverFn plugin_deliver = nullptr;
+
+    std::size_t capacity = 0;
+    std::unique_ptr<cell[]> cells;
+    alignas(64) std::atomic<std::size_t> enqueue_pos{0};
+    alignas(64) std::atomic<std::size_t> dequeue_pos{0};
+
+    alignas(64) std::atomic<bool> scheduled{false};  // a drain is queued or running
+    std::atomic<bool> closed{false};
+    std::atomic<int> delivering{0};
+
+    // Only publishers waiting under LIBS_BLOCK touch these
+    std::atomic<int> blocked{0};
+    std::mutex room_lock;
+    std::condition_variable room;
+
+    counter published, delivered, dropped, batches, waits;
+
+    explicit bus_subscription(std::size_t requested) : capacity(round_up_pow2(requested ? requested : kDefaultCapacity)) {
+        cells = std::make_unique<cell[]>(capacity);
+        for (std::size_t i = 0; i < capacity; ++i) cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    bool try_push(const char* data, std::size_t size) {
+        std::size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+        while (true) {
+            cell& slot = cells[pos & (capacity - 1)];
+            std::size_t sequence = slot.sequence.load(std::memory_order_acquire);
+            auto diff = std::ptrdiff_t(sequence) - std::ptrdiff_t(pos);
+            if (diff == 0) {
+                if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    slot.data.assign(data ? data : "", size);
+                    slot.sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;  // full
+            } else {
+                pos = enqueue_pos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    bool try_pop(std::string& out) {
+        std::size_t pos = dequeue_pos.load(std::memory_order_relaxed);
+        while (true) {
+            cell& slot = cells[pos & (capacity - 1)];
+            std::size_t sequence = slot.sequence.load(std::memory_order_acquire);
+            auto diff = std::ptrdiff_t(sequence) - std::ptrdiff_t(pos + 1);
+            if (diff == 0) {
+                if (dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    out.swap(slot.data);
+                    slot.sequence.store(pos + capacity, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;  // empty
+            } else {
+                pos = dequeue_pos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    std::size_t depth() const {
+        std::size_t head = dequeue_pos.load(std::memory_order_relaxed);
+        std::size_t tail = enqueue_pos.load(std::memory_order_relaxed);
+        return tail > head ? tail - head : 0;
+    }
+
+    // Called by the drain after it made room
+    void signal_room() {
+        if (blocked.load() == 0) return;
+        std::lock_guard<std::mutex> lock(room_lock);
+        room.notify_all();
+    }
+};
+
+namespace {
+
+using subscriber_list = std::vector<std::shared_ptr<bus_subscription>>;
+
+// Lists are replaced rather than edited, so a publisher takes one reference under the
+// shared lock and fans out without holding it
+std::shared_mutex g_bus_lock;
+std::unordered_map<std::string, std::shared_ptr<const subscriber_list>, route_hash, std::equal_to<>> g_topics;
+std::atomic<bool> g_any{false};
+std::atomic<std::uint64_t> g_next_id{1};
+
+// The subscription whose Deliver is running on this thread
+thread_local const bus_subscription* t_delivering = nullptr;
+
+std::shared_ptr<const subscriber_list> subscribers_of(std::string_view topic) {
+    if (!g_any.load(std::memory_order_acquire)) return nullptr;
+    std::shared_lock<std::shared_mutex> lock(g_bus_lock);
+    auto it = g_topics.find(topic);
+    return it == g_topics.end() ? nullptr : it->second;
+}
+
+std::shared_ptr<bus_subscription> add(std::shared_ptr<bus_subscription> subscription) {
+    subscription->id = g_next_id.fetch_add(1, std::memory_order_relaxed);
+    std::unique_lock<std::shared_mutex> lock(g_bus_lock);
+    auto& list = g_topics[subscription->topic];
+    auto updated = list ? std::make_shared<subscriber_list>(*list) : std::make_shared<subscriber_list>();
+    updated->push_back(subscription);
+    list = std::move(updated);
+    g_any.store(true, std::memory_order_release);
+    return subscription;
+}
+
+// Takes the subscription out of its topic; false if it wasn't there
+bool remove_from_topic(const bus_subscription& subscription) {
+    std::unique_lock<std::shared_mutex> lock(g_bus_lock);
+    auto it = g_topics.find(subscription.topic);
+    if (it == g_topics.end()) return false;
+    auto updated = std::make_shared<subscriber_list>();
+    for (const auto& entry : *it->second) {
+        if (entry.get() != &subscription) updated->push_back(entry);
+    }
+    if (updated->size() == it->second->size()) return false;
+    if (updated->empty()) {
+        g_topics.erase(it);
+    } else {
+        it->second = std::move(updated);
+    }
+    g_any.store(!g_topics.empty(), std::memory_order_release);
+    return true;
+}
+
+void deliver(bus_subscription& subscription, const std::vector<std::string>& batch, std::size_t count,
+             std::vector<libsevent>& events) {
+    // Paired with closed/delivering in bus_unsubscribe: either it sees this delivery or
+    // this sees the subscription closed
+    subscription.delivering.fetch_add(1);
+    if (subscription.closed.load()) {
+        subscription.dropped.add(count);
+        subscription.delivering.fetch_sub(1);
+        return;
+    }
+
+    events.clear();
+    for (std::size_t i = 0; i < count; ++i) {
+        events.push_back({subscription.topic.c_str(), batch[i].data(), batch[i].size()});
+    }
+    const bus_subscription* outer = std::exchange(t_delivering, &subscription);
+    if (subscription.plugin_deliver) {
+        subscription.plugin_deliver(events.data(), count);
+    } else {
+        subscription.deliver(events.data(), count, subscription.user_data);
+    }
+    t_delivering = outer;
+    subscription.delivered.add(count);
+    subscription.batches.add();
+    subscription.delivering.fetch_sub(1);
+}
+
+void schedule(const std::shared_ptr<bus_subscription>& subscription, work_pool* pool);
+
+void drain(const std::shared_ptr<bus_subscription>& subscription, work_pool* pool) {
+    std::vector<std::string> batch(kBatch);
+    std::vector<libsevent> events;
+    events.reserve(kBatch);
+
+    for (std::size_t round = 0;; ++round) {
+        if (round == kBatchesPerDrain) {
+            // Still busy: go to the back of the pool so other work gets a turn
+            subscription->scheduled.store(false);
+            schedule(subscription, pool);
+            return;
+        }
+
+        std::size_t count = 0;
+        while (count < kBatch && subscription->try_pop(batch[count])) ++count;
+        if (count == 0) {
+            subscription->scheduled.store(false);
+            // A publisher that pushed after the last pop may have seen scheduled still set
+            if (subscription->depth() == 0 || subscription->scheduled.exchange(true)) return;
+            continue;
+        }
+        subscription->signal_room();
+        deliver(*subscription, batch, count, events);
+    }
+}
+
+void schedule(const std::shared_ptr<bus_subscription>& subscription, work_pool* pool) {
+    if (subscription->scheduled.exchange(true)) return;
+    if (!pool->submit([subscription, pool] { drain(subscription, pool); })) {
+        subscription->scheduled.store(false);
+    }
+}
+
+// Waits for room under LIBS_BLOCK, helping the pool meanwhile, since the drain that makes
+// room may be queued behind this very thread. Gives up when the call's deadline passes or
+// it is cancelled, or the subscription goes away.
+bool push_blocking(bus_subscription& subscription, const char* data, std::size_t size, work_pool* pool) {
+    subscription.waits.add();
+    subscription.blocked.fetch_add(1);
+    bool pushed = false;
+    while (!(pushed = subscription.try_push(data, size))) {
+        if (subscription.closed.load() || call_interrupted()) break;
+        if (pool->run_one()) continue;
+        std::unique_lock<std::mutex> lock(subscription.room_lock);
+        subscription.room.wait_for(lock, kRecheck, [&] { return pushed = subscription.try_push(data, size); });
+        if (pushed) break;
+    }
+    subscription.blocked.fetch_sub(1);
+    return pushed;
+}
+
+bool push(bus_subscription& subscription, const char* data, std::size_t size, work_pool* pool) {
+    if (subscription.closed.load(std::memory_order_relaxed)) return false;
+    bool pushed = subscription.try_push(data, size);
+    // A subscriber publishing to its own topic from Deliver would wait on itself, and a
+    // reactor loop would stall every call it owns; both give up at once as at a deadline
+    if (!pushed && subscription.overflow == LIBS_BLOCK) {
+        if (t_delivering != &subscription && !reactor_on_loop()) pushed = push_blocking(subscription, data, size, pool);
+        if (!pushed) subscription.dropped.add();
+    } else if (!pushed) {
+        std::string oldest;
+        while (!(pushed = subscription.try_push(data, size))) {
+            if (subscription.try_pop(oldest)) subscription.dropped.add();
+        }
+    }
+    if (pushed) subscription.published.add();
+    return pushed;
+}
+
+std::shared_ptr<bus_subscription> make(std::string_view topic, std::size_t capacity, libsoverflow overflow,
+                                       std::string owner) {
+    auto subscription = std::make_shared<bus_subscription>(capacity);
+    subscription->topic = std::string(topic);
+    subscription->owner = std::move(owner);
+    subscription->overflow = overflow == LIBS_BLOCK ? LIBS_BLOCK : LIBS_DROP_OLDEST;
+    return subscription;
+}
+
+}
+
+std::shared_ptr<bus_subscription> bus_subscribe(std::string_view topic, std::size_t capacity, libsoverflow overflow,
+                                                DeliverFn deliver, void* user_data, std::string owner) {
+    auto subscription = make(topic, capacity, overflow, std::move(owner));
+    subscription->deliver = deliver;
+    subscription->user_data = user_data;
+    return add(std::move(subscription));
+}
+
+std::shared_ptr<bus_subscription> bus_subscribe(std::string_view topic, std::size_t capacity, libsoverflow overflow,
+                                                PluginDeliverFn deliver, std::string owner) {
+    auto subscription = make(topic, capacity, overflow, std::move(owner));
+    subscription->plugin_deliver = deliver;
+    return add(std::move(subscription));
+}
+
+std::uint64_t bus_id(const bus_subscription& subscription) {
+    return subscription.id;
+}
+
+bool bus_unsubscribe(bus_subscription& subscription) {
+    remove_from_topic(subscription);
+    subscription.closed.store(true);
+    subscription.signal_room();
+
+    // From its own Deliver the count includes this very call
+    int own = t_delivering == &subscription ? 1 : 0;
+    auto until = std::chrono::steady_clock::now() + kGracePeriod;
+    while (subscription.delivering.load() > own) {
+        if (std::chrono::steady_clock::now() >= until) return false;
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    std::string discarded;
+    while (subscription.try_pop(discarded)) subscription.dropped.add();
+    return true;
+}
+
+bool bus_unsubscribe(std::uint64_t id) {
+    std::shared_ptr<bus_subscription> found;
+    {
+        std::shared_lock<std::shared_mutex> lock(g_bus_lock);
+        for (const auto& [topic, list] : g_topics) {
+            for (const auto& entry : *list) {
+                if (entry->id == id) found = entry;
+            }
+        }
+    }
+    return found && bus_unsubscribe(*found);
+}
+
+std::size_t bus_publish(std::string_view topic, const char* data, std::size_t size) {
+    std::shared_ptr<const subscriber_list> subscribers = subscribers_of(topic);
+    if (!subscribers) return 0;
+    pool_ref pool = control_pool();
+    if (!pool) return 0;
+
+    std::size_t reached = 0;
+    for (const auto& subscription : *subscribers) {
+        if (!push(*subscription, data, size, pool.get())) continue;
+        schedule(subscription, pool.get());
+        ++reached;
+    }
+    return reached;
+}
+
+std::string bus_report() {
+    std::map<std::string, std::shared_ptr<const subscriber_list>> topics;
+    {
+        std::shared_lock<std::shared_mutex> lock(g_bus_lock);
+        topics.insert(g_topics.begin(), g_topics.end());
+    }
+
+    std::string out = "[";
+    for (const auto& [topic, list] : topics) {
+        for (const auto& entry : *list) {
+            if (out.size() > 1) out += ",";
+            out += R"({"id":)" + std::to_string(entry->id) + R"(,"topic":")" + json_escape(topic) +
+                   R"(","owner":")" + json_escape(entry->owner) + R"(","capacity":)" +
+                   std::to_string(entry->capacity) + R"(,"overflow":")" +
+                   (entry->overflow == LIBS_BLOCK ? "block" : "drop_oldest") + R"(","depth":)" +
+                   std::to_string(entry->depth()) + R"(,"published":)" + std::to_string(entry->published.get()) +
+                   R"(,"delivered":)" + std::to_string(entry->delivered.get()) + R"(,"dropped":)" +
+                   std::to_string(entry->dropped.get()) + R"(,"batches":)" + std::to_string(entry->batches.get()) +
+                   R"(,"waits":)" + std::to_string(entry->waits.get()) + "}";
+        }
+    }
+    out += "]";
+    return out;
+}
+
+void bus_reset() {
+    std::vector<std::shared_ptr<bus_subscription>> left;
+    {
+        std::shared_lock<std::shared_mutex> lock(g_bus_lock);
+        for (const auto& [topic, list] : g_topics) left.insert(left.end(), list->begin(), list->end());
+    }
+    for (const auto& subscription : left) bus_unsubscribe(*subscription);
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "contract.h"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+
+// Publish/subscribe next to request/response dispatch. Each subscription has a bounded
+// lock-free queue of its own; publishing copies the event into the queue of every
+// subscriber of the topic and schedules a drain on control's pool for those that had none
+// pending. A drain hands the subscriber everything queued in batches, so one publisher
+// can fan out to many plugins without a dispatch per subscriber.
+
+struct bus_subscription;
+
+using PluginDeliverFn = void (*)(const libsevent* events, std::size_t count);
+
+// owner names the subscriber in reports: the plugin, or "host"
+std::shared_ptr<bus_subscription> bus_subscribe(std::string_view topic, std::size_t capacity, libsoverflow overflow,
+                                                DeliverFn deliver, void* user_data, std::string owner);
+std::shared_ptr<bus_subscription> bus_subscribe(std::string_view topic, std::size_t capacity, libsoverflow overflow,
+                                                PluginDeliverFn deliver, std::string owner);
+
+std::uint64_t bus_id(const bus_subscription& subscription);
+
+// Stops deliveries and drops the queue. False when a delivery was still running into the
+// subscriber after the grace period, in which case its code must stay loaded.
+bool bus_unsubscribe(bus_subscription& subscription);
+bool bus_unsubscribe(std::uint64_t id);
+
+// Returns how many subscribers the event was queued for; 0 while the pool is closed
+std::size_t bus_publish(std::string_view topic, const char* data, std::size_t size);
+
+// JSON array with each subscription: topic, owner, capacity, policy, depth and counters
+std::string bus_report();
+
+// Unsubscribes everything left, at Detach
+void bus_reset();
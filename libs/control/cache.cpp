@@ -0,0 +1,170 @@
+#include "cache.h"
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+
+namespace {
+
+constexpr std::size_t kShards = 16;
+
+using cache_clock = std::chrono::steady_clock;
+
+struct cache_entry {
+    std::string key;
+    std::size_t address_size;  // key starts with the address
+    std::string value;
+    std::uint64_t generation;
+    cache_clock::time_point expires;  // max() for entries without a ttl
+};
+
+struct alignas(64) cache_shard {
+    std::mutex lock;
+    std::list<cache_entry> lru;  // most recently used first
+    std::unordered_map<std::string_view, std::list<cache_entry>::iterator> index;  // views into lru keys
+    std::size_t bytes = 0;
+    std::uint64_t hits = 0;
+    std::uint64_t misses = 0;
+    std::uint64_t evictions = 0;
+    std::uint64_t invalidations = 0;
+    std::uint64_t stale = 0;  // puts dropped for an invalidation during their call
+};
+
+cache_shard g_shards[kShards];
+std::atomic<std::size_t> g_capacity{std::size_t(64) << 20};
+
+// Bumped before an invalidation sweeps the shards, so a put that checks it under a shard
+// lock either sees the bump or lands before the sweep reaches that shard
+std::atomic<std::uint64_t> g_sequence{0};
+
+// Address, then options, then payload; the separators can't occur in an address
+std::string make_key(std::string_view address, dispatch_payload payload, const char* options) {
+    std::string key;
+    std::string_view opts = options ? options : "";
+    key.reserve(address.size() + opts.size() + payload.size + 2);
+    key.append(address);
+    key.push_back('\0');
+    key.append(opts);
+    key.push_back('\0');
+    if (payload.data) key.append(payload.data, payload.size);
+    return key;
+}
+
+cache_shard& shard_for(std::string_view key) {
+    return g_shards[std::hash<std::string_view>{}(key) % kShards];
+}
+
+std::size_t entry_bytes(const cache_entry& entry) {
+    return entry.key.size() + entry.value.size() + sizeof(cache_entry);
+}
+
+// Caller holds the shard lock
+void erase(cache_shard& shard, std::list<cache_entry>::iterator it) {
+    shard.bytes -= entry_bytes(*it);
+    shard.index.erase(it->key);
+    shard.lru.erase(it);
+}
+
+}
+
+bool cache_get(std::string_view address, dispatch_payload payload, const char* options,
+               std::uint64_t generation, std::string& response) {
+    if (g_capacity.load(std::memory_order_relaxed) == 0) return false;
+    std::string key = make_key(address, payload, options);
+    cache_shard& shard = shard_for(key);
+
+    std::lock_guard<std::mutex> lock(shard.lock);
+    auto found = shard.index.find(key);
+    if (found == shard.index.end()) {
+        ++shard.misses;
+        return false;
+    }
+    auto it = found->second;
+    if (it->generation != generation || cache_clock::now() >= it->expires) {
+        erase(shard, it);
+        ++shard.misses;
+        return false;
+    }
+    shard.lru.splice(shard.lru.begin(), shard.lru, it);
+    response = it->value;
+    ++shard.hits;
+    return true;
+}
+
+std::uint64_t cache_sequence() {
+    return g_sequence.load(std::memory_order_acquire);
+}
+
+void cache_put(std::string_view address, dispatch_payload payload, const char* options,
+               std::uint64_t generation, std::uint64_t sequence, long ttl_ms, const std::string& response) {
+    std::size_t budget = g_capacity.load(std::memory_order_relaxed) / kShards;
+    cache_entry entry{make_key(address, payload, options), address.size(), response, generation,
+                      ttl_ms < 0 ? cache_clock::time_point::max()
+                                 : cache_clock::now() + std::chrono::milliseconds(ttl_ms)};
+    if (entry_bytes(entry) > budget) return;
+
+    cache_shard& shard = shard_for(entry.key);
+    std::lock_guard<std::mutex> lock(shard.lock);
+    if (g_sequence.load(std::memory_order_acquire) != sequence) {
+        ++shard.stale;
+        return;
+    }
+    auto found = shard.index.find(entry.key);
+    if (found != shard.index.end()) erase(shard, found->second);
+
+    shard.bytes += entry_bytes(entry);
+    shard.lru.push_front(std::move(entry));
+    shard.index.emplace(shard.lru.front().key, shard.lru.begin());
+    while (shard.bytes > budget) {
+        erase(shard, std::prev(shard.lru.end()));
+        ++shard.evictions;
+    }
+}
+
+std::size_t cache_invalidate(std::string_view address) {
+    g_sequence.fetch_add(1, std::memory_order_acq_rel);
+    std::size_t dropped = 0;
+    for (auto& shard : g_shards) {
+        std::lock_guard<std::mutex> lock(shard.lock);
+        for (auto it = shard.lru.begin(); it != shard.lru.end();) {
+            auto next = std::next(it);
+            if (address.empty() || std::string_view(it->key).substr(0, it->address_size) == address) {
+                erase(shard, it);
+                ++shard.invalidations;
+                ++dropped;
+            }
+            it = next;
+        }
+    }
+    return dropped;
+}
+
+void cache_set_capacity(std::size_t bytes) {
+    g_capacity.store(bytes, std::memory_order_relaxed);
+    std::size_t budget = bytes / kShards;
+    for (auto& shard : g_shards) {
+        std::lock_guard<std::mutex> lock(shard.lock);
+        while (shard.bytes > budget) {
+            erase(shard, std::prev(shard.lru.end()));
+            ++shard.evictions;
+        }
+    }
+}
+
+cache_counters cache_stats() {
+    cache_counters counters;
+    counters.capacity = g_capacity.load(std::memory_order_relaxed);
+    for (auto& shard : g_shards) {
+        std::lock_guard<std::mutex> lock(shard.lock);
+        counters.entries += shard.lru.size();
+        counters.bytes += shard.bytes;
+        counters.hits += shard.hits;
+        counters.misses += shard.misses;
+        counters.evictions += shard.evictions;
+        counters.invalidations += shard.invalidations;
+        counters.stale += shard.stale;
+    }
+    return counters;
+}
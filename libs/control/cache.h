@@ -0,0 +1,43 @@
+#pragma once
+
+#include "dispatch.h"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// Result cache for addresses their plugin declares cacheable (see Cacheable in contract.h).
+// Entries are keyed by address, options and payload, tagged with the registry generation
+// they were computed under, and spread over independently locked shards, each evicting
+// least recently used entries past its share of the byte budget.
+
+// Copies a live entry into response. generation is the caller's registry generation; an
+// entry from another generation came from a plugin build that may be gone.
+bool cache_get(std::string_view address, dispatch_payload payload, const char* options,
+               std::uint64_t generation, std::string& response);
+
+// Counts invalidations. A caller reads it before computing a result and hands it to
+// cache_put, which drops the result if an invalidation came in between, so a call that
+// was in flight during one can't put back what it removed.
+std::uint64_t cache_sequence();
+
+void cache_put(std::string_view address, dispatch_payload payload, const char* options,
+               std::uint64_t generation, std::uint64_t sequence, long ttl_ms, const std::string& response);
+
+// Drops entries for address, or all entries when address is empty; returns how many
+std::size_t cache_invalidate(std::string_view address);
+
+// Byte budget across all shards (64 MB by default); zero turns caching off
+void cache_set_capacity(std::size_t bytes);
+
+struct cache_counters {
+    std::size_t entries = 0;
+    std::size_t bytes = 0;
+    std::size_t capacity = 0;
+    std::uint64_t hits = 0;
+    std::uint64_t misses = 0;
+    std::uint64_t evictions = 0;
+    std::uint64_t invalidations = 0;
+    std::uint64_t stale = 0;  // results not stored, see cache_sequence
+};
+cache_counters cache_stats();
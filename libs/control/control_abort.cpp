@@ -0,0 +1,24 @@
+#include "handler.h"
+#include "deadline.h"
+#include "json.h"
+#include <iostream>
+
+handler_def control_abort_with() {
+    return {
+        .sid = "control.abort",
+        .tag = "dispatch",
+        .fun = [](const char* payload, const char* /* options */, std::string& /* err */) -> std::any {
+            // {"cancel":"name"} trips the token that calls were started with
+            std::string_view body = payload ? payload : "";
+            auto raw = json_find(body, "cancel");
+            if (!raw) {
+                return std::string(R"({"success":false,"error":"payload must name a cancel token"})");
+            }
+            std::string name = json_text(*raw);
+            std::size_t aborted = call_abort(name);
+
+            std::cout << "CONTROL: Abort '" << name << "' " << (aborted ? "tripped" : "found no calls") << std::endl;
+            return std::string(R"({"success":true,"aborted":)" + std::string(aborted ? "true" : "false") + "}");
+        }
+    };
+}
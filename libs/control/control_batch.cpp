@@ -0,0 +1,97 @@
+#include "handler.h"
+#include "dispatch.h"
+#include "json.h"
+#include "pool.h"
+#include <chrono>
+#include <iostream>
+#include <optional>
+#include <vector>
+
+namespace {
+
+struct batch_entry {
+    std::string address;
+    std::optional<std::string> payload;
+    std::optional<std::string> options;
+    std::string response;
+    bool handled = false;
+    long long micros = 0;
+};
+
+// Payload and options may be given as JSON values or as strings holding the text
+std::optional<std::string> batch_text(std::string_view call, std::string_view key) {
+    auto raw = json_find(call, key);
+    if (!raw || *raw == "null") return std::nullopt;
+    return json_text(*raw);
+}
+
+void run_entry(batch_entry& entry) {
+    auto start = std::chrono::steady_clock::now();
+    dispatch_payload payload = entry.payload
+        ? dispatch_payload{entry.payload->c_str(), entry.payload->size(), true}
+        : dispatch_payload{nullptr, 0, true};
+    entry.handled = control_dispatch(entry.address.c_str(), payload,
+                                     entry.options ? entry.options->c_str() : nullptr,
+                                     entry.response);
+    entry.micros = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start).count();
+}
+
+}
+
+handler_def control_batch_with() {
+    return {
+        .sid = "control.batch",
+        .tag = "dispatch",
+        .fun = [](const char* payload, const char* options, std::string& /* err */) -> std::any {
+            std::string_view body = payload ? payload : "";
+            std::string_view calls = body;
+            if (auto raw = json_find(body, "calls")) calls = *raw;
+
+            std::vector<batch_entry> entries;
+            bool parsed = json_array_each(calls, [&](std::string_view call) {
+                batch_entry entry;
+                if (auto address = json_find(call, "address")) entry.address = json_text(*address);
+                entry.payload = batch_text(call, "payload");
+                entry.options = batch_text(call, "options");
+                entries.push_back(std::move(entry));
+            });
+            if (!parsed) {
+                return std::string(R"({"success":false,"error":"payload must be an array of calls"})");
+            }
+
+            bool parallel = json_bool(options ? options : "", "parallel", true);
+            std::cout << "CONTROL: Batch of " << entries.size() << " calls"
+                      << (parallel ? " (parallel)" : " (sequential)") << std::endl;
+
+            auto start = std::chrono::steady_clock::now();
+            pool_ref pool = parallel ? control_pool() : pool_ref();
+
+            pool_for_each(pool.get(), entries.size(), [&](std::size_t i) { run_entry(entries[i]); });
+
+            long long total = std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - start).count();
+
+            std::string result = R"({"success":true,"count":)" + std::to_string(entries.size()) +
+                                 R"(,"micros":)" + std::to_string(total) + R"(,"results":[)";
+            for (std::size_t i = 0; i < entries.size(); ++i) {
+                const auto& entry = entries[i];
+                if (i > 0) result += ",";
+                result += R"({"address":")" + json_escape(entry.address) + R"(","handled":)" +
+                          (entry.handled ? "true" : "false") + R"(,"micros":)" + std::to_string(entry.micros) +
+                          R"(,"result":)";
+                // JSON results are embedded as-is, anything else travels as a string
+                if (json_is_value(entry.response)) {
+                    result += entry.response;
+                } else {
+                    result += '"';
+                    result += json_escape(entry.response);
+                    result += '"';
+                }
+                result += "}";
+            }
+            result += "]}";
+            return result;
+        }
+    };
+}
@@ -0,0 +1,30 @@
+#include "handler.h"
+#include "cache.h"
+#include <iostream>
+#include <sstream>
+
+handler_def control_cache_with() {
+    return {
+        .sid = "control.cache",
+        .tag = "introspection",
+        .fun = [](const char* /* payload */, const char* /* options */, std::string& /* err */) -> std::any {
+            std::cout << "CONTROL: Reporting cache counters" << std::endl;
+
+            cache_counters stats = cache_stats();
+            std::uint64_t lookups = stats.hits + stats.misses;
+            double hit_rate = lookups ? double(stats.hits) / double(lookups) : 0.0;
+
+            std::ostringstream result;
+            result << R"({"success":true,"entries":)" << stats.entries
+                   << R"(,"bytes":)" << stats.bytes
+                   << R"(,"capacity":)" << stats.capacity
+                   << R"(,"hits":)" << stats.hits
+                   << R"(,"misses":)" << stats.misses
+                   << R"(,"hit_rate":)" << hit_rate
+                   << R"(,"evictions":)" << stats.evictions
+                   << R"(,"invalidations":)" << stats.invalidations
+                   << R"(,"stale":)" << stats.stale << "}";
+            return result.str();
+        }
+    };
+}
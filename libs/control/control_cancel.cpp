@@ -0,0 +1,23 @@
+#include "handler.h"
+#include "json.h"
+#include "timer.h"
+#include <iostream>
+
+handler_def control_cancel_with() {
+    return {
+        .sid = "control.cancel",
+        .tag = "scheduling",
+        .fun = [](const char* payload, const char* /* options */, std::string& /* err */) -> std::any {
+            // {"id":N} as control.schedule returned it; a dispatch already made still completes
+            std::string_view body = payload ? payload : "";
+            long long id = json_int(body, "id", 0);
+            if (id <= 0) {
+                return std::string(R"({"success":false,"error":"payload must carry a timer id"})");
+            }
+            bool cancelled = timer_cancel(timer_id(id));
+
+            std::cout << "CONTROL: Cancel timer " << id << (cancelled ? "" : " found nothing") << std::endl;
+            return std::string(R"({"success":true,"cancelled":)" + std::string(cancelled ? "true" : "false") + "}");
+        }
+    };
+}
@@ -11,8 +11,8 @@ handler_def control_discover_with() {
         .fun = [](const char* /* payload */, const char* /* options */, std::string& /* err */) -> std::any {
             std::cout << "CONTROL: Discovering plugins" << std::endl;
             control_discover_and_load(g_dispatch);
-            std::vector<LoadedPlugin>& plugins = control_get_registry();
-            return std::string(R"({"success":true,"discovered":)" + std::to_string(plugins.size()) + "}");
+            registry_read registry;
+            return std::string(R"({"success":true,"discovered":)" + std::to_string(registry->plugins.size()) + "}");
         }
     };
 }
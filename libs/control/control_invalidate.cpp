@@ -0,0 +1,35 @@
+#include "handler.h"
+#include "cache.h"
+#include "json.h"
+#include "registry.h"
+#include <iostream>
+
+handler_def control_invalidate_with() {
+    return {
+        .sid = "control.invalidate",
+        .tag = "dispatch",
+        .fun = [](const char* payload, const char* /* options */, std::string& /* err */) -> std::any {
+            // {"address":"efs.read"}, {"plugin":"efs"} for everything it routes, or {} for all
+            std::string_view body = payload ? payload : "";
+            std::size_t dropped = 0;
+            if (auto raw = json_find(body, "address")) {
+                dropped = cache_invalidate(json_text(*raw));
+            } else if (auto raw = json_find(body, "plugin")) {
+                std::string name = json_text(*raw);
+                registry_read registry;
+                const LoadedPlugin* plugin = registry->find(name);
+                if (!plugin) {
+                    return std::string(R"({"success":false,"error":"no plugin named )" + json_escape(name) + R"("})");
+                }
+                for (const auto& [address, owner] : registry->routes) {
+                    if (owner == plugin) dropped += cache_invalidate(address);
+                }
+            } else {
+                dropped = cache_invalidate({});
+            }
+
+            std::cout << "CONTROL: Invalidated " << dropped << " cached results" << std::endl;
+            return std::string(R"({"success":true,"dropped":)" + std::to_string(dropped) + "}");
+        }
+    };
+}
@@ -0,0 +1,28 @@
+#include "handler.h"
+#include "admission.h"
+#include "json.h"
+#include <iostream>
+
+handler_def control_limit_with() {
+    return {
+        .sid = "control.limit",
+        .tag = "dispatch",
+        .fun = [](const char* payload, const char* /* options */, std::string& /* err */) -> std::any {
+            // {"address":"llm.query","concurrency":2,"queue":16} sets a limit, concurrency 0
+            // lifts it; either way, or with {}, the limits in force are reported
+            std::string_view body = payload ? payload : "";
+            if (auto raw = json_find(body, "address")) {
+                std::string address = json_text(*raw);
+                long long concurrency = json_int(body, "concurrency", 0);
+                long long queue = json_int(body, "queue", 0);
+                if (concurrency < 0 || queue < 0) {
+                    return std::string(R"({"success":false,"error":"concurrency and queue must not be negative"})");
+                }
+                admission_set(address, {std::size_t(concurrency), std::size_t(queue)});
+                std::cout << "CONTROL: Limit " << address << " to " << concurrency << " running, " << queue
+                          << " queued" << std::endl;
+            }
+            return std::string(R"({"success":true,"limits":)" + admission_report() + "}");
+        }
+    };
+}
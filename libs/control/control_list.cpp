@@ -9,12 +9,21 @@ handler_def control_list_with() {
         .fun = [](const char* /* payload */, const char* /* options */, std::string& /* err */) -> std::any {
             std::cout << "CONTROL: Listing loaded plugins" << std::endl;
             
-            std::vector<LoadedPlugin>& plugins = control_get_registry();
-            std::string result = R"({"success":true,"plugins":[)";
+            registry_read registry;
+            const auto& plugins = registry->plugins;
+            std::string result = R"({"success":true,"generation":)" + std::to_string(registry->generation) +
+                                 R"(,"plugins":[)";
             
             for (size_t i = 0; i < plugins.size(); ++i) {
+                const LoadedPlugin& plugin = *plugins[i];
                 if (i > 0) result += ",";
-                result += R"({"name":")" + plugins[i].name + R"("})";
+                bool loaded = (!plugin.lazy || plugin.lazy->ready.load(std::memory_order_acquire)) &&
+                              plugin.handle != nullptr;
+                result += R"({"name":")" + plugin.name + R"(","loaded":)" + (loaded ? "true" : "false") +
+                          R"(,"adopted":)" +
+                          (plugin.adopted ? "true" : "false") + R"(,"load_us":)" +
+                          std::to_string(plugin.load_us) + R"(,"attach_us":)" +
+                          std::to_string(plugin.attach_us) + "}";
             }
             
             result += "]}";
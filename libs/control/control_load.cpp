@@ -1,13 +1,32 @@
 #include "handler.h"
+#include "registry.h"
+#include "json.h"
 #include <iostream>
 
+extern DispatchFn g_dispatch;
+
 handler_def control_load_with() {
     return {
         .sid = "control.load",
         .tag = "loading",
-        .fun = [](const char* /* payload */, const char* /* options */, std::string& /* err */) -> std::any {
-            std::cout << "CONTROL: Load specific plugin (not yet implemented)" << std::endl;
-            return std::string(R"({"success":true,"message":"load not yet implemented"})");
+        .fun = [](const char* payload, const char* /* options */, std::string& /* err */) -> std::any {
+            // {"path":"/opt/jam/libllm.dylib"} or {"name":"llm"} for one next to the others
+            std::string_view body = payload ? payload : "";
+            std::filesystem::path path;
+            if (auto raw = json_find(body, "path")) {
+                path = json_text(*raw);
+            } else if (auto raw = json_find(body, "name")) {
+                path = control_library_path(json_text(*raw));
+            } else {
+                return std::string(R"({"success":false,"error":"payload needs a path or a name"})");
+            }
+
+            std::cout << "CONTROL: Loading plugin " << path << std::endl;
+            std::string error;
+            if (!control_load_plugin(g_dispatch, path, error)) {
+                return std::string(R"({"success":false,"error":")" + json_escape(error) + R"("})");
+            }
+            return std::string(R"({"success":true,"name":")" + json_escape(path.filename().string()) + R"("})");
         }
     };
 }
@@ -0,0 +1,91 @@
+#include "handler.h"
+#include "json.h"
+#include "registry.h"
+#include "stats.h"
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <map>
+#include <mutex>
+
+namespace {
+
+using memstats_clock = std::chrono::steady_clock;
+
+const memstats_clock::time_point g_loaded = memstats_clock::now();
+
+// What the previous report saw of each library, so rates cover the time between reports
+struct heap_sample {
+    void* handle = nullptr;
+    std::uint64_t allocated = 0;
+    std::uint64_t allocations = 0;
+    memstats_clock::time_point at;
+};
+
+std::mutex g_samples_lock;
+std::map<std::string, heap_sample, std::less<>> g_samples;
+
+void write_library(std::string& out, std::string_view name, void* handle, MemStatsFn memstats,
+                   memstats_clock::time_point loaded_at, memstats_clock::time_point now) {
+    out += R"({"plugin":")" + json_escape(name) + R"(")";
+    if (!memstats) {
+        out += R"(,"tracked":false})";
+        return;
+    }
+    libsmemory total = {};
+    memstats(&total, nullptr);
+
+    // A library reloaded since the last report starts its counts over
+    heap_sample previous = {handle, 0, 0, loaded_at};
+    {
+        std::lock_guard<std::mutex> lock(g_samples_lock);
+        auto [sample, first] = g_samples.try_emplace(std::string(name));
+        if (!first && sample->second.handle == handle && sample->second.allocated <= total.allocated) {
+            previous = sample->second;
+        }
+        sample->second = {handle, total.allocated, total.allocations, now};
+    }
+    auto window = std::chrono::duration_cast<std::chrono::milliseconds>(now - previous.at);
+    double seconds = std::chrono::duration<double>(now - previous.at).count();
+
+    // Back-to-back reports leave too short a window for a rate to mean anything
+    auto rate = [&](std::uint64_t count) {
+        return window.count() < 1 ? std::string("null") : std::to_string(std::uint64_t(double(count) / seconds));
+    };
+    out += R"(,"tracked":true,"live":)" + std::to_string(total.live) + R"(,"peak":)" + std::to_string(total.peak) +
+           R"(,"allocated":)" + std::to_string(total.allocated) + R"(,"freed":)" + std::to_string(total.freed) +
+           R"(,"allocations":)" + std::to_string(total.allocations) + R"(,"frees":)" + std::to_string(total.frees) +
+           R"(,"window_ms":)" + std::to_string(std::max<std::int64_t>(window.count(), 0)) + R"(,"bytes_per_sec":)" +
+           rate(total.allocated - previous.allocated) + R"(,"allocations_per_sec":)" +
+           rate(total.allocations - previous.allocations) + "}";
+}
+
+}
+
+handler_def control_memstats_with() {
+    return {
+        .sid = "control.memstats",
+        .tag = "introspection",
+        .fun = [](const char* /* payload */, const char* /* options */, std::string& /* err */) -> std::any {
+            // Heap per library as its own allocator counts it, with rates since the previous
+            // report; then what dispatch charged to each address since control.stats last
+            // reset, which needs {"memstats":true} in AttachEx's options
+            std::cout << "CONTROL: Reporting heap use" << std::endl;
+            auto now = memstats_clock::now();
+
+            std::string result = R"({"success":true,"plugins":[)";
+            write_library(result, "control", nullptr, MemStats, g_loaded, now);
+            {
+                registry_read registry;
+                for (const auto& plugin : registry->plugins) {
+                    if (plugin->lazy && !plugin->lazy->ready.load(std::memory_order_acquire)) continue;
+                    if (!plugin->handle) continue;
+                    result += ",";
+                    write_library(result, plugin->name, plugin->handle, plugin->memstats, plugin->loaded_at, now);
+                }
+            }
+            result += R"(],"dispatch":)" + stats_heap_report() + "}";
+            return result;
+        }
+    };
+}
@@ -0,0 +1,50 @@
+#include "handler.h"
+#include "pool.h"
+#include "reactor.h"
+#include <iostream>
+#include <sstream>
+
+handler_def control_pool_with() {
+    return {
+        .sid = "control.pool",
+        .tag = "introspection",
+        .fun = [](const char* /* payload */, const char* /* options */, std::string& /* err */) -> std::any {
+            std::cout << "CONTROL: Reporting pool counters" << std::endl;
+
+            pool_ref pool = control_pool();
+            if (!pool) {
+                return std::string(R"({"success":false,"error":"pool is not running"})");
+            }
+
+            work_pool::counters stats = pool->stats();
+            double steal_rate = stats.executed ? double(stats.steals) / double(stats.executed) : 0.0;
+
+            std::ostringstream result;
+            result << R"({"success":true,"workers":)" << stats.workers
+                   << R"(,"queued":)" << stats.queued
+                   << R"(,"submitted":)" << stats.submitted
+                   << R"(,"executed":)" << stats.executed
+                   << R"(,"steals":)" << stats.steals
+                   << R"(,"steal_rate":)" << steal_rate
+                   << R"(,"executor":")" << (reactor_running() ? "reactor" : "pool") << R"(")";
+            if (reactor_running()) {
+                result << R"(,"cores":[)";
+                for (const reactor_counters& core : reactor_stats()) {
+                    if (core.core) result << ",";
+                    result << R"({"core":)" << core.core
+                           << R"(,"executed":)" << core.executed
+                           << R"(,"local":)" << core.local
+                           << R"(,"received":)" << core.received
+                           << R"(,"injected":)" << core.injected
+                           << R"(,"sent":)" << core.sent
+                           << R"(,"overflowed":)" << core.overflowed
+                           << R"(,"completions":)" << core.completions
+                           << R"(,"sleeps":)" << core.sleeps << "}";
+                }
+                result << "]";
+            }
+            result << "}";
+            return result.str();
+        }
+    };
+}
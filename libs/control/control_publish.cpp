@@ -0,0 +1,27 @@
+#include "handler.h"
+#include "bus.h"
+#include "json.h"
+#include <iostream>
+
+handler_def control_publish_with() {
+    return {
+        .sid = "control.publish",
+        .tag = "events",
+        .fun = [](const char* payload, const char* /* options */, std::string& /* err */) -> std::any {
+            // {"topic":"sql.batch","data":...}: a string is published decoded, any other value
+            // as its JSON text
+            std::string_view body = payload ? payload : "";
+            auto topic = json_find(body, "topic");
+            if (!topic) {
+                return std::string(R"({"success":false,"error":"topic is required"})");
+            }
+            std::string name = json_text(*topic);
+            std::string data;
+            if (auto raw = json_find(body, "data")) data = json_text(*raw);
+
+            std::size_t reached = bus_publish(name, data.data(), data.size());
+            std::cout << "CONTROL: Published to " << reached << " subscribers of " << name << std::endl;
+            return std::string(R"({"success":true,"subscribers":)" + std::to_string(reached) + "}");
+        }
+    };
+}
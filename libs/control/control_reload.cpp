@@ -0,0 +1,31 @@
+#include "handler.h"
+#include "registry.h"
+#include "json.h"
+#include <iostream>
+
+extern DispatchFn g_dispatch;
+
+handler_def control_reload_with() {
+    return {
+        .sid = "control.reload",
+        .tag = "loading",
+        .fun = [](const char* payload, const char* /* options */, std::string& /* err */) -> std::any {
+            // {"name":"llm"}: opens the library's current file and swaps it in. Dispatches
+            // already inside the old build finish there; new ones reach the new build.
+            // "closed" says whether the old build is closed yet, as for control.unload.
+            std::string_view body = payload ? payload : "";
+            auto raw = json_find(body, "name");
+            if (!raw) return std::string(R"({"success":false,"error":"payload needs a name"})");
+            std::string name = json_text(*raw);
+
+            std::cout << "CONTROL: Reloading plugin " << name << std::endl;
+            std::string error;
+            bool closed = false;
+            if (!control_reload_plugin(g_dispatch, name, closed, error)) {
+                return std::string(R"({"success":false,"error":")" + json_escape(error) + R"("})");
+            }
+            return std::string(R"({"success":true,"name":")" + json_escape(name) + R"(","closed":)" +
+                               (closed ? "true" : "false") + "}");
+        }
+    };
+}
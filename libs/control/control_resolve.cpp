@@ -0,0 +1,25 @@
+#include "handler.h"
+#include "handles.h"
+#include "json.h"
+#include <iostream>
+
+handler_def control_resolve_with() {
+    return {
+        .sid = "control.resolve",
+        .tag = "dispatch",
+        .fun = [](const char* payload, const char* /* options */, std::string& /* err */) -> std::any {
+            // Accepts {"address":"efs.read"} or the bare address
+            std::string_view body = payload ? payload : "";
+            std::string address(body);
+            if (auto raw = json_find(body, "address")) address = json_text(*raw);
+
+            std::uint64_t handle = control_resolve(address.c_str());
+            std::cout << "CONTROL: Resolved '" << address << "' to handle " << handle << std::endl;
+            if (!handle) {
+                return std::string(R"({"success":false,"error":"address is not routed"})");
+            }
+            return std::string(R"({"success":true,"address":")" + json_escape(address) +
+                               R"(","handle":)" + std::to_string(handle) + "}");
+        }
+    };
+}
@@ -18,16 +18,21 @@ handler_def control_run_with() {
                 return std::string(R"({"success":true,"message":"no plugins found"})");
             }
             
-            std::vector<LoadedPlugin>& plugins = control_get_registry();
+            registry_read registry;
+            const auto& plugins = registry->plugins;
             std::cout << "CONTROL: Successfully loaded " << plugins.size() << " plugins" << std::endl;
             
             // Print plugin list
             std::cout << "\n=== DISCOVERED PLUGINS ===" << std::endl;
             for (size_t i = 0; i < plugins.size(); ++i) {
-                auto& plugin = plugins[i];
+                const LoadedPlugin& plugin = *plugins[i];
                 std::cout << (i + 1) << ". " << plugin.name;
                 
-                if (plugin.report) {
+                if (plugin.lazy) {
+                    // Not loaded yet; the manifest has its report
+                    std::cout << " - " << plugin.info.description_short
+                              << " (type=" << plugin.info.plugin_type << ", deferred)";
+                } else if (plugin.report) {
                     libsinfo desc = {};
                     char err_buf[256] = {0};
                     if (plugin.report(err_buf, sizeof(err_buf), &desc)) {
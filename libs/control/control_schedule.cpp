@@ -0,0 +1,86 @@
+#include "handler.h"
+#include "contract.h"
+#include "json.h"
+#include "timer.h"
+#include <atomic>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <string>
+
+namespace {
+
+// A dispatch a timer makes each time it fires. A run that finds the previous one still
+// in flight is skipped, so a slow address can't pile up calls.
+struct scheduled_call {
+    std::string address;
+    std::optional<std::string> payload;
+    std::optional<std::string> options;
+    std::atomic<bool> running{false};
+};
+
+std::atomic<std::uint64_t> g_skipped{0};
+
+void call_done(bool /* handled */, const libsresult* /* result */, void* user_data) {
+    std::unique_ptr<std::shared_ptr<scheduled_call>> call(static_cast<std::shared_ptr<scheduled_call>*>(user_data));
+    (*call)->running.store(false, std::memory_order_release);
+}
+
+void fire(const std::shared_ptr<scheduled_call>& call) {
+    if (call->running.exchange(true, std::memory_order_acq_rel)) {
+        g_skipped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    auto* pinned = new std::shared_ptr<scheduled_call>(call);
+    if (!InvokeAsync(call->address.c_str(), call->payload ? call->payload->c_str() : nullptr,
+                     call->options ? call->options->c_str() : nullptr, call_done, pinned)) {
+        delete pinned;
+        call->running.store(false, std::memory_order_release);
+    }
+}
+
+std::string report() {
+    timer_counters stats = timer_stats();
+    return R"({"success":true,"timers":{"active":)" + std::to_string(stats.active) + R"(,"scheduled":)" +
+           std::to_string(stats.scheduled) + R"(,"fired":)" + std::to_string(stats.fired) + R"(,"cancelled":)" +
+           std::to_string(stats.cancelled) + R"(,"cascaded":)" + std::to_string(stats.cascaded) +
+           R"(,"skipped":)" + std::to_string(g_skipped.load(std::memory_order_relaxed)) + "}}";
+}
+
+}
+
+handler_def control_schedule_with() {
+    return {
+        .sid = "control.schedule",
+        .tag = "scheduling",
+        .fun = [](const char* payload, const char* /* options */, std::string& /* err */) -> std::any {
+            // {"address":"log.write","payload":...,"options":...,"delay_ms":N,"every_ms":M}
+            // dispatches asynchronously after delay_ms (default every_ms) and then every every_ms;
+            // without an address the timer counters are reported
+            std::string_view body = payload ? payload : "";
+            auto address = json_find(body, "address");
+            if (!address) return report();
+
+            long long delay_ms = json_int(body, "delay_ms", -1);
+            long long every_ms = json_int(body, "every_ms", 0);
+            if (every_ms < 0 || (delay_ms < 0 && every_ms == 0)) {
+                return std::string(R"({"success":false,"error":"delay_ms or a positive every_ms is required"})");
+            }
+            if (delay_ms < 0) delay_ms = every_ms;
+
+            auto call = std::make_shared<scheduled_call>();
+            call->address = json_text(*address);
+            if (auto raw = json_find(body, "payload")) call->payload = json_text(*raw);
+            if (auto raw = json_find(body, "options")) call->options = json_text(*raw);
+
+            timer_id id = timer_schedule(std::chrono::milliseconds(delay_ms), std::chrono::milliseconds(every_ms),
+                                         std::make_shared<const std::function<void()>>([call] { fire(call); }));
+            if (!id) {
+                return std::string(R"({"success":false,"error":"timer service is closed"})");
+            }
+            std::cout << "CONTROL: Scheduled " << call->address << " in " << delay_ms << "ms"
+                      << (every_ms ? ", every " + std::to_string(every_ms) + "ms" : std::string()) << std::endl;
+            return std::string(R"({"success":true,"id":)" + std::to_string(id) + "}");
+        }
+    };
+}
@@ -0,0 +1,24 @@
+#include "handler.h"
+#include "json.h"
+#include "stats.h"
+#include <iostream>
+
+handler_def control_stats_with() {
+    return {
+        .sid = "control.stats",
+        .tag = "introspection",
+        .fun = [](const char* payload, const char* /* options */, std::string& /* err */) -> std::any {
+            // {"reset":true} reports and then starts the counts over; {"dump_ms":N} prints a
+            // summary every N ms, 0 to stop
+            std::string_view body = payload ? payload : "";
+            std::cout << "CONTROL: Reporting dispatch stats" << std::endl;
+
+            long long dump_ms = json_int(body, "dump_ms", -1);
+            if (dump_ms >= 0) stats_dump_every(std::chrono::milliseconds(dump_ms));
+
+            std::string result = stats_report();
+            if (json_bool(body, "reset", false)) stats_reset();
+            return result;
+        }
+    };
+}
@@ -0,0 +1,14 @@
+#include "handler.h"
+#include "bus.h"
+#include <iostream>
+
+handler_def control_topics_with() {
+    return {
+        .sid = "control.topics",
+        .tag = "introspection",
+        .fun = [](const char* /* payload */, const char* /* options */, std::string& /* err */) -> std::any {
+            std::cout << "CONTROL: Reporting subscriptions" << std::endl;
+            return std::string(R"({"success":true,"subscriptions":)" + bus_report() + "}");
+        }
+    };
+}
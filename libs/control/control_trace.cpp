@@ -0,0 +1,46 @@
+#include "handler.h"
+#include "json.h"
+#include "trace.h"
+#include <iostream>
+
+handler_def control_trace_with() {
+    return {
+        .sid = "control.trace",
+        .tag = "introspection",
+        .fun = [](const char* payload, const char* /* options */, std::string& /* err */) -> std::any {
+            // {"action":"start","path":"trace.json","capacity":65536}, then {"action":"stop"}
+            // to write the file; no action reports whether a trace is running
+            std::string_view body = payload ? payload : "";
+            std::string action;
+            if (auto raw = json_find(body, "action")) action = json_text(*raw);
+
+            std::string error;
+            if (action == "start") {
+                std::string path = "trace.json";
+                if (auto raw = json_find(body, "path")) path = json_text(*raw);
+                long long capacity = json_int(body, "capacity", kTraceCapacity);
+                std::cout << "CONTROL: Tracing to " << path << std::endl;
+                if (!trace_start(path, capacity > 0 ? std::size_t(capacity) : 0, error)) {
+                    return std::string(R"({"success":false,"error":")" + json_escape(error) + R"("})");
+                }
+                return std::string(R"({"success":true,"tracing":true,"path":")" + json_escape(path) + R"("})");
+            }
+
+            if (action == "stop") {
+                trace_summary summary;
+                if (!trace_stop(summary, error)) {
+                    return std::string(R"({"success":false,"error":")" + json_escape(error) + R"("})");
+                }
+                std::cout << "CONTROL: Wrote " << summary.spans << " spans to " << summary.path << std::endl;
+                return std::string(R"({"success":true,"tracing":false,"path":")" + json_escape(summary.path) +
+                                   R"(","spans":)" + std::to_string(summary.spans) +
+                                   R"(,"dropped":)" + std::to_string(summary.dropped) + "}");
+            }
+
+            if (!action.empty()) {
+                return std::string(R"({"success":false,"error":"action must be start or stop"})");
+            }
+            return std::string(R"({"success":true,"tracing":)") + (trace_active() ? "true" : "false") + "}";
+        }
+    };
+}
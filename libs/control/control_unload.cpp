@@ -0,0 +1,30 @@
+#include "handler.h"
+#include "registry.h"
+#include "json.h"
+#include <iostream>
+
+handler_def control_unload_with() {
+    return {
+        .sid = "control.unload",
+        .tag = "loading",
+        .fun = [](const char* payload, const char* /* options */, std::string& /* err */) -> std::any {
+            // {"name":"llm"} or {"name":"libllm.dylib"}
+            std::string_view body = payload ? payload : "";
+            auto raw = json_find(body, "name");
+            if (!raw) return std::string(R"({"success":false,"error":"payload needs a name"})");
+            std::string name = json_text(*raw);
+
+            // Waits for in-flight calls into the plugin to finish and closes it. "closed":false
+            // when they outlast the grace period or this runs inside a plugin call; control
+            // then closes it once they are done.
+            std::cout << "CONTROL: Unloading plugin " << name << std::endl;
+            std::string error;
+            bool closed = false;
+            if (!control_unload_plugin(name, closed, error)) {
+                return std::string(R"({"success":false,"error":")" + json_escape(error) + R"("})");
+            }
+            return std::string(R"({"success":true,"name":")" + json_escape(name) + R"(","closed":)" +
+                               (closed ? "true" : "false") + "}");
+        }
+    };
+}
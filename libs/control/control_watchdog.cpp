@@ -0,0 +1,28 @@
+#include "handler.h"
+#include "json.h"
+#include "watchdog.h"
+#include <iostream>
+
+handler_def control_watchdog_with() {
+    return {
+        .sid = "control.watchdog",
+        .tag = "dispatch",
+        .fun = [](const char* payload, const char* /* options */, std::string& /* err */) -> std::any {
+            // {"address":"llm.query","wall_ms":30000,"cpu_ms":10000,"action":"cancel"} sets a
+            // budget, "*" for every address without one, and zero for both lifts it; either
+            // way, or with {}, the budgets and the latest overruns are reported
+            std::string_view body = payload ? payload : "";
+            if (auto raw = json_find(body, "address")) {
+                std::string address = json_text(*raw);
+                if (json_int(body, "wall_ms", 0) < 0 || json_int(body, "cpu_ms", 0) < 0) {
+                    return std::string(R"({"success":false,"error":"wall_ms and cpu_ms must not be negative"})");
+                }
+                watchdog_budget budget = watchdog_parse(body);
+                watchdog_set(address, budget);
+                std::cout << "CONTROL: Budget for " << address << ": " << budget.wall.count() << " ms wall, "
+                          << budget.cpu.count() << " ms CPU, " << (budget.cancel ? "cancel" : "flag") << std::endl;
+            }
+            return std::string(R"({"success":true,"watchdog":)" + watchdog_report() + "}");
+        }
+    };
+}
@@ -0,0 +1,73 @@
+#include "cputime.h"
+#include <ctime>
+
+#if defined(__APPLE__)
+    #include <mach/mach.h>
+    #include <pthread.h>
+#elif defined(_WIN32)
+    #include <windows.h>
+#else
+    #include <pthread.h>
+#endif
+
+namespace {
+
+#if defined(_WIN32)
+std::uint64_t filetime_ns(const FILETIME& time) {
+    return ((std::uint64_t(time.dwHighDateTime) << 32) | time.dwLowDateTime) * 100;
+}
+
+std::uint64_t handle_cpu_ns(HANDLE thread) {
+    FILETIME created, exited, kernel, user;
+    if (!GetThreadTimes(thread, &created, &exited, &kernel, &user)) return 0;
+    return filetime_ns(kernel) + filetime_ns(user);
+}
+#elif !defined(__APPLE__)
+std::uint64_t clock_ns(clockid_t clock) {
+    timespec now = {};
+    if (clock_gettime(clock, &now) != 0) return 0;
+    return std::uint64_t(now.tv_sec) * 1000000000u + std::uint64_t(now.tv_nsec);
+}
+#endif
+
+}
+
+std::uint64_t thread_cpu_ns() {
+#if defined(__APPLE__)
+    return clock_gettime_nsec_np(CLOCK_THREAD_CPUTIME_ID);
+#elif defined(_WIN32)
+    return handle_cpu_ns(GetCurrentThread());
+#else
+    return clock_ns(CLOCK_THREAD_CPUTIME_ID);
+#endif
+}
+
+thread_cpu_clock thread_cpu_self() {
+#if defined(__APPLE__)
+    return {std::intptr_t(pthread_mach_thread_np(pthread_self()))};
+#elif defined(_WIN32)
+    // GetCurrentThread is a pseudo handle that means the caller wherever it is used, so
+    // each thread opens a real one once and keeps it
+    thread_local HANDLE self = OpenThread(THREAD_QUERY_LIMITED_INFORMATION, FALSE, GetCurrentThreadId());
+    return {std::intptr_t(self)};
+#else
+    clockid_t clock;
+    if (pthread_getcpuclockid(pthread_self(), &clock) != 0) return {};
+    return {std::intptr_t(clock)};
+#endif
+}
+
+std::uint64_t thread_cpu_ns(thread_cpu_clock clock) {
+    if (clock.id == 0) return 0;
+#if defined(__APPLE__)
+    thread_basic_info_data_t info;
+    mach_msg_type_number_t count = THREAD_BASIC_INFO_COUNT;
+    if (thread_info(mach_port_t(clock.id), THREAD_BASIC_INFO, thread_info_t(&info), &count) != KERN_SUCCESS) return 0;
+    return (std::uint64_t(info.user_time.seconds) + std::uint64_t(info.system_time.seconds)) * 1000000000u +
+           (std::uint64_t(info.user_time.microseconds) + std::uint64_t(info.system_time.microseconds)) * 1000u;
+#elif defined(_WIN32)
+    return handle_cpu_ns(HANDLE(clock.id));
+#else
+    return clock_ns(clockid_t(clock.id));
+#endif
+}
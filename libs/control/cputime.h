@@ -0,0 +1,16 @@
+#pragma once
+
+#include <cstdint>
+
+// CPU time of threads in nanoseconds, user and system together, as
+// CLOCK_THREAD_CPUTIME_ID counts it where there is one
+
+// The calling thread's
+std::uint64_t thread_cpu_ns();
+
+// The calling thread's clock, for other threads to read; valid while the thread lives
+struct thread_cpu_clock {
+    std::intptr_t id = 0;
+};
+thread_cpu_clock thread_cpu_self();
+std::uint64_t thread_cpu_ns(thread_cpu_clock clock);
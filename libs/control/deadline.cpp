@@ -0,0 +1,132 @@
+#include "deadline.h"
+#include "json.h"
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+
+struct cancel_token {
+    std::atomic<bool> tripped{false};
+};
+
+namespace {
+
+thread_local const call_context* t_context = nullptr;
+
+// Named tokens of running calls. Entries die with the last call holding them and are
+// swept whenever the table has doubled since the last sweep.
+std::mutex g_tokens_lock;
+std::unordered_map<std::string, std::weak_ptr<cancel_token>> g_tokens;
+std::size_t g_sweep_at = 64;
+
+std::shared_ptr<cancel_token> acquire_token(const std::string& name) {
+    std::lock_guard<std::mutex> lock(g_tokens_lock);
+    auto& slot = g_tokens[name];
+    if (auto token = slot.lock()) return token;
+
+    auto token = std::make_shared<cancel_token>();
+    slot = token;
+    if (g_tokens.size() >= g_sweep_at) {
+        std::erase_if(g_tokens, [](const auto& entry) { return entry.second.expired(); });
+        g_sweep_at = std::max<std::size_t>(64, g_tokens.size() * 2);
+    }
+    return token;
+}
+
+std::optional<call_priority> parse_priority(std::string_view raw) {
+    std::string name = json_text(raw);
+    if (name == "interactive") return call_priority::interactive;
+    if (name == "normal") return call_priority::normal;
+    if (name == "bulk") return call_priority::bulk;
+    return std::nullopt;
+}
+
+const char* check(const call_context* context) {
+    if (!context) return nullptr;
+    for (const auto& token : context->tokens) {
+        if (token->tripped.load(std::memory_order_acquire)) return "cancelled";
+    }
+    if (context->deadline != deadline_clock::time_point::max() && deadline_clock::now() >= context->deadline) {
+        return "deadline exceeded";
+    }
+    return nullptr;
+}
+
+}
+
+call_context call_current() {
+    return t_context ? *t_context : call_context{};
+}
+
+deadline_clock::time_point call_deadline() {
+    return t_context ? t_context->deadline : deadline_clock::time_point::max();
+}
+
+call_priority call_current_priority() {
+    return t_context ? t_context->priority : call_priority::normal;
+}
+
+call_scope::call_scope(const char* options) : saved_(t_context) {
+    // Every key needs a quote, so "" and "{}", the usual options, skip the parse
+    if (!options || !std::strchr(options, '"')) return;
+    std::string_view text = options;
+    auto budget = json_find(text, "deadline_ms");
+    auto name = json_find(text, "cancel");
+    auto priority = json_find(text, "priority");
+    if (!budget && !name && !priority) return;
+
+    if (saved_) own_ = *saved_;
+    if (budget) {
+        long long ms = json_int(text, "deadline_ms", -1);
+        if (ms >= 0) own_.deadline = std::min(own_.deadline, deadline_clock::now() + std::chrono::milliseconds(ms));
+    }
+    if (name && *name != "null") own_.tokens.push_back(acquire_token(json_text(*name)));
+    if (priority) own_.priority = parse_priority(*priority).value_or(own_.priority);
+    t_context = &own_;
+}
+
+call_scope::call_scope(call_context inherited) : own_(std::move(inherited)), saved_(t_context) {
+    t_context = own_.empty() ? nullptr : &own_;
+}
+
+call_scope::~call_scope() {
+    t_context = saved_;
+}
+
+const char* call_scope::refused() const {
+    return check(t_context);
+}
+
+bool call_cancelled() {
+    return check(t_context) != nullptr;
+}
+
+const char* call_interrupted() {
+    return check(t_context);
+}
+
+const char* call_interrupted(const call_context& context) {
+    return check(&context);
+}
+
+std::shared_ptr<cancel_token> call_token() {
+    return std::make_shared<cancel_token>();
+}
+
+void call_trip(cancel_token& token) {
+    token.tripped.store(true, std::memory_order_release);
+}
+
+std::size_t call_abort(std::string_view name) {
+    std::lock_guard<std::mutex> lock(g_tokens_lock);
+    auto it = g_tokens.find(std::string(name));
+    if (it == g_tokens.end()) return 0;
+    auto token = it->second.lock();
+    g_tokens.erase(it);
+    if (!token) return 0;
+    token->tripped.store(true, std::memory_order_release);
+    return 1;
+}
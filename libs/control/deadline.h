@@ -0,0 +1,75 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+// Deadlines, cooperative cancellation and priority. A dispatch may carry in its options
+//   "deadline_ms": N    budget in milliseconds, counted from when control receives it
+//   "cancel": "name"    token that control.abort can trip while the call runs
+//   "priority": "interactive" | "normal" | "bulk", see admission.h
+// All carry over to every dispatch made while the call runs, on its own thread or through
+// control's pool, so nested calls need not forward them. A nested call can shorten the
+// deadline but never extend it; it may name its own priority. Handlers that loop check
+// call_cancelled() (plugins reach it through libshost::cancelled) and stop early.
+
+using deadline_clock = std::chrono::steady_clock;
+
+struct cancel_token;
+
+// Lower values are admitted first when calls queue for an address
+enum class call_priority { interactive, normal, bulk };
+
+// Limits in force on a thread; copied into work handed to another thread
+struct call_context {
+    deadline_clock::time_point deadline = deadline_clock::time_point::max();
+    std::vector<std::shared_ptr<cancel_token>> tokens;
+    call_priority priority = call_priority::normal;
+
+    bool empty() const {
+        return deadline == deadline_clock::time_point::max() && tokens.empty() && priority == call_priority::normal;
+    }
+};
+
+// The limits of the innermost call on this thread, empty if none
+call_context call_current();
+deadline_clock::time_point call_deadline();
+call_priority call_current_priority();
+
+// Puts a call's limits in force for the scope of the object: those of the enclosing call
+// plus any given in options. Costs nothing when neither has any.
+class call_scope {
+public:
+    explicit call_scope(const char* options);
+    explicit call_scope(call_context inherited);
+    ~call_scope();
+    call_scope(const call_scope&) = delete;
+    call_scope& operator=(const call_scope&) = delete;
+
+    // Why the call must not start ("deadline exceeded" or "cancelled"), null if it may
+    const char* refused() const;
+
+private:
+    call_context own_;
+    const call_context* saved_;
+};
+
+// True once the current call's deadline has passed or one of its tokens was tripped
+bool call_cancelled();
+
+// Which of the two, as call_scope::refused() words it; null while the call may go on
+const char* call_interrupted();
+
+// The same for a call that is not running on this thread, such as one queued for admission
+const char* call_interrupted(const call_context& context);
+
+// Trips the named token for every call running under it; returns how many tokens that
+// was (0 or 1). Calls that start afterwards with the same name are not affected.
+std::size_t call_abort(std::string_view name);
+
+// A token no name reaches, for control to trip itself (see watchdog.h); a call runs
+// under it once it is added to the tokens of a call_scope
+std::shared_ptr<cancel_token> call_token();
+void call_trip(cancel_token& token);
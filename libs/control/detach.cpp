@@ -1,14 +1,43 @@
 #include "contract.h"
 #include "registry.h"
+#include "pool.h"
+#include "reactor.h"
+#include "bus.h"
+#include "timer.h"
+#include "stats.h"
+#include "watchdog.h"
+#include "trace.h"
 #include <iostream>
 
 extern DispatchFn g_dispatch;
 
 extern "C" bool Detach(char* /* err_buf */, std::size_t /* err_cap */) {
     g_dispatch = nullptr;
+    stats_dump_every(std::chrono::milliseconds(0));
+    watchdog_reset();
+    // No timer fires into the executors once they start draining
+    timer_shutdown();
+    
+    // Let queued and in-flight async work finish while plugins are still loaded. The
+    // reactor goes first: what it runs may still hand work to the pool.
+    reactor_stop();
+    control_pool_shutdown();
     
     // Clean up any loaded plugins in registry
     control_cleanup_registry();
+
+    // What the host left subscribed; plugins' subscriptions went with them
+    bus_reset();
+
+    if (trace_active()) {
+        trace_summary summary;
+        std::string error;
+        if (trace_stop(summary, error)) {
+            std::cout << "CONTROL: Wrote " << summary.spans << " spans to " << summary.path << std::endl;
+        } else {
+            std::cout << "CONTROL: Trace not written: " << error << std::endl;
+        }
+    }
     
     std::cout << "CONTROL: Detach() called" << std::endl;
     return true;
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "contract.h"
+#include <cstddef>
+#include <cstring>
+#include <string>
+
+// Payload as handed to control: size bytes at data. terminated means data[size] is a NUL,
+// so text-only handlers can take it without a copy.
+struct dispatch_payload {
+    const char* data;
+    std::size_t size;
+    bool terminated;
+};
+
+inline dispatch_payload text_payload(const char* text) {
+    return {text, text ? std::strlen(text) : 0, true};
+}
+
+struct handler_def;
+
+// Runs one of control's own handlers; exceptions become an error response. site is the
+// handle the call came through, 0 for none (see stats.h).
+void control_run_handler(const handler_def& handler, dispatch_payload payload, const char* options,
+                         std::string& response, std::size_t site = 0);
+
+// Runs control's own handler or routes to the owning plugin; result lands in response.
+// Returns false when nothing handled the address. Safe to call from any thread.
+bool control_dispatch(const char* address, dispatch_payload payload, const char* options, std::string& response);
+
+// control_dispatch for InvokeAsync. A plugin that exports InvokeDeferred gets the call
+// without this thread waiting on it, so a coroutine handler can park until its nested
+// dispatches complete; anything else is dispatched here as usual. callback, which may be
+// null, runs once.
+void control_dispatch_deferred(const char* address, dispatch_payload payload, const char* options,
+                               CompletionFn callback, void* user_data);
@@ -0,0 +1,50 @@
+#include "epoch.h"
+#include <thread>
+
+static thread_local unsigned t_depth = 0;
+
+unsigned epoch_gate::enter() {
+    while (true) {
+        std::uint64_t epoch = epoch_.load(std::memory_order_seq_cst);
+        unsigned slot = unsigned(epoch & 1);
+        counters_[slot].readers.fetch_add(1, std::memory_order_seq_cst);
+        // If a writer flipped in between, it may already have seen this counter at zero
+        if (epoch_.load(std::memory_order_seq_cst) == epoch) {
+            ++t_depth;
+            return slot;
+        }
+        counters_[slot].readers.fetch_sub(1, std::memory_order_release);
+    }
+}
+
+void epoch_gate::leave(unsigned slot) {
+    --t_depth;
+    counters_[slot].readers.fetch_sub(1, std::memory_order_release);
+}
+
+bool epoch_gate::synchronize(std::chrono::milliseconds limit) {
+    auto deadline = std::chrono::steady_clock::now() + limit;
+    // One flip isn't enough: a reader that entered on the other counter before an earlier
+    // writer gave up may still hold data that was current until now
+    for (int flip = 0; flip < 2; ++flip) {
+        unsigned slot = unsigned(epoch_.fetch_add(1, std::memory_order_seq_cst) & 1);
+        if (!wait_drained(slot, deadline)) return false;
+    }
+    return true;
+}
+
+bool epoch_gate::wait_drained(unsigned slot, std::chrono::steady_clock::time_point deadline) const {
+    for (unsigned spins = 0; counters_[slot].readers.load(std::memory_order_acquire) != 0; ++spins) {
+        if (std::chrono::steady_clock::now() >= deadline) return false;
+        if (spins < 64) {
+            std::this_thread::yield();
+        } else {
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+        }
+    }
+    return true;
+}
+
+bool epoch_gate::reading() {
+    return t_depth > 0;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+// Epoch-based reclamation for data that is read on every dispatch and changed rarely.
+// Readers bump one of two counters, picked by the parity of the current epoch; they
+// never block. A writer publishes new data and then calls synchronize(), after which no
+// reader can still hold what was there before.
+class epoch_gate {
+public:
+    // Registers a reader and returns the slot to hand back to leave()
+    unsigned enter();
+    void leave(unsigned slot);
+
+    // Flips the epoch twice, waiting for each counter to drain, so every reader that
+    // entered before the call has left. Bounded: a writer that gives up returns false and
+    // must keep the old data alive. Never call it from inside a read section.
+    bool synchronize(std::chrono::milliseconds limit);
+
+    // True while the calling thread is inside a read section of any gate
+    static bool reading();
+
+private:
+    bool wait_drained(unsigned slot, std::chrono::steady_clock::time_point deadline) const;
+
+    struct alignas(64) counter {
+        std::atomic<std::uint64_t> readers{0};
+    };
+
+    std::atomic<std::uint64_t> epoch_{0};
+    counter counters_[2];
+};
+
+// Read section for the scope of the object
+class epoch_read {
+public:
+    explicit epoch_read(epoch_gate& gate) : gate_(gate), slot_(gate.enter()) {}
+    ~epoch_read() { gate_.leave(slot_); }
+    epoch_read(const epoch_read&) = delete;
+    epoch_read& operator=(const epoch_read&) = delete;
+
+private:
+    epoch_gate& gate_;
+    unsigned slot_;
+};
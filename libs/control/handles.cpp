@@ -0,0 +1,219 @@
+#include "handles.h"
+#include "handler.h"
+#include "registry.h"
+#include "stats.h"
+#include "trace.h"
+#include "cache.h"
+#include "deadline.h"
+#include "admission.h"
+#include "watchdog.h"
+#include <atomic>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+const handler_table& control_table();
+
+namespace {
+
+constexpr std::uint64_t kUnbound = std::numeric_limits<std::uint64_t>::max();
+
+// One per address ever resolved. address and local are set before the slot is published
+// and never change. A plugin binding holds for the registry generation it was made under
+// and is rebound in place after a swap: the writer clears generation, rewrites the rest
+// and sets generation again, and a reader that sees the same generation before and after
+// reading the rest has a consistent binding.
+struct handle_slot {
+    std::string address;
+    const handler_def* local = nullptr;  // control's own handler
+    std::atomic<std::uint64_t> generation{kUnbound};
+    std::atomic<LoadedPlugin*> plugin{nullptr};  // owning plugin, null if nothing routes the address
+    std::atomic<long> index{-1};     // plugin handler index, -1 if the plugin has no InvokeHandler
+    std::atomic<long> cache_ms{0};   // the plugin's cache policy for the address, see cache.h
+};
+
+struct plugin_binding {
+    LoadedPlugin* plugin = nullptr;
+    long index = -1;
+    long cache_ms = 0;
+};
+
+// Slots live in fixed chunks that are never moved, so readers index them without a lock
+constexpr std::size_t kChunkBits = 8;
+constexpr std::size_t kChunkSize = std::size_t(1) << kChunkBits;
+constexpr std::size_t kMaxChunks = 256;
+
+std::atomic<handle_slot*> g_chunks[kMaxChunks];
+std::atomic<std::size_t> g_count{0};
+
+// Resolution and rebinding are rare; the mutex guards writers and the address map
+std::mutex g_resolve_lock;
+std::unordered_map<std::string, std::size_t> g_interned;  // address -> slot
+
+handle_slot* lookup(std::uint64_t handle) {
+    if (handle == 0 || handle > g_count.load(std::memory_order_acquire)) return nullptr;
+    std::size_t slot = std::size_t(handle - 1);
+    handle_slot* chunk = g_chunks[slot >> kChunkBits].load(std::memory_order_acquire);
+    return chunk ? &chunk[slot & (kChunkSize - 1)] : nullptr;
+}
+
+// Caller holds g_resolve_lock and a registry_read of registry
+void bind(handle_slot& slot, const registry_snapshot& registry) {
+    plugin_binding binding;
+    if (LoadedPlugin* plugin = registry.route(slot.address)) {
+        binding.plugin = plugin;
+        if (control_ensure_loaded(*plugin)) {
+            if (plugin->resolve_handler && plugin->invoke_handler) {
+                binding.index = plugin->resolve_handler(slot.address.c_str());
+            }
+            auto policy = plugin->cache_policy.find(std::string_view(slot.address));
+            if (policy != plugin->cache_policy.end()) binding.cache_ms = policy->second;
+        }
+    }
+    slot.generation.store(kUnbound, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.plugin.store(binding.plugin, std::memory_order_relaxed);
+    slot.index.store(binding.index, std::memory_order_relaxed);
+    slot.cache_ms.store(binding.cache_ms, std::memory_order_relaxed);
+    slot.generation.store(registry.generation, std::memory_order_release);
+}
+
+bool read_binding(const handle_slot& slot, std::uint64_t generation, plugin_binding& binding) {
+    if (slot.generation.load(std::memory_order_acquire) != generation) return false;
+    binding.plugin = slot.plugin.load(std::memory_order_relaxed);
+    binding.index = slot.index.load(std::memory_order_relaxed);
+    binding.cache_ms = slot.cache_ms.load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return slot.generation.load(std::memory_order_relaxed) == generation;
+}
+
+// The slot's binding for the caller's snapshot, rebinding it first if a swap made it stale
+plugin_binding current_binding(handle_slot& slot, const registry_snapshot& registry) {
+    plugin_binding binding;
+    if (read_binding(slot, registry.generation, binding)) return binding;
+
+    std::lock_guard<std::mutex> lock(g_resolve_lock);
+    if (!read_binding(slot, registry.generation, binding)) {
+        bind(slot, registry);
+        read_binding(slot, registry.generation, binding);
+    }
+    return binding;
+}
+
+}
+
+std::uint64_t control_resolve(const char* address) {
+    if (!address) return 0;
+
+    registry_read registry;
+    const handler_def* local = control_table().find(address);
+    if (!local && !registry->route(address)) return 0;
+
+    std::lock_guard<std::mutex> lock(g_resolve_lock);
+    if (auto it = g_interned.find(address); it != g_interned.end()) return it->second + 1;
+
+    std::size_t slot = g_count.load(std::memory_order_relaxed);
+    if (slot >= kMaxChunks * kChunkSize) {
+        std::cout << "CONTROL: Handle table full, not interning '" << address << "'" << std::endl;
+        return 0;
+    }
+    handle_slot* chunk = g_chunks[slot >> kChunkBits].load(std::memory_order_relaxed);
+    if (!chunk) {
+        chunk = new handle_slot[kChunkSize];
+        g_chunks[slot >> kChunkBits].store(chunk, std::memory_order_release);
+    }
+    handle_slot& taken = chunk[slot & (kChunkSize - 1)];
+    taken.address = address;
+    taken.local = local;
+    if (!local) bind(taken, *registry);
+    g_count.store(slot + 1, std::memory_order_release);
+
+    g_interned.emplace(address, slot);
+    return slot + 1;
+}
+
+void control_handles_reset() {
+    std::lock_guard<std::mutex> lock(g_resolve_lock);
+    for (std::size_t slot = 0; slot < g_count.load(std::memory_order_relaxed); ++slot) {
+        handle_slot& bound = g_chunks[slot >> kChunkBits].load(std::memory_order_relaxed)[slot & (kChunkSize - 1)];
+        bound.generation.store(kUnbound, std::memory_order_release);
+    }
+}
+
+bool control_dispatch_handle(std::uint64_t handle, dispatch_payload payload, const char* options,
+                             std::string& response) {
+    handle_slot* slot = lookup(handle);
+    if (!slot) {
+        response = R"({"success":false,"error":"invalid handle"})";
+        stats_record({}, {}, false, true, payload.size, response.size(), stats_clock::now());
+        return false;
+    }
+    // The slot number keys what each thread keeps for the address between calls
+    std::size_t site = std::size_t(handle);
+    const std::string& address = slot->address;
+
+    trace_span span(address, payload.size, response);
+    auto start = stats_clock::now();
+    stats_clock::duration queued{};
+    auto finish = [&](std::string_view owner, bool handled) {
+        stats_record(address, owner, handled, stats_failed(response), payload.size, response.size(), start, queued,
+                     site);
+        return handled;
+    };
+    auto refuse = [&](const char* reason) {
+        response = R"({"success":false,"error":")" + std::string(reason) + R"("})";
+        stats_refused(address, payload.size, response.size(), queued, site);
+        return false;
+    };
+
+    call_scope limits(options);
+    if (const char* reason = limits.refused()) return refuse(reason);
+
+    // Addresses with a concurrency limit may queue here or turn the call away
+    admission_ticket admission(address, site);
+    queued = admission.waited();
+    if (const char* reason = admission.refused()) return refuse(reason);
+    watch_ticket watch(address, site);
+
+    if (slot->local) {
+        control_run_handler(*slot->local, payload, options, response, site);
+        return finish("control", true);
+    }
+
+    // The plugin pointer is only good while the snapshot it was bound under is current
+    registry_read registry;
+    plugin_binding binding = current_binding(*slot, *registry);
+    if (!binding.plugin) {
+        response = R"({"success":false,"error":"no plugin handled address"})";
+        return finish({}, false);
+    }
+
+    LoadedPlugin& plugin = *binding.plugin;
+    if (binding.index < 0) {
+        return finish(plugin.name, control_call_cached(plugin, registry->generation, address.c_str(), payload,
+                                                       options, response));
+    }
+
+    if (binding.cache_ms && cache_get(address, payload, options, registry->generation, response)) {
+        return finish(plugin.name, true);
+    }
+
+    std::uint64_t sequence = cache_sequence();
+    libsresult result = {};
+    {
+        call_probe probe(plugin.memstats, address, plugin.name, site);
+        plugin.invoke_handler(binding.index, payload.data, payload.size, options, &result);
+    }
+    if (!result.data) {
+        plugin.release(&result);
+        return finish(plugin.name, false);
+    }
+    response.assign(result.data, result.size);
+    plugin.release(&result);
+    if (binding.cache_ms && !stats_failed(response)) {
+        cache_put(address, payload, options, registry->generation, sequence, binding.cache_ms, response);
+    }
+    return finish(plugin.name, true);
+}
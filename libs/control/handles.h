@@ -0,0 +1,27 @@
+#pragma once
+
+#include "dispatch.h"
+#include <cstdint>
+#include <string>
+
+// Address interning. A handle binds an address to control's own handler or to the owning
+// plugin and its handler index, so dispatch by handle does no string work at all: what a
+// call needs besides the binding (its stats counters, admission gate and watchdog budget)
+// each thread keeps per handle as well.
+//
+// A plugin binding belongs to the registry snapshot it was made under. After a load,
+// unload or reload publishes a new one, the next dispatch through the handle binds it
+// again, so handles stay valid for the life of the process; one whose address no plugin
+// routes any more gets "no plugin handled address" until one does again.
+
+// Handle for address, 0 if nothing routes it. An address keeps its handle for good; the
+// table holds 64K distinct addresses.
+std::uint64_t control_resolve(const char* address);
+
+// Dispatches to a handle's target. Returns false for unknown handles and unrouted addresses.
+bool control_dispatch_handle(std::uint64_t handle, dispatch_payload payload, const char* options,
+                             std::string& response);
+
+// Drops every plugin binding, so the next dispatch through each handle binds afresh; called
+// at cleanup
+void control_handles_reset();
@@ -0,0 +1,20 @@
+#include "contract.h"
+#include "registry.h"
+
+// Service table handed to every plugin that exports Services
+const libshost* control_host() {
+    static const libshost host = {
+        sizeof(libshost),
+        Invoke,
+        Invoke2,
+        Release,
+        InvokeAsync,
+        InvokeBytes,
+        Resolve,
+        InvokeHandle,
+        Invalidate,
+        Cancelled,
+        Publish,
+    };
+    return &host;
+}
@@ -1,53 +1,481 @@
 #include "contract.h"
 #include "handler.h"
 #include "registry.h"
+#include "dispatch.h"
+#include "handles.h"
+#include "pool.h"
+#include "reactor.h"
+#include "stats.h"
+#include "cache.h"
+#include "bus.h"
+#include "deadline.h"
+#include "admission.h"
+#include "watchdog.h"
+#include "trace.h"
+#include "task.h"
+#include <functional>
 #include <iostream>
+#include <memory>
+#include <optional>
 #include <string>
 
 extern DispatchFn g_dispatch;
+extern bool g_log_calls;
 
-handler_list control_with();
+const handler_table& control_table();
 
-extern "C" const char* Invoke(const char* address, 
-                              const char* payload, 
-                              const char* options) {
+void control_run_handler(const handler_def& handler, dispatch_payload payload, const char* options,
+                         std::string& response, std::size_t site) {
+    call_probe probe(MemStats, handler.sid, "control", site);
+    std::string err;
+    try {
+        if (handler.bytes) {
+            response = handler.bytes(std::string_view(payload.data ? payload.data : "", payload.size), options, err);
+        } else if (handler.co) {
+            response = sync_wait(handler.co(std::string(payload.data ? payload.data : "", payload.size),
+                                            options ? options : ""));
+        } else if (!payload.terminated && payload.data) {
+            // Text handlers expect a NUL-terminated payload
+            std::string text(payload.data, payload.size);
+            response = std::any_cast<std::string>(handler.fun(text.c_str(), options, err));
+        } else {
+            response = std::any_cast<std::string>(handler.fun(payload.data, options, err));
+        }
+    } catch (const std::exception& ex) {
+        response = R"({"success":false,"error":")" + std::string(ex.what()) + R"("})";
+    }
+}
+
+namespace {
+
+// Only with log_calls set, see kLogCallsEnv
+void log_call(const char* address, dispatch_payload payload, const char* options) {
+    if (!g_log_calls) return;
+    std::cout << "CONTROL: Invoke called\n";
+    std::cout << "CONTROL: address='" << (address ? address : "null") << "'\n";
+    if (payload.terminated) {
+        std::cout << "CONTROL: payload='" << (payload.data ? payload.data : "null") << "'\n";
+    } else {
+        std::cout << "CONTROL: payload=<" << payload.size << " bytes>\n";
+    }
+    std::cout << "CONTROL: pptions='" << (options ? options : "null") << "'\n";
+}
+
+// Turns a call away before it runs. It is booked under its address when something owns
+// the address, and with the unrouted calls otherwise.
+bool refuse(const char* address, std::size_t bytes_in, const char* reason, stats_clock::time_point start,
+            stats_clock::duration queued, std::string& response) {
+    response = R"({"success":false,"error":")" + std::string(reason) + R"("})";
+    std::string_view name = address ? address : "";
+    bool owned = control_table().find(name) || admission_limited(name);
+    if (!owned && address) {
+        registry_read registry;
+        owned = registry->route(address) != nullptr;
+    }
+    if (owned) {
+        stats_refused(name, bytes_in, response.size(), queued);
+    } else {
+        stats_record(name, {}, false, true, bytes_in, response.size(), start, queued);
+    }
+    return false;
+}
+
+// Runs control's own handler for an admitted call or routes it to the owning plugin, and
+// reports the outcome through finish(owner, handled), whose result it returns
+template <typename Finish>
+bool run_routed(const char* address, dispatch_payload payload, const char* options, std::string& response,
+                Finish&& finish) {
+    if (const handler_def* handler = control_table().find(address ? address : "")) {
+        control_run_handler(*handler, payload, options, response);
+        return finish("control", true);
+    }
+
+    // Plugins are only reached through the pinned snapshot, which keeps them loaded until
+    // this dispatch returns even if they are unloaded or reloaded meanwhile
+    registry_read registry;
 
-    std::cout << "CONTROL: Invoke called" << std::endl;
-    std::cout << "CONTROL: address='" << (address ? address : "null") << "'" << std::endl;
-    std::cout << "CONTROL: payload='" << (payload ? payload : "null") << "'" << std::endl;
-    std::cout << "CONTROL: pptions='" << (options ? options : "null") << "'" << std::endl;
-    
-    handler_list handlers = control_with();
-    
-    for (const auto& handler : handlers) {
-        if (handler.sid == address) {
-            std::string err;
-            try {
-                std::any result = handler.fun(payload, options, err);
-                static std::string response;
-                response = std::any_cast<std::string>(result);
-                return response.c_str();
-            } catch (const std::exception& ex) {
-                static std::string response = R"({"success":false,"error":")" + std::string(ex.what()) + R"("})";
-                return response.c_str();
+    // Single lookup in the snapshot's route table
+    if (address) {
+        if (LoadedPlugin* plugin = registry->route(address)) {
+            if (g_log_calls) std::cout << "CONTROL: Routed to " << plugin->name << '\n';
+            if (control_call_cached(*plugin, registry->generation, address, payload, options, response)) {
+                return finish(plugin->name, true);
             }
         }
     }
-    
-    // Broadcast to all loaded plugins - let them decide if they handle it
-    std::vector<LoadedPlugin>& plugins = control_get_registry();
-    
-    for (auto& plugin : plugins) {
-        const char* result = plugin.invoke(address, payload, options);
-        
+
+    // Legacy plugins that don't export Routes - let them decide if they handle it
+    for (const auto& plugin : registry->plugins) {
+        if (plugin->lazy || plugin->routes) continue;
+
         // Check if plugin handled it (any non-null response)
-        if (result != nullptr) {
-            std::cout << "CONTROL: Routed to " << plugin.name << std::endl;
-            return result;
+        if (control_call_plugin(*plugin, address, payload, options, response)) {
+            if (g_log_calls) std::cout << "CONTROL: Routed to " << plugin->name << '\n';
+            return finish(plugin->name, true);
         }
     }
-    
+
     // No plugin handled it
-    std::cout << "CONTROL: No plugin handled address '" << address << "'" << std::endl;
-    return R"({"success":false,"error":"no plugin handled address"})";
+    std::cout << "CONTROL: No plugin handled address '" << (address ? address : "null") << "'\n";
+    response = R"({"success":false,"error":"no plugin handled address"})";
+    return finish({}, false);
+}
+
+}
+
+bool control_dispatch(const char* address, dispatch_payload payload, const char* options, std::string& response) {
+    log_call(address, payload, options);
+
+    trace_span span(address ? address : "", payload.size, response);
+    auto start = stats_clock::now();
+    stats_clock::duration queued{};
+    auto finish = [&](std::string_view owner, bool handled) {
+        stats_record(address ? address : "", owner, handled, stats_failed(response), payload.size,
+                     response.size(), start, queued);
+        return handled;
+    };
+
+    call_scope limits(options);
+    if (const char* reason = limits.refused()) return refuse(address, payload.size, reason, start, {}, response);
+
+    // Addresses with a concurrency limit may queue here or turn the call away
+    admission_ticket admission(address ? address : "");
+    queued = admission.waited();
+    if (const char* reason = admission.refused()) return refuse(address, payload.size, reason, start, queued, response);
+    watch_ticket watch(address ? address : "");
+
+    return run_routed(address, payload, options, response, finish);
+}
+
+extern "C" const char* Invoke(const char* address,
+                              const char* payload,
+                              const char* options) {
+    // Legacy entry point and the dispatch callback handed to plugins. Nested dispatches
+    // on this thread reuse the buffer, so fill a local first and publish it at the end.
+    thread_local std::string response;
+    std::string result;
+    control_dispatch(address, text_payload(payload), options, result);
+    response = std::move(result);
+    return response.c_str();
+}
+
+static bool control_dispatch_owned(const char* address, dispatch_payload payload, const char* options,
+                                   libsresult* out) {
+    if (!out) return false;
+
+    auto* response = new std::string();
+    bool handled = control_dispatch(address, payload, options, *response);
+    out->data = response->c_str();
+    out->size = response->size();
+    out->owner = response;
+    return handled;
+}
+
+extern "C" bool Invoke2(const char* address, const char* payload, const char* options, libsresult* out) {
+    return control_dispatch_owned(address, text_payload(payload), options, out);
+}
+
+extern "C" bool InvokeBytes(const char* address, const char* payload, std::size_t payload_len,
+                            const char* options, libsresult* out) {
+    return control_dispatch_owned(address, {payload, payload_len, false}, options, out);
+}
+
+extern "C" std::uint64_t Resolve(const char* address) {
+    return control_resolve(address);
+}
+
+extern "C" bool InvokeHandle(std::uint64_t handle, const char* payload, std::size_t payload_len,
+                             const char* options, libsresult* out) {
+    if (!out) return false;
+
+    auto* response = new std::string();
+    bool handled = control_dispatch_handle(handle, {payload, payload_len, false}, options, *response);
+    out->data = response->c_str();
+    out->size = response->size();
+    out->owner = response;
+    return handled;
+}
+
+extern "C" std::size_t Invalidate(const char* address) {
+    return cache_invalidate(address ? address : "");
+}
+
+extern "C" bool Cancelled() {
+    return call_cancelled();
+}
+
+extern "C" std::size_t Publish(const char* topic, const char* data, std::size_t size) {
+    if (!topic) return 0;
+    return bus_publish(topic, data, size);
+}
+
+extern "C" std::uint64_t Subscribe(const char* topic, std::size_t capacity, int overflow, DeliverFn deliver,
+                                   void* user_data) {
+    if (!topic || !*topic || !deliver) return 0;
+    return bus_id(*bus_subscribe(topic, capacity, libsoverflow(overflow), deliver, user_data, "host"));
+}
+
+extern "C" bool Unsubscribe(std::uint64_t id) {
+    return bus_unsubscribe(id);
+}
+
+extern "C" void Release(libsresult* result) {
+    if (!result) return;
+    delete static_cast<std::string*>(result->owner);
+    *result = {};
+}
+
+// Keeps null arguments null when they are copied into a pooled task
+static std::optional<std::string> own(const char* text) {
+    if (!text) return std::nullopt;
+    return std::string(text);
+}
+
+static const char* view(const std::optional<std::string>& text) {
+    return text ? text->c_str() : nullptr;
+}
+
+static dispatch_payload view_payload(const std::optional<std::string>& text) {
+    if (!text) return {nullptr, 0, true};
+    return {text->c_str(), text->size(), true};
+}
+
+namespace {
+
+// A call handed to a plugin's InvokeDeferred, until the plugin calls back
+struct deferred_call {
+    std::shared_ptr<LoadedPlugin> plugin;  // keeps the LoadedPlugin, and its deferred count, alive
+    std::string address;
+    std::size_t bytes_in = 0;
+    stats_clock::time_point start;
+    stats_clock::duration queued{};
+    std::shared_ptr<admission_ticket> admission;
+    CompletionFn callback = nullptr;
+    void* user_data = nullptr;
+    trace_open span;  // closed by the callback, with what the plugin returned
+
+    // Cacheable addresses only: what the result is stored under
+    long cache_ms = 0;
+    std::uint64_t generation = 0;
+    std::uint64_t sequence = 0;  // see cache_sequence
+    std::string payload;
+    std::optional<std::string> options;
+};
+
+void deferred_done(bool handled, const libsresult* result, void* user_data) {
+    std::unique_ptr<deferred_call> call(static_cast<deferred_call*>(user_data));
+    std::string_view response = result && result->data ? std::string_view(result->data, result->size) : "";
+    trace_end(call->span, call->address, call->bytes_in, response.size());
+    stats_record(call->address, call->plugin->name, handled, stats_failed(response), call->bytes_in, response.size(),
+                 call->start, call->queued);
+    call->admission.reset();
+    if (call->cache_ms && handled && !stats_failed(response)) {
+        cache_put(call->address, {call->payload.c_str(), call->payload.size(), true},
+                  call->options ? call->options->c_str() : nullptr, call->generation, call->sequence,
+                  call->cache_ms, std::string(response));
+    }
+    if (call->callback) {
+        // The caller's span, so a coroutine this resumes hangs its next calls off it
+        trace_parent caller(call->span.parent);
+        call->callback(handled, result, call->user_data);
+    }
+    call->plugin->deferred->fetch_sub(1, std::memory_order_release);
+}
+
+void complete(CompletionFn callback, void* user_data, bool handled, const std::string& response) {
+    if (!callback) return;
+    libsresult result = {response.c_str(), response.size(), nullptr};
+    callback(handled, &result, user_data);
+}
+
+// The plugin that would take address through InvokeDeferred, pinned; null for control's
+// own addresses and plugins without it
+std::shared_ptr<LoadedPlugin> deferred_owner(const registry_snapshot& registry, const char* address) {
+    if (!address || control_table().find(address)) return nullptr;
+    LoadedPlugin* owner = registry.route(address);
+    if (!owner || !control_ensure_loaded(*owner) || !owner->invoke_deferred) return nullptr;
+    for (const auto& plugin : registry.plugins) {
+        if (plugin.get() == owner) return plugin;
+    }
+    return nullptr;
+}
+
+// An asynchronous call queued for a slot, with copies of what its caller's buffers held
+struct queued_call {
+    std::string address;
+    std::optional<std::string> payload;
+    std::optional<std::string> options;
+    CompletionFn callback = nullptr;
+    void* user_data = nullptr;
+    stats_clock::time_point start;
+    std::uint64_t parent = 0;
+    call_context context;
+};
+
+// Runs a resumed call on an executor: the reactor core that owns the address, the pool,
+// or this thread once both are closed
+void hand_off(std::string_view address, const std::function<void()>& task) {
+    if (reactor_running() && reactor_post(address, task)) return;
+    if (pool_ref pool = control_pool(); pool && pool->submit(task)) return;
+    task();
+}
+
+// control_dispatch_deferred once the call holds its slot, if the address has a limit
+void run_admitted(const char* address, dispatch_payload payload, const char* options, CompletionFn callback,
+                  void* user_data, stats_clock::time_point start, std::shared_ptr<admission_ticket> admission) {
+    stats_clock::duration queued = admission ? admission->waited() : stats_clock::duration{};
+    if (const char* reason = admission ? admission->refused() : nullptr) {
+        std::string response;
+        bool handled = refuse(address, payload.size, reason, start, queued, response);
+        complete(callback, user_data, handled, response);
+        return;
+    }
+
+    // Held across the call, so a thread that resumes a coroutine is in a read section
+    // until it has left the plugin's code, see release_plugin
+    registry_read registry;
+    std::shared_ptr<LoadedPlugin> plugin = deferred_owner(*registry, address);
+    if (!plugin) {
+        log_call(address, payload, options);
+        std::string response;
+        bool handled;
+        {
+            trace_span span(address ? address : "", payload.size, response);
+            watch_ticket watch(address ? address : "");
+            handled = run_routed(address, payload, options, response, [&](std::string_view owner, bool routed) {
+                stats_record(address ? address : "", owner, routed, stats_failed(response), payload.size,
+                             response.size(), start, queued);
+                return routed;
+            });
+        }
+        admission.reset();
+        complete(callback, user_data, handled, response);
+        return;
+    }
+
+    std::string response;
+    auto call = std::make_unique<deferred_call>();
+    call->plugin = plugin;
+    call->address = address;
+    call->bytes_in = payload.size;
+    call->start = start;
+    call->queued = queued;
+    call->admission = std::move(admission);
+    call->callback = callback;
+    call->user_data = user_data;
+    call->span = trace_begin();
+
+    if (auto policy = plugin->cache_policy.find(std::string_view(address)); policy != plugin->cache_policy.end()) {
+        if (cache_get(address, payload, options, registry->generation, response)) {
+            trace_end(call->span, address, payload.size, response.size());
+            stats_record(address, plugin->name, true, false, payload.size, response.size(), call->start, call->queued);
+            call.reset();
+            complete(callback, user_data, true, response);
+            return;
+        }
+        call->cache_ms = policy->second;
+        call->generation = registry->generation;
+        call->sequence = cache_sequence();
+        call->payload.assign(payload.data ? payload.data : "", payload.size);
+        call->options = own(options);
+    }
+
+    plugin->deferred->fetch_add(1, std::memory_order_relaxed);
+    deferred_call* pending = call.release();
+    bool started;
+    {
+        // Measured and watched until InvokeDeferred returns; a coroutine that resumes later
+        // runs on whichever thread resumes it, under this span again (see deferred_done)
+        trace_parent in_span(pending->span.current());
+        call_probe probe(plugin->memstats, address, plugin->name);
+        watch_ticket watch(address);
+        started = plugin->invoke_deferred(address, payload.data, payload.size, options, deferred_done, pending);
+    }
+    if (!started) {
+        // Not called back: the plugin has no handler for it after all
+        auto start = pending->start;
+        response = R"({"success":false,"error":"no plugin handled address"})";
+        trace_end(pending->span, address, payload.size, response.size());
+        delete pending;
+        plugin->deferred->fetch_sub(1, std::memory_order_release);
+        stats_record(address, {}, false, true, payload.size, response.size(), start);
+        complete(callback, user_data, false, response);
+    }
+}
+
+}
+
+void control_dispatch_deferred(const char* address, dispatch_payload payload, const char* options,
+                               CompletionFn callback, void* user_data) {
+    auto start = stats_clock::now();
+    call_scope limits(options);
+    if (const char* reason = limits.refused()) {
+        std::string response;
+        bool handled = refuse(address, payload.size, reason, start, {}, response);
+        complete(callback, user_data, handled, response);
+        return;
+    }
+
+    std::string_view name = address ? address : "";
+    auto keep = [&] {
+        auto queued = std::make_shared<queued_call>();
+        queued->address = name;
+        if (payload.data) queued->payload.emplace(payload.data, payload.size);
+        queued->options = own(options);
+        queued->callback = callback;
+        queued->user_data = user_data;
+        queued->start = start;
+        queued->parent = trace_current();
+        queued->context = call_current();
+        return queued;
+    };
+
+    // Control's own coroutine handlers run under sync_wait, which would hold a reactor
+    // loop for every call they await; the pool runs them instead
+    if (reactor_on_loop()) {
+        const handler_def* handler = control_table().find(name);
+        if (pool_ref pool = handler && handler->co ? control_pool() : pool_ref()) {
+            auto queued = keep();
+            bool submitted = pool->submit([queued] {
+                trace_parent caller(queued->parent);
+                call_scope resumed(queued->context);
+                control_dispatch_deferred(queued->address.c_str(), view_payload(queued->payload),
+                                          view(queued->options), queued->callback, queued->user_data);
+            });
+            if (submitted) return;
+        }
+    }
+
+    // A call that has to wait for a slot gives this thread, an executor's, back at once;
+    // the call that frees the slot hands it to an executor again
+    std::shared_ptr<admission_ticket> admission;
+    if (admission_limited(name)) {
+        auto queued = keep();
+        admission = admission_enqueue(name, [queued](std::shared_ptr<admission_ticket> ticket) {
+            hand_off(queued->address, [queued, ticket] {
+                trace_parent caller(queued->parent);
+                call_scope resumed(queued->context);
+                run_admitted(queued->address.c_str(), view_payload(queued->payload), view(queued->options),
+                             queued->callback, queued->user_data, queued->start, ticket);
+            });
+        });
+        if (!admission) return;
+    }
+    run_admitted(address, payload, options, callback, user_data, start, std::move(admission));
+}
+
+extern "C" bool InvokeAsync(const char* address, const char* payload, const char* options,
+                            CompletionFn callback, void* user_data) {
+    if (reactor_running() && reactor_submit(address, payload, options, callback, user_data)) return true;
+
+    pool_ref pool = control_pool();
+    if (!pool) return false;
+
+    // The caller's buffers may be gone by the time the task runs
+    return pool->submit([address = own(address), payload = own(payload), options = own(options),
+                         callback, user_data, parent = trace_current(), context = call_current()]() mutable {
+        trace_parent caller(parent);
+        call_scope limits(std::move(context));
+        control_dispatch_deferred(view(address), view_payload(payload), view(options), callback, user_data);
+    });
 }
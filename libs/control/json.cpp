@@ -0,0 +1,241 @@
+#include "json.h"
+#include <cstdio>
+#include <cstdlib>
+
+static void skip_ws(std::string_view text, std::size_t& pos) {
+    while (pos < text.size() && (text[pos] == ' ' || text[pos] == '\t' || text[pos] == '\n' || text[pos] == '\r')) {
+        ++pos;
+    }
+}
+
+static bool skip_string(std::string_view text, std::size_t& pos) {
+    if (pos >= text.size() || text[pos] != '"') return false;
+    for (++pos; pos < text.size(); ++pos) {
+        if (text[pos] == '\\') {
+            ++pos;
+        } else if (text[pos] == '"') {
+            ++pos;
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool skip_container(std::string_view text, std::size_t& pos, char open, char close) {
+    ++pos;
+    skip_ws(text, pos);
+    if (pos < text.size() && text[pos] == close) {
+        ++pos;
+        return true;
+    }
+    while (pos < text.size()) {
+        if (open == '{') {
+            if (!skip_string(text, pos)) return false;
+            skip_ws(text, pos);
+            if (pos >= text.size() || text[pos] != ':') return false;
+            ++pos;
+        }
+        if (!json_skip_value(text, pos)) return false;
+        skip_ws(text, pos);
+        if (pos >= text.size()) return false;
+        if (text[pos] == close) {
+            ++pos;
+            return true;
+        }
+        if (text[pos] != ',') return false;
+        ++pos;
+        skip_ws(text, pos);
+    }
+    return false;
+}
+
+bool json_skip_value(std::string_view text, std::size_t& pos) {
+    skip_ws(text, pos);
+    if (pos >= text.size()) return false;
+
+    char c = text[pos];
+    if (c == '"') return skip_string(text, pos);
+    if (c == '{') return skip_container(text, pos, '{', '}');
+    if (c == '[') return skip_container(text, pos, '[', ']');
+
+    // Numbers and literals run until the next delimiter
+    std::size_t start = pos;
+    while (pos < text.size() && text[pos] != ',' && text[pos] != '}' && text[pos] != ']' &&
+           text[pos] != ' ' && text[pos] != '\t' && text[pos] != '\n' && text[pos] != '\r') {
+        ++pos;
+    }
+    std::string_view token = text.substr(start, pos - start);
+    if (token == "true" || token == "false" || token == "null") return true;
+    if (token.empty()) return false;
+    for (char d : token) {
+        if (!((d >= '0' && d <= '9') || d == '-' || d == '+' || d == '.' || d == 'e' || d == 'E')) return false;
+    }
+    return true;
+}
+
+bool json_is_value(std::string_view text) {
+    std::size_t pos = 0;
+    if (!json_skip_value(text, pos)) return false;
+    skip_ws(text, pos);
+    return pos == text.size();
+}
+
+bool json_object_each(std::string_view text, const std::function<void(std::string_view, std::string_view)>& fn) {
+    std::size_t pos = 0;
+    skip_ws(text, pos);
+    if (pos >= text.size() || text[pos] != '{') return false;
+    ++pos;
+    skip_ws(text, pos);
+    if (pos < text.size() && text[pos] == '}') return true;
+
+    while (pos < text.size()) {
+        std::size_t key_start = pos;
+        if (!skip_string(text, pos)) return false;
+        std::string_view key = text.substr(key_start + 1, pos - key_start - 2);
+        skip_ws(text, pos);
+        if (pos >= text.size() || text[pos] != ':') return false;
+        ++pos;
+        skip_ws(text, pos);
+        std::size_t value_start = pos;
+        if (!json_skip_value(text, pos)) return false;
+        fn(key, text.substr(value_start, pos - value_start));
+        skip_ws(text, pos);
+        if (pos < text.size() && text[pos] == '}') return true;
+        if (pos >= text.size() || text[pos] != ',') return false;
+        ++pos;
+        skip_ws(text, pos);
+    }
+    return false;
+}
+
+bool json_array_each(std::string_view text, const std::function<void(std::string_view)>& fn) {
+    std::size_t pos = 0;
+    skip_ws(text, pos);
+    if (pos >= text.size() || text[pos] != '[') return false;
+    ++pos;
+    skip_ws(text, pos);
+    if (pos < text.size() && text[pos] == ']') return true;
+
+    while (pos < text.size()) {
+        std::size_t value_start = pos;
+        if (!json_skip_value(text, pos)) return false;
+        fn(text.substr(value_start, pos - value_start));
+        skip_ws(text, pos);
+        if (pos < text.size() && text[pos] == ']') return true;
+        if (pos >= text.size() || text[pos] != ',') return false;
+        ++pos;
+        skip_ws(text, pos);
+    }
+    return false;
+}
+
+std::optional<std::string_view> json_find(std::string_view text, std::string_view key) {
+    std::optional<std::string_view> found;
+    json_object_each(text, [&](std::string_view k, std::string_view raw) {
+        if (!found && k == key) found = raw;
+    });
+    return found;
+}
+
+static unsigned hex4(std::string_view digits) {
+    return unsigned(std::strtoul(std::string(digits).c_str(), nullptr, 16));
+}
+
+static void append_utf8(std::string& out, unsigned code) {
+    if (code < 0x80) {
+        out += char(code);
+    } else if (code < 0x800) {
+        out += char(0xC0 | (code >> 6));
+        out += char(0x80 | (code & 0x3F));
+    } else if (code < 0x10000) {
+        out += char(0xE0 | (code >> 12));
+        out += char(0x80 | ((code >> 6) & 0x3F));
+        out += char(0x80 | (code & 0x3F));
+    } else {
+        out += char(0xF0 | (code >> 18));
+        out += char(0x80 | ((code >> 12) & 0x3F));
+        out += char(0x80 | ((code >> 6) & 0x3F));
+        out += char(0x80 | (code & 0x3F));
+    }
+}
+
+std::string json_text(std::string_view raw) {
+    if (raw.size() < 2 || raw.front() != '"' || raw.back() != '"') return std::string(raw);
+
+    std::string out;
+    out.reserve(raw.size() - 2);
+    for (std::size_t i = 1; i + 1 < raw.size(); ++i) {
+        char c = raw[i];
+        if (c != '\\' || i + 2 >= raw.size()) {
+            out += c;
+            continue;
+        }
+        char e = raw[++i];
+        switch (e) {
+            case 'n': out += '\n'; break;
+            case 'r': out += '\r'; break;
+            case 't': out += '\t'; break;
+            case 'b': out += '\b'; break;
+            case 'f': out += '\f'; break;
+            case 'u': {
+                if (i + 4 >= raw.size()) return out;
+                unsigned code = hex4(raw.substr(i + 1, 4));
+                i += 4;
+                // A surrogate pair is one code point; half of one on its own becomes U+FFFD
+                if (code >= 0xD800 && code <= 0xDBFF && i + 7 < raw.size() && raw[i + 1] == '\\' &&
+                    raw[i + 2] == 'u') {
+                    unsigned low = hex4(raw.substr(i + 3, 4));
+                    if (low >= 0xDC00 && low <= 0xDFFF) {
+                        code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+                        i += 6;
+                    }
+                }
+                if (code >= 0xD800 && code <= 0xDFFF) code = 0xFFFD;
+                append_utf8(out, code);
+                break;
+            }
+            default: out += e; break;
+        }
+    }
+    return out;
+}
+
+long long json_int(std::string_view text, std::string_view key, long long fallback) {
+    auto raw = json_find(text, key);
+    if (!raw || raw->empty()) return fallback;
+    std::string value(*raw);
+    char* end = nullptr;
+    long long parsed = std::strtoll(value.c_str(), &end, 10);
+    return end == value.c_str() ? fallback : parsed;
+}
+
+bool json_bool(std::string_view text, std::string_view key, bool fallback) {
+    auto raw = json_find(text, key);
+    if (!raw) return fallback;
+    if (*raw == "true") return true;
+    if (*raw == "false") return false;
+    return fallback;
+}
+
+std::string json_escape(std::string_view text) {
+    std::string out;
+    out.reserve(text.size());
+    for (char c : text) {
+        switch (c) {
+            case '"': out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\r': out += "\\r"; break;
+            case '\t': out += "\\t"; break;
+            default:
+                if ((unsigned char)c < 0x20) {
+                    char buf[8];
+                    std::snprintf(buf, sizeof(buf), "\\u%04x", (unsigned char)c);
+                    out += buf;
+                } else {
+                    out += c;
+                }
+        }
+    }
+    return out;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <optional>
+#include <string>
+#include <string_view>
+
+// Minimal JSON scanning for control's own payloads. Values are handed around as raw
+// slices of the input; nothing is materialised unless asked for.
+
+// Advances pos past one complete value; false on malformed input
+bool json_skip_value(std::string_view text, std::size_t& pos);
+
+// True if text holds exactly one JSON value (surrounding whitespace allowed)
+bool json_is_value(std::string_view text);
+
+// Calls fn for each member of a top-level object / element of a top-level array
+bool json_object_each(std::string_view text, const std::function<void(std::string_view key, std::string_view raw)>& fn);
+bool json_array_each(std::string_view text, const std::function<void(std::string_view raw)>& fn);
+
+// Raw value of a top-level member, if present
+std::optional<std::string_view> json_find(std::string_view text, std::string_view key);
+
+// Decoded string for a raw string value; any other raw value is returned as-is
+std::string json_text(std::string_view raw);
+
+// Integer / boolean members with a fallback
+long long json_int(std::string_view text, std::string_view key, long long fallback);
+bool json_bool(std::string_view text, std::string_view key, bool fallback);
+
+// Escapes text for use inside a JSON string literal (without the quotes)
+std::string json_escape(std::string_view text);
@@ -0,0 +1,187 @@
+#include "manifest.h"
+#include <atomic>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <system_error>
+
+#if !defined(_WIN32)
+    #include <cerrno>
+    #include <fcntl.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#else
+    #include <windows.h>
+#endif
+
+static constexpr const char* kManifestHeader = "# jam plugin manifest v3";
+
+bool manifest_stamp(const std::filesystem::path& path, file_stamp& out) {
+    std::error_code ec;
+    out.size = std::filesystem::file_size(path, ec);
+    if (ec) return false;
+    out.mtime = std::filesystem::last_write_time(path, ec).time_since_epoch().count();
+    if (ec) return false;
+#if !defined(_WIN32)
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) return false;
+    out.inode = std::uint64_t(st.st_ino);
+#endif
+    return true;
+}
+
+// Tabs and newlines would break the line format
+static std::string field(const std::string& text) {
+    std::string out = text;
+    for (char& c : out) {
+        if (c == '\t' || c == '\n' || c == '\r') c = ' ';
+    }
+    return out;
+}
+
+static std::vector<std::string> split(const std::string& line, char sep) {
+    std::vector<std::string> parts;
+    std::string part;
+    std::istringstream in(line);
+    while (std::getline(in, part, sep)) parts.push_back(part);
+    if (!line.empty() && line.back() == sep) parts.emplace_back();
+    return parts;
+}
+
+static std::string serialize(const manifest_map& manifest) {
+    std::ostringstream out;
+    out << kManifestHeader << "\n";
+    for (const auto& [filename, entry] : manifest) {
+        out << field(filename) << '\t' << entry.stamp.inode << '\t' << entry.stamp.mtime << '\t'
+            << entry.stamp.size << '\t' << (entry.valid ? "plugin" : "invalid") << '\t'
+            << field(entry.plugin_type) << '\t' << std::hex << entry.plugin_id << std::dec << '\t'
+            << field(entry.product) << '\t' << field(entry.description_short) << '\t'
+            << field(entry.description_long) << '\t';
+        if (!entry.has_routes) {
+            out << '*';
+        } else {
+            for (std::size_t i = 0; i < entry.addresses.size(); ++i) {
+                if (i > 0) out << ',';
+                out << field(entry.addresses[i]);
+            }
+        }
+        out << '\t';
+        for (std::size_t i = 0; i < entry.depends_on.size(); ++i) {
+            if (i > 0) out << ',';
+            out << field(entry.depends_on[i]);
+        }
+        out << '\t';
+        for (std::size_t i = 0; i < entry.topics.size(); ++i) {
+            if (i > 0) out << ',';
+            out << field(entry.topics[i].topic) << ':' << entry.topics[i].capacity << ':' << entry.topics[i].overflow;
+        }
+        out << "\n";
+    }
+    return out.str();
+}
+
+static std::string read_all(const std::filesystem::path& file) {
+    std::ifstream in(file, std::ios::binary);
+    if (!in) return {};
+    std::ostringstream text;
+    text << in.rdbuf();
+    return text.str();
+}
+
+manifest_map manifest_read(const std::filesystem::path& file) {
+    manifest_map manifest;
+    std::istringstream in(read_all(file));
+    std::string line;
+    if (!std::getline(in, line) || line != kManifestHeader) return manifest;
+
+    while (std::getline(in, line)) {
+        std::vector<std::string> parts = split(line, '\t');
+        if (parts.size() != 13) continue;
+
+        manifest_entry entry;
+        try {
+            if (!parts[12].empty()) {
+                for (const auto& item : split(parts[12], ',')) {
+                    // The topic itself may contain ':', the two numbers after it don't
+                    std::size_t overflow = item.rfind(':');
+                    std::size_t capacity = overflow == std::string::npos ? overflow : item.rfind(':', overflow - 1);
+                    if (capacity == std::string::npos) throw std::invalid_argument(item);
+                    entry.topics.push_back({item.substr(0, capacity), std::stoull(item.substr(capacity + 1)),
+                                            std::stoi(item.substr(overflow + 1))});
+                }
+            }
+            entry.stamp.inode = std::stoull(parts[1]);
+            entry.stamp.mtime = std::stoll(parts[2]);
+            entry.stamp.size = std::stoull(parts[3]);
+            entry.plugin_id = std::stoul(parts[6], nullptr, 16);
+        } catch (const std::exception&) {
+            continue;
+        }
+        entry.valid = parts[4] == "plugin";
+        entry.plugin_type = parts[5];
+        entry.product = parts[7];
+        entry.description_short = parts[8];
+        entry.description_long = parts[9];
+        entry.has_routes = parts[10] != "*";
+        if (entry.has_routes && !parts[10].empty()) entry.addresses = split(parts[10], ',');
+        if (!parts[11].empty()) entry.depends_on = split(parts[11], ',');
+        manifest[parts[0]] = std::move(entry);
+    }
+    return manifest;
+}
+
+// Writes text to path and flushes it to disk before returning true
+static bool write_durable(const std::filesystem::path& path, const std::string& text) {
+#if !defined(_WIN32)
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+    if (fd < 0) return false;
+    std::size_t written = 0;
+    while (written < text.size()) {
+        ssize_t n = write(fd, text.data() + written, text.size() - written);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        written += std::size_t(n);
+    }
+    bool ok = written == text.size() && fsync(fd) == 0;
+    return close(fd) == 0 && ok;
+#else
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (!out) return false;
+    out << text;
+    out.flush();
+    return bool(out);
+#endif
+}
+
+bool manifest_write(const std::filesystem::path& file, const manifest_map& manifest) {
+    std::string text = serialize(manifest);
+    if (text == read_all(file)) return true;
+
+    // Write beside it and rename, so a concurrent reader sees the old or the new file. The
+    // temp name is this process's own, since another one may be writing at the same time.
+    static std::atomic<unsigned> g_writes{0};
+#if !defined(_WIN32)
+    unsigned long pid = (unsigned long)getpid();
+#else
+    unsigned long pid = GetCurrentProcessId();
+#endif
+    std::ostringstream suffix;
+    suffix << '.' << pid << '.' << g_writes.fetch_add(1) << ".tmp";
+    std::filesystem::path temp = file;
+    temp += suffix.str();
+    std::error_code ec;
+    if (!write_durable(temp, text)) {
+        std::cout << "CONTROL: Could not write " << temp << std::endl;
+        std::filesystem::remove(temp, ec);
+        return false;
+    }
+    std::filesystem::rename(temp, file, ec);
+    if (ec) {
+        std::cout << "CONTROL: Could not write " << file << ": " << ec.message() << std::endl;
+        std::filesystem::remove(temp, ec);
+        return false;
+    }
+    std::cout << "CONTROL: Wrote manifest with " << manifest.size() << " libraries" << std::endl;
+    return true;
+}
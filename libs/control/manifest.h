@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <string>
+#include <vector>
+
+// On-disk plugin manifest, kept next to the plugins as plugins.manifest. One line per
+// library, tab-separated, in this order (hosts parse it too, see apps/cjam/control/boot.cpp):
+//
+//   filename  inode  mtime  size  status  plugin_type  plugin_id  product  description_short
+//   description_long  addresses  requires  topics
+//
+// status is "plugin" or "invalid" (opens, but lacks the plugin exports). addresses is a
+// comma-separated list, or "*" for a plugin without a Routes export. requires is the
+// comma-separated Requires list, empty when there is none. topics lists the plugin's
+// Subscriptions the same way, each as topic:capacity:overflow. A library whose
+// inode, mtime and size still match its line is trusted without being probed again.
+
+constexpr const char* kManifestName = "plugins.manifest";
+
+struct file_stamp {
+    std::uint64_t inode = 0;
+    std::int64_t mtime = 0;
+    std::uint64_t size = 0;
+
+    bool operator==(const file_stamp&) const = default;
+};
+
+struct manifest_topic {
+    std::string topic;
+    std::size_t capacity = 0;
+    int overflow = 0;  // libsoverflow
+};
+
+struct manifest_entry {
+    file_stamp stamp;
+    bool valid = false;
+    std::string plugin_type;
+    unsigned long plugin_id = 0;
+    std::string product;
+    std::string description_short;
+    std::string description_long;
+    bool has_routes = false;
+    std::vector<std::string> addresses;
+    std::vector<std::string> depends_on;
+    std::vector<manifest_topic> topics;
+};
+
+// Keyed by filename
+using manifest_map = std::map<std::string, manifest_entry>;
+
+// False if the file can't be stat'ed
+bool manifest_stamp(const std::filesystem::path& path, file_stamp& out);
+
+// Empty map when the file is missing or from another format version
+manifest_map manifest_read(const std::filesystem::path& file);
+
+// Rewrites the file atomically; skipped when nothing changed since read
+bool manifest_write(const std::filesystem::path& file, const manifest_map& manifest);
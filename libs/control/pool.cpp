@@ -0,0 +1,246 @@
+#include "pool.h"
+#include "trace.h"
+#include "deadline.h"
+#include <chrono>
+#include <iostream>
+
+// Worker identity, so submissions from inside a task stay on the local deque
+static thread_local const work_pool* t_pool = nullptr;
+static thread_local std::size_t t_worker = 0;
+
+work_pool::work_pool(std::size_t workers) {
+    if (workers == 0) workers = 1;
+    for (std::size_t i = 0; i < workers; ++i) {
+        queues_.push_back(std::make_unique<worker_queue>());
+    }
+    for (std::size_t i = 0; i < workers; ++i) {
+        threads_.emplace_back([this, i] { worker_loop(i); });
+    }
+}
+
+work_pool::~work_pool() {
+    stopping_.store(true);
+    { std::lock_guard<std::mutex> lock(sleep_lock_); }
+    sleep_cv_.notify_all();
+    for (auto& thread : threads_) {
+        if (thread.joinable()) thread.join();
+    }
+
+    // Anything that raced in behind the stop flag still runs, so no completion is lost
+    task_fn task;
+    while (steal(0, task)) run(task);
+}
+
+bool work_pool::submit(task_fn task) {
+    if (stopping_.load(std::memory_order_acquire)) return false;
+
+    std::size_t index = (t_pool == this)
+        ? t_worker
+        : next_queue_.fetch_add(1, std::memory_order_relaxed) % queues_.size();
+    {
+        std::lock_guard<std::mutex> lock(queues_[index]->lock);
+        queues_[index]->tasks.push_back(std::move(task));
+    }
+    pending_.fetch_add(1);
+    submitted_.fetch_add(1, std::memory_order_relaxed);
+
+    // pending_ went up before sleepers_ is read, and a worker counts itself before it
+    // reads pending_, so one of the two sees the other. Taking the lock orders the
+    // wake-up after that worker's check.
+    if (sleepers_.load() > 0) {
+        { std::lock_guard<std::mutex> lock(sleep_lock_); }
+        sleep_cv_.notify_one();
+    }
+    return true;
+}
+
+bool work_pool::pop_local(std::size_t index, task_fn& task) {
+    auto& queue = *queues_[index];
+    std::lock_guard<std::mutex> lock(queue.lock);
+    if (queue.tasks.empty()) return false;
+    task = std::move(queue.tasks.back());
+    queue.tasks.pop_back();
+    return true;
+}
+
+bool work_pool::steal(std::size_t thief, task_fn& task) {
+    for (std::size_t offset = 1; offset <= queues_.size(); ++offset) {
+        auto& queue = *queues_[(thief + offset) % queues_.size()];
+        std::lock_guard<std::mutex> lock(queue.lock);
+        if (queue.tasks.empty()) continue;
+        task = std::move(queue.tasks.front());
+        queue.tasks.pop_front();
+        if (offset != queues_.size()) steals_.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+    return false;
+}
+
+void work_pool::run(task_fn& task) {
+    pending_.fetch_sub(1);
+    try {
+        task();
+    } catch (const std::exception& ex) {
+        std::cout << "CONTROL: Pool task threw: " << ex.what() << std::endl;
+    } catch (...) {
+        std::cout << "CONTROL: Pool task threw unknown exception" << std::endl;
+    }
+    executed_.fetch_add(1, std::memory_order_relaxed);
+}
+
+bool work_pool::run_one() {
+    std::size_t home = (t_pool == this) ? t_worker : 0;
+    task_fn task;
+    if (!pop_local(home, task) && !steal(home, task)) return false;
+    run(task);
+    return true;
+}
+
+void work_pool::worker_loop(std::size_t index) {
+    t_pool = this;
+    t_worker = index;
+
+    while (true) {
+        task_fn task;
+        if (pop_local(index, task) || steal(index, task)) {
+            run(task);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(sleep_lock_);
+        sleepers_.fetch_add(1);
+        sleep_cv_.wait(lock, [this] { return stopping_.load() || pending_.load() > 0; });
+        sleepers_.fetch_sub(1);
+        if (stopping_.load() && pending_.load() == 0) return;
+    }
+}
+
+work_pool::counters work_pool::stats() const {
+    return {
+        queues_.size(),
+        pending_.load(),
+        submitted_.load(std::memory_order_relaxed),
+        executed_.load(std::memory_order_relaxed),
+        steals_.load(std::memory_order_relaxed),
+    };
+}
+
+void pool_for_each(work_pool* pool, std::size_t count, const std::function<void(std::size_t)>& fn) {
+    if (!pool || count < 2) {
+        for (std::size_t i = 0; i < count; ++i) fn(i);
+        return;
+    }
+
+    struct join_state {
+        std::mutex lock;
+        std::condition_variable done_cv;
+        std::size_t remaining = 0;
+    };
+    auto state = std::make_shared<join_state>();
+    state->remaining = count - 1;
+
+    // Dispatches made by the tasks stay children of the caller's span in a trace and
+    // run under the caller's deadline and cancel tokens
+    std::uint64_t parent = trace_current();
+    call_context context = call_current();
+    for (std::size_t i = 1; i < count; ++i) {
+        auto task = [i, &fn, state, parent, context] {
+            {
+                trace_parent caller(parent);
+                call_scope limits(context);
+                fn(i);
+            }
+            std::lock_guard<std::mutex> lock(state->lock);
+            if (--state->remaining == 0) state->done_cv.notify_all();
+        };
+        if (!pool->submit(task)) task();
+    }
+    fn(0);
+
+    // Help drain the pool while waiting, so a caller on a worker can't starve it
+    while (true) {
+        {
+            std::lock_guard<std::mutex> lock(state->lock);
+            if (state->remaining == 0) break;
+        }
+        if (pool->run_one()) continue;
+        std::unique_lock<std::mutex> lock(state->lock);
+        state->done_cv.wait_for(lock, std::chrono::milliseconds(1), [&] { return state->remaining == 0; });
+    }
+}
+
+// The running pool, published once started. A user counts itself in g_pool_users before
+// it loads the pointer, and shutdown clears the pointer before it reads the count, so
+// either the user sees no pool or shutdown waits for it. g_pool_lock only guards starting
+// and stopping.
+static std::mutex g_pool_lock;
+static std::atomic<work_pool*> g_pool{nullptr};
+static std::atomic<bool> g_pool_open{false};
+static std::atomic<long> g_pool_users{0};
+static thread_local long t_pool_users = 0;
+
+pool_ref& pool_ref::operator=(pool_ref&& other) noexcept {
+    if (this != &other) {
+        pool_ref released(std::move(*this));
+        pool_ = std::exchange(other.pool_, nullptr);
+    }
+    return *this;
+}
+
+pool_ref::~pool_ref() {
+    if (!pool_) return;
+    --t_pool_users;
+    g_pool_users.fetch_sub(1, std::memory_order_release);
+}
+
+void control_pool_open() {
+    g_pool_open.store(true);
+}
+
+static work_pool* start_pool() {
+    std::lock_guard<std::mutex> lock(g_pool_lock);
+    if (!g_pool_open.load()) return nullptr;
+    work_pool* pool = g_pool.load();
+    if (!pool) {
+        std::size_t workers = std::thread::hardware_concurrency();
+        if (workers < 2) workers = 2;
+        pool = new work_pool(workers);
+        g_pool.store(pool);
+        std::cout << "CONTROL: Started pool with " << workers << " workers" << std::endl;
+    }
+    return pool;
+}
+
+pool_ref control_pool() {
+    g_pool_users.fetch_add(1);
+    work_pool* pool = g_pool.load();
+    if (!pool && g_pool_open.load(std::memory_order_relaxed)) pool = start_pool();
+    if (!pool) {
+        g_pool_users.fetch_sub(1, std::memory_order_release);
+        return {};
+    }
+    ++t_pool_users;
+    return pool_ref(pool);
+}
+
+void control_pool_shutdown() {
+    work_pool* pool;
+    {
+        std::lock_guard<std::mutex> lock(g_pool_lock);
+        g_pool_open.store(false);
+        pool = g_pool.exchange(nullptr);
+    }
+    if (!pool) return;
+
+    // Batches and async submits still holding it finish first; this thread's own, if it
+    // holds any, can't be waited for
+    for (unsigned spins = 0; g_pool_users.load(std::memory_order_acquire) > t_pool_users; ++spins) {
+        if (spins < 64) {
+            std::this_thread::yield();
+        } else {
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+        }
+    }
+    // Destructor drains queued work and joins the workers
+    delete pool;
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Work-stealing thread pool: one deque per worker, owners pop newest-first,
+// idle workers steal oldest-first from their neighbours.
+class work_pool {
+public:
+    using task_fn = std::function<void()>;
+
+    struct counters {
+        std::size_t workers;
+        std::size_t queued;     // submitted but not yet started
+        std::size_t submitted;
+        std::size_t executed;
+        std::size_t steals;
+    };
+
+    explicit work_pool(std::size_t workers);
+    ~work_pool();
+
+    work_pool(const work_pool&) = delete;
+    work_pool& operator=(const work_pool&) = delete;
+
+    // Queues a task; from a worker thread it goes to that worker's own deque
+    bool submit(task_fn task);
+
+    // Runs one queued task on the calling thread, if any. Lets a thread that waits on
+    // pooled work help instead of blocking a worker.
+    bool run_one();
+
+    counters stats() const;
+
+private:
+    struct worker_queue {
+        std::mutex lock;
+        std::deque<task_fn> tasks;
+    };
+
+    bool pop_local(std::size_t index, task_fn& task);
+    bool steal(std::size_t thief, task_fn& task);
+    void run(task_fn& task);
+    void worker_loop(std::size_t index);
+
+    std::vector<std::unique_ptr<worker_queue>> queues_;
+    std::vector<std::thread> threads_;
+
+    // Workers sleep under sleep_lock_ and count themselves in sleepers_ first, so a
+    // submit only takes the lock to wake one when one is asleep
+    std::mutex sleep_lock_;
+    std::condition_variable sleep_cv_;
+    std::atomic<bool> stopping_{false};
+    std::atomic<std::size_t> sleepers_{0};
+
+    std::atomic<std::size_t> pending_{0};
+    std::atomic<std::size_t> submitted_{0};
+    std::atomic<std::size_t> executed_{0};
+    std::atomic<std::size_t> steals_{0};
+    std::atomic<std::size_t> next_queue_{0};
+};
+
+// Runs fn(0) .. fn(count - 1) on the pool and returns when all are done. The calling
+// thread runs index 0 and then helps drain the pool, so this is safe from a worker.
+// Everything runs inline when pool is null.
+void pool_for_each(work_pool* pool, std::size_t count, const std::function<void(std::size_t)>& fn);
+
+// A use of control's pool. The pool isn't shut down while any is held; empty while the
+// pool is closed.
+class pool_ref {
+public:
+    pool_ref() = default;
+    explicit pool_ref(work_pool* pool) : pool_(pool) {}
+    pool_ref(pool_ref&& other) noexcept : pool_(std::exchange(other.pool_, nullptr)) {}
+    pool_ref& operator=(pool_ref&& other) noexcept;
+    ~pool_ref();
+    pool_ref(const pool_ref&) = delete;
+    pool_ref& operator=(const pool_ref&) = delete;
+
+    work_pool* get() const { return pool_; }
+    work_pool* operator->() const { return pool_; }
+    explicit operator bool() const { return pool_ != nullptr; }
+
+private:
+    work_pool* pool_ = nullptr;
+};
+
+// Control's shared executor. Attach opens it, the workers start on first use, and
+// Detach drains and stops it once every pool_ref handed out is gone; control_pool()
+// returns an empty one while closed.
+void control_pool_open();
+pool_ref control_pool();
+void control_pool_shutdown();
@@ -0,0 +1,469 @@
+#include "reactor.h"
+#include "deadline.h"
+#include "dispatch.h"
+#include "registry.h"
+#include "trace.h"
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#if defined(__APPLE__)
+    #include <mach/mach.h>
+    #include <mach/thread_policy.h>
+    #include <pthread.h>
+#elif defined(__linux__)
+    #include <pthread.h>
+    #include <sched.h>
+#elif defined(_WIN32)
+    #include <windows.h>
+#endif
+
+namespace {
+
+// Slots per mailbox; a sender that finds it full falls back to the locked queue
+constexpr std::size_t kRingSlots = 128;
+
+// Calls a loop runs under one pinned registry snapshot
+constexpr std::size_t kBatch = 64;
+
+// Empty polls before a loop goes to sleep
+constexpr unsigned kSpins = 64;
+
+enum class message_kind { call, completion, task };
+
+// A call, the completion of one made on another core, or a task posted for an address. Mailbox slots are reused, so
+// assigning into their strings stops allocating once they have grown to the traffic.
+struct reactor_message {
+    message_kind kind = message_kind::call;
+    std::string address;
+    std::string payload;  // the response, for a completion
+    std::string options;
+    bool has_payload = false;
+    bool has_options = false;
+    bool handled = false;  // completions only
+    CompletionFn callback = nullptr;
+    void* user_data = nullptr;
+    std::uint64_t parent = 0;
+    call_context context;
+    std::function<void()> task;  // tasks only
+};
+
+// Single producer, single consumer. head and tail sit on their own cache lines, and the
+// producer only rereads head when its cached copy says the ring is full.
+struct mailbox {
+    alignas(64) std::atomic<std::size_t> head{0};
+    alignas(64) std::atomic<std::size_t> tail{0};
+    std::size_t cached_head = 0;
+    reactor_message slots[kRingSlots];
+
+    template <typename Fill>
+    bool push(Fill& fill) {
+        std::size_t at = tail.load(std::memory_order_relaxed);
+        if (at - cached_head == kRingSlots) {
+            cached_head = head.load(std::memory_order_acquire);
+            if (at - cached_head == kRingSlots) return false;
+        }
+        fill(slots[at % kRingSlots]);
+        tail.store(at + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool empty() const {
+        return head.load(std::memory_order_relaxed) == tail.load(std::memory_order_acquire);
+    }
+};
+
+// Written only by the core's own thread; read by reports
+struct counter {
+    std::atomic<std::uint64_t> value{0};
+
+    void bump() { value.store(value.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed); }
+    std::uint64_t get() const { return value.load(std::memory_order_relaxed); }
+};
+
+struct reactor_core {
+    std::size_t index = 0;
+
+    // inbox[k] carries what core k sends here; created by core k on its first send
+    std::vector<std::atomic<mailbox*>> inbox;
+    std::vector<std::unique_ptr<mailbox>> owned;
+
+    // Calls from outside the reactor, and sends that found their mailbox full
+    std::mutex injected_lock;
+    std::deque<reactor_message> injected;
+    std::atomic<bool> has_injected{false};
+    std::deque<reactor_message> draining;
+
+    // Calls this core makes for addresses it owns; spare keeps retired ones for reuse
+    std::deque<reactor_message> local;
+    std::vector<reactor_message> spare;
+
+    std::atomic<std::uint32_t> wake{0};
+    std::atomic<bool> sleeping{false};
+
+    counter executed, local_calls, received, injected_calls, sent, overflowed, completions, sleeps;
+
+    std::thread thread;
+
+    explicit reactor_core(std::size_t cores) : inbox(cores) {
+        for (auto& box : inbox) box.store(nullptr, std::memory_order_relaxed);
+    }
+};
+
+// g_lifecycle guards g_cores against start and stop for threads outside the reactor; the
+// loops themselves only run while the cores exist
+std::shared_mutex g_lifecycle;
+std::vector<std::unique_ptr<reactor_core>> g_cores;
+std::atomic<bool> g_running{false};
+std::atomic<bool> g_stopping{false};
+
+// Posted messages not yet run, plus the completions that cross-core calls will send back
+std::atomic<std::size_t> g_outstanding{0};
+
+thread_local reactor_core* t_core = nullptr;
+
+void wake(reactor_core& core, bool always = false) {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (!always && !core.sleeping.load(std::memory_order_relaxed)) return;
+    core.wake.fetch_add(1, std::memory_order_release);
+    core.wake.notify_one();
+}
+
+void wake_all() {
+    for (auto& core : g_cores) wake(*core, true);
+}
+
+bool stop_reached() {
+    return g_stopping.load(std::memory_order_acquire) && g_outstanding.load(std::memory_order_acquire) == 0;
+}
+
+// Hands a message to target: its own queue from its own thread, the mailbox from another
+// core, the locked queue from anywhere else or when the mailbox is full
+template <typename Fill>
+void post(reactor_core& target, Fill fill) {
+    reactor_core* from = t_core;
+    if (from == &target) {
+        if (target.spare.empty()) {
+            target.local.emplace_back();
+        } else {
+            target.local.push_back(std::move(target.spare.back()));
+            target.spare.pop_back();
+        }
+        fill(target.local.back());
+        return;
+    }
+
+    if (from) {
+        from->sent.bump();
+        mailbox* box = target.inbox[from->index].load(std::memory_order_relaxed);
+        if (!box) {
+            from->owned.push_back(std::make_unique<mailbox>());
+            box = from->owned.back().get();
+            target.inbox[from->index].store(box, std::memory_order_release);
+        }
+        if (box->push(fill)) {
+            wake(target);
+            return;
+        }
+        from->overflowed.bump();
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(target.injected_lock);
+        fill(target.injected.emplace_back());
+        target.has_injected.store(true, std::memory_order_release);
+    }
+    wake(target);
+}
+
+void assign(std::string& to, bool& present, const char* text) {
+    present = text != nullptr;
+    if (text) {
+        to.assign(text);
+    } else {
+        to.clear();
+    }
+}
+
+// Where a cross-core call's completion goes back to
+struct reply_ctx {
+    reactor_core* origin;
+    CompletionFn callback;
+    void* user_data;
+    std::uint64_t parent;  // the caller's span, for what the callback goes on to call
+};
+
+void reply_to_origin(bool handled, const libsresult* result, void* user_data) {
+    std::unique_ptr<reply_ctx> reply(static_cast<reply_ctx*>(user_data));
+    // Counted in g_outstanding when the call was posted
+    post(*reply->origin, [&](reactor_message& message) {
+        message.kind = message_kind::completion;
+        message.handled = handled;
+        message.has_payload = result && result->data;
+        if (message.has_payload) {
+            message.payload.assign(result->data, result->size);
+        } else {
+            message.payload.clear();
+        }
+        message.callback = reply->callback;
+        message.user_data = reply->user_data;
+        message.parent = reply->parent;
+    });
+}
+
+void execute(reactor_core& core, reactor_message& message) {
+    if (message.kind == message_kind::task) {
+        core.executed.bump();
+        message.task();
+        message.task = nullptr;
+    } else if (message.kind == message_kind::completion) {
+        core.completions.bump();
+        libsresult result = {message.has_payload ? message.payload.c_str() : nullptr, message.payload.size(), nullptr};
+        trace_parent caller(message.parent);
+        message.callback(message.handled, &result, message.user_data);
+    } else {
+        core.executed.bump();
+        trace_parent caller(message.parent);
+        call_scope limits(std::move(message.context));
+        dispatch_payload payload = {message.has_payload ? message.payload.c_str() : nullptr, message.payload.size(),
+                                    true};
+        control_dispatch_deferred(message.address.c_str(), payload,
+                                  message.has_options ? message.options.c_str() : nullptr, message.callback,
+                                  message.user_data);
+    }
+    message.context = {};
+
+    if (g_outstanding.fetch_sub(1, std::memory_order_acq_rel) == 1 && g_stopping.load(std::memory_order_acquire)) {
+        wake_all();
+    }
+}
+
+bool has_work(reactor_core& core) {
+    if (!core.local.empty() || core.has_injected.load(std::memory_order_acquire)) return true;
+    for (auto& slot : core.inbox) {
+        mailbox* box = slot.load(std::memory_order_acquire);
+        if (box && !box->empty()) return true;
+    }
+    return false;
+}
+
+std::size_t run_batch(reactor_core& core) {
+    std::size_t ran = 0;
+
+    // Runs before anything it may queue behind itself
+    while (ran < kBatch && !core.local.empty()) {
+        execute(core, core.local.front());
+        core.spare.push_back(std::move(core.local.front()));
+        core.local.pop_front();
+        ++ran;
+    }
+
+    for (auto& slot : core.inbox) {
+        mailbox* box = slot.load(std::memory_order_acquire);
+        if (!box) continue;
+        std::size_t at = box->head.load(std::memory_order_relaxed);
+        std::size_t end = box->tail.load(std::memory_order_acquire);
+        for (; at != end && ran < kBatch; ++at, ++ran) {
+            core.received.bump();
+            execute(core, box->slots[at % kRingSlots]);
+            box->head.store(at + 1, std::memory_order_release);
+        }
+    }
+
+    if (ran < kBatch && core.has_injected.load(std::memory_order_acquire)) {
+        {
+            std::lock_guard<std::mutex> lock(core.injected_lock);
+            core.draining.swap(core.injected);
+            core.has_injected.store(false, std::memory_order_relaxed);
+        }
+        for (auto& message : core.draining) {
+            core.injected_calls.bump();
+            execute(core, message);
+            ++ran;
+        }
+        core.draining.clear();
+    }
+    return ran;
+}
+
+void idle(reactor_core& core) {
+    for (unsigned spin = 0; spin < kSpins; ++spin) {
+        if (has_work(core) || stop_reached()) return;
+        std::this_thread::yield();
+    }
+
+    std::uint32_t seen = core.wake.load(std::memory_order_acquire);
+    core.sleeping.store(true, std::memory_order_relaxed);
+    // Pairs with the fence in wake(): either the sender sees sleeping or this sees its post
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (!has_work(core) && !stop_reached()) {
+        core.sleeps.bump();
+        core.wake.wait(seen, std::memory_order_acquire);
+    }
+    core.sleeping.store(false, std::memory_order_relaxed);
+}
+
+// Keeps the loop on one of the CPUs the process may run on; best effort
+void pin_to_core(std::size_t index) {
+#if defined(__APPLE__)
+    // Mach only takes a hint: threads with different tags are placed on different cores
+    thread_affinity_policy_data_t policy = {integer_t(index + 1)};
+    thread_policy_set(pthread_mach_thread_np(pthread_self()), THREAD_AFFINITY_POLICY,
+                      reinterpret_cast<thread_policy_t>(&policy), THREAD_AFFINITY_POLICY_COUNT);
+#elif defined(__linux__)
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (pthread_getaffinity_np(pthread_self(), sizeof(allowed), &allowed) != 0) return;
+    int count = CPU_COUNT(&allowed);
+    if (count == 0) return;
+    int pick = int(index % std::size_t(count));
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+        if (!CPU_ISSET(cpu, &allowed) || pick-- > 0) continue;
+        cpu_set_t one;
+        CPU_ZERO(&one);
+        CPU_SET(cpu, &one);
+        pthread_setaffinity_np(pthread_self(), sizeof(one), &one);
+        return;
+    }
+#elif defined(_WIN32)
+    SetThreadAffinityMask(GetCurrentThread(), DWORD_PTR(1) << (index % (sizeof(DWORD_PTR) * 8)));
+#endif
+}
+
+void reactor_loop(reactor_core& core) {
+    t_core = &core;
+    pin_to_core(core.index);
+    while (!stop_reached()) {
+        if (!has_work(core)) {
+            idle(core);
+            continue;
+        }
+        // The dispatches in the batch nest inside this read, see registry_read
+        registry_read pinned;
+        run_batch(core);
+    }
+    t_core = nullptr;
+}
+
+reactor_core& home_of(std::string_view address) {
+    return *g_cores[std::hash<std::string_view>{}(address) % g_cores.size()];
+}
+
+}
+
+bool reactor_start(std::size_t cores) {
+    std::unique_lock<std::shared_mutex> lock(g_lifecycle);
+    if (g_running.load(std::memory_order_relaxed) || g_stopping.load(std::memory_order_relaxed)) return false;
+    if (cores == 0) cores = std::max(1u, std::thread::hardware_concurrency());
+
+    for (std::size_t i = 0; i < cores; ++i) {
+        g_cores.push_back(std::make_unique<reactor_core>(cores));
+        g_cores.back()->index = i;
+    }
+    for (auto& core : g_cores) {
+        core->thread = std::thread(reactor_loop, std::ref(*core));
+    }
+    g_running.store(true, std::memory_order_release);
+    std::cout << "CONTROL: Started reactor with " << cores << " cores" << std::endl;
+    return true;
+}
+
+void reactor_stop() {
+    if (t_core) {
+        std::cout << "CONTROL: Not stopping the reactor from one of its loops" << std::endl;
+        return;
+    }
+    {
+        std::unique_lock<std::shared_mutex> lock(g_lifecycle);
+        if (!g_running.load(std::memory_order_relaxed)) return;
+        g_running.store(false, std::memory_order_release);
+        g_stopping.store(true, std::memory_order_release);
+    }
+    // The loops only read g_cores from here on, and the vector stays as it is until they
+    // are joined
+    wake_all();
+    for (auto& core : g_cores) core->thread.join();
+
+    std::unique_lock<std::shared_mutex> lock(g_lifecycle);
+    g_cores.clear();
+    g_stopping.store(false, std::memory_order_release);
+}
+
+bool reactor_running() {
+    return g_running.load(std::memory_order_acquire);
+}
+
+bool reactor_on_loop() {
+    return t_core != nullptr;
+}
+
+bool reactor_submit(const char* address, const char* payload, const char* options, CompletionFn callback,
+                    void* user_data) {
+    // Calls made on a loop are always taken, so whatever runs while the reactor drains can
+    // still make the calls it needs
+    reactor_core* from = t_core;
+    std::shared_lock<std::shared_mutex> lifecycle(g_lifecycle, std::defer_lock);
+    if (!from) {
+        lifecycle.lock();
+        if (!g_running.load(std::memory_order_acquire)) return false;
+    }
+
+    reactor_core& home = home_of(address ? address : "");
+    CompletionFn done = callback;
+    void* done_data = user_data;
+    bool reply = from && from != &home && callback;
+    if (reply) {
+        done = reply_to_origin;
+        done_data = new reply_ctx{from, callback, user_data, trace_current()};
+    }
+    if (from == &home) from->local_calls.bump();
+
+    g_outstanding.fetch_add(reply ? 2 : 1, std::memory_order_relaxed);
+    post(home, [&](reactor_message& message) {
+        message.kind = message_kind::call;
+        message.address.assign(address ? address : "");
+        assign(message.payload, message.has_payload, payload);
+        assign(message.options, message.has_options, options);
+        message.callback = done;
+        message.user_data = done_data;
+        message.parent = trace_current();
+        message.context = call_current();
+    });
+    return true;
+}
+
+bool reactor_post(std::string_view address, std::function<void()> task) {
+    reactor_core* from = t_core;
+    std::shared_lock<std::shared_mutex> lifecycle(g_lifecycle, std::defer_lock);
+    if (!from) {
+        lifecycle.lock();
+        if (!g_running.load(std::memory_order_acquire)) return false;
+    }
+
+    g_outstanding.fetch_add(1, std::memory_order_relaxed);
+    post(home_of(address), [&](reactor_message& message) {
+        message.kind = message_kind::task;
+        message.task = std::move(task);
+    });
+    return true;
+}
+
+std::vector<reactor_counters> reactor_stats() {
+    std::shared_lock<std::shared_mutex> lock(g_lifecycle);
+    std::vector<reactor_counters> out;
+    for (const auto& core : g_cores) {
+        out.push_back({core->index, core->executed.get(), core->local_calls.get(), core->received.get(),
+                       core->injected_calls.get(), core->sent.get(), core->overflowed.get(),
+                       core->completions.get(), core->sleeps.get()});
+    }
+    return out;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include "contract.h"
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string_view>
+#include <vector>
+
+// Thread-per-core execution for asynchronous dispatch, the alternative to the shared pool
+// chosen at attach time. One event loop per core, pinned to it, owns the addresses that
+// hash to it. A call made on a loop for an address it owns runs there without any
+// synchronisation; one owned by another core crosses through the single-producer
+// mailbox between the two loops, and its completion comes back the same way, so
+// callbacks (and the coroutines they resume) stay on the core that made the call. Calls
+// from threads outside the reactor are queued on the owning core, and their callbacks run
+// there.
+//
+// Each loop pins the registry snapshot for a batch of calls, so the dispatches in it
+// don't touch the shared epoch counters; records into its own stats shard; and reuses the
+// strings of its mailbox slots, so steady traffic doesn't allocate per call.
+
+// Starts cores loops; 0 means one per hardware thread. False if already running.
+bool reactor_start(std::size_t cores);
+
+// Runs everything queued, including calls queued by what is run, then joins the loops.
+// Does nothing on a loop thread, which would have to join itself.
+void reactor_stop();
+
+bool reactor_running();
+
+// True on a loop thread. What runs there must not wait for other calls to finish: the
+// loop it holds may be the one that would run them, and its batch pins the registry.
+bool reactor_on_loop();
+
+// Queues an InvokeAsync on the owning core. False when the reactor is stopped.
+bool reactor_submit(const char* address, const char* payload, const char* options, CompletionFn callback,
+                    void* user_data);
+
+// Runs task on the core that owns address, as it would a call there; for work resumed off
+// the loops, such as a call admitted after queueing (see admission.h). False when stopped.
+bool reactor_post(std::string_view address, std::function<void()> task);
+
+struct reactor_counters {
+    std::size_t core = 0;
+    std::uint64_t executed = 0;   // calls run
+    std::uint64_t local = 0;      // of those, made on this core for an address it owns
+    std::uint64_t received = 0;   // arrived through a mailbox from another core
+    std::uint64_t injected = 0;   // arrived through the locked queue: from outside, or overflow
+    std::uint64_t sent = 0;       // calls and completions this core posted to another
+    std::uint64_t overflowed = 0; // posts that found the mailbox full and took the locked queue
+    std::uint64_t completions = 0;
+    std::uint64_t sleeps = 0;
+};
+std::vector<reactor_counters> reactor_stats();
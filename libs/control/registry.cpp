@@ -1,6 +1,20 @@
 #include "registry.h"
+#include "handles.h"
+#include "pool.h"
+#include "manifest.h"
+#include "epoch.h"
+#include "cache.h"
+#include "stats.h"
+#include "timer.h"
+#include <algorithm>
+#include <chrono>
 #include <iostream>
 #include <filesystem>
+#include <functional>
+#include <map>
+#include <optional>
+#include <thread>
+#include <unordered_map>
 
 #if defined(__APPLE__)
     #include <dlfcn.h>
@@ -25,37 +39,689 @@
     #define LIB_CLOSE(handle) FreeLibrary((HMODULE)handle)
 #endif
 
-// Global plugin registry
-static std::vector<LoadedPlugin> g_plugin_registry;
+// The published registry. Readers pin it through g_gate; writers serialise on
+// g_writer_lock and never modify a snapshot once it is stored here.
+static std::atomic<const registry_snapshot*> g_snapshot{new registry_snapshot()};
+static epoch_gate g_gate;
+static std::mutex g_writer_lock;
 
-std::vector<LoadedPlugin>& control_get_registry() {
-    return g_plugin_registry;
+// How long a writer waits for dispatches still using the old snapshot before it gives up
+// and leaves the dropped plugins for a later writer to close
+constexpr std::chrono::milliseconds kGracePeriod{2000};
+
+// Snapshots and plugins a writer couldn't wait out, freed after the next successful wait
+struct retired_registry {
+    const registry_snapshot* snapshot;
+    std::vector<std::shared_ptr<LoadedPlugin>> plugins;
+};
+static std::vector<retired_registry> g_retired;
+
+// Plugins of retired snapshots some close_retired call is waiting out without the lock;
+// still open as far as anyone asking is concerned
+static std::vector<const LoadedPlugin*> g_retiring;
+
+// Plugins no reader can reach that were still busy when they were to be closed. Both
+// lists are guarded by g_writer_lock and retried from the timer until they are empty.
+static std::vector<std::shared_ptr<LoadedPlugin>> g_unclosed;
+
+constexpr std::chrono::milliseconds kRetryEvery{1000};
+static std::mutex g_retry_lock;
+static timer_id g_retry_timer = 0;
+static std::atomic<bool> g_retrying{false};
+
+// Reads nested in one that is open on the thread only take the snapshot: the outer read
+// section already keeps whatever they can see from being reclaimed
+static thread_local unsigned t_reads = 0;
+
+registry_read::registry_read()
+    : slot_(t_reads++ == 0 ? g_gate.enter() : 0), snapshot_(g_snapshot.load(std::memory_order_acquire)) {}
+
+registry_read::~registry_read() {
+    if (--t_reads == 0) g_gate.leave(slot_);
+}
+
+static bool name_matches(std::string_view plugin, std::string_view name) {
+    if (plugin == name) return true;
+    // Short form: "efs" for libefs.dylib
+    std::string_view ext = LIB_EXT;
+    return plugin.size() == 3 + name.size() + ext.size() && plugin.substr(0, 3) == "lib" &&
+           plugin.substr(3, name.size()) == name && plugin.substr(3 + name.size()) == ext;
+}
+
+LoadedPlugin* registry_snapshot::route(std::string_view address) const {
+    auto it = routes.find(address);
+    return it == routes.end() ? nullptr : it->second;
+}
+
+using plugin_list = std::vector<std::shared_ptr<LoadedPlugin>>;
+
+static plugin_list::iterator find_plugin(plugin_list& plugins, std::string_view name) {
+    return std::find_if(plugins.begin(), plugins.end(),
+                        [&](const auto& plugin) { return name_matches(plugin->name, name); });
+}
+
+LoadedPlugin* registry_snapshot::find(std::string_view name) const {
+    for (const auto& plugin : plugins) {
+        if (name_matches(plugin->name, name)) return plugin.get();
+    }
+    return nullptr;
+}
+
+// Libraries the host handed over, by canonical path, until discovery claims them
+struct adopted_library {
+    void* handle;
+    libsinfo info;
+};
+static std::map<std::filesystem::path, adopted_library> g_adopted;
+
+static std::filesystem::path canonical_path(const std::filesystem::path& path) {
+    std::error_code ec;
+    std::filesystem::path canonical = std::filesystem::weakly_canonical(path, ec);
+    return ec ? path : canonical;
+}
+
+void control_adopt(const libshandoff* libs, std::size_t count) {
+    for (std::size_t i = 0; i < count; ++i) {
+        if (!libs[i].path || !libs[i].handle) continue;
+        auto [it, inserted] = g_adopted.try_emplace(canonical_path(libs[i].path), adopted_library{libs[i].handle, libs[i].info});
+        if (!inserted) LIB_CLOSE(libs[i].handle);
+    }
+}
+
+// Groups plugins so that each one only requires plugins in earlier groups; members of a
+// group are independent of each other. Requirements outside the list count as met.
+// Plugins caught in a requirement cycle come last, one per group, in list order.
+static std::vector<std::vector<std::size_t>> requirement_levels(const std::vector<const LoadedPlugin*>& plugins) {
+    std::vector<std::vector<std::size_t>> dependents(plugins.size());
+    std::vector<std::size_t> waiting(plugins.size(), 0);
+    for (std::size_t i = 0; i < plugins.size(); ++i) {
+        for (std::size_t j = 0; j < plugins.size(); ++j) {
+            if (i == j) continue;
+            bool required = std::any_of(plugins[i]->depends_on.begin(), plugins[i]->depends_on.end(),
+                                        [&](const std::string& name) { return name_matches(plugins[j]->name, name); });
+            if (required) {
+                dependents[j].push_back(i);
+                ++waiting[i];
+            }
+        }
+    }
+
+    std::vector<std::vector<std::size_t>> levels;
+    std::vector<std::size_t> ready;
+    for (std::size_t i = 0; i < plugins.size(); ++i) {
+        if (waiting[i] == 0) ready.push_back(i);
+    }
+    std::vector<char> placed(plugins.size(), 0);
+    while (!ready.empty()) {
+        std::vector<std::size_t> next;
+        for (std::size_t i : ready) {
+            placed[i] = 1;
+            for (std::size_t dependent : dependents[i]) {
+                if (--waiting[dependent] == 0) next.push_back(dependent);
+            }
+        }
+        std::sort(next.begin(), next.end());
+        levels.push_back(std::move(ready));
+        ready = std::move(next);
+    }
+
+    for (std::size_t i = 0; i < plugins.size(); ++i) {
+        if (placed[i]) continue;
+        std::cout << "CONTROL: " << plugins[i]->name << " is part of a requirement cycle" << std::endl;
+        levels.push_back({i});
+    }
+    return levels;
+}
+
+static registry_snapshot* build_snapshot(plugin_list plugins, std::uint64_t generation) {
+    auto* snapshot = new registry_snapshot();
+    snapshot->generation = generation;
+    snapshot->plugins = std::move(plugins);
+
+    for (const auto& plugin : snapshot->plugins) {
+        auto route = [&](const char* address) {
+            auto [it, inserted] = snapshot->routes.try_emplace(address, plugin.get());
+            if (!inserted) {
+                std::cout << "CONTROL: Address '" << address << "' already routed to "
+                          << it->second->name << ", ignoring " << plugin->name << std::endl;
+            }
+        };
+
+        // Deferred plugins route by the addresses the manifest recorded for them
+        if (plugin->lazy) {
+            for (const auto& address : plugin->lazy->entry.addresses) route(address.c_str());
+            continue;
+        }
+        if (!plugin->routes) continue;
+
+        const libsroute* routes = nullptr;
+        std::size_t count = plugin->routes(&routes);
+        for (std::size_t r = 0; r < count; ++r) {
+            if (routes[r].address) route(routes[r].address);
+        }
+    }
+
+    std::cout << "CONTROL: Route table has " << snapshot->routes.size() << " addresses" << std::endl;
+    return snapshot;
+}
+
+// Detach and close. Only called once no reader can reach the plugin any more. False when
+// it is still busy and was left loaded, to be tried again.
+static bool release_plugin(LoadedPlugin& plugin) {
+    // First, since a deferred plugin's subscriptions load it when an event arrives
+    while (!plugin.subscriptions.empty()) {
+        if (!bus_unsubscribe(*plugin.subscriptions.back())) {
+            std::cout << "CONTROL: " << plugin.name << " is still taking events, leaving it loaded" << std::endl;
+            return false;
+        }
+        plugin.subscriptions.pop_back();
+    }
+    if (!plugin.handle) return true;  // deferred and never used
+
+    // Deferred calls finish on pool threads, each inside a read section; once the last one
+    // completed, the thread it finished on may still be unwinding through the plugin
+    if (plugin.deferred->load(std::memory_order_acquire) > 0) {
+        auto until = std::chrono::steady_clock::now() + kGracePeriod;
+        while (plugin.deferred->load(std::memory_order_acquire) > 0 && std::chrono::steady_clock::now() < until) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        if (plugin.deferred->load(std::memory_order_acquire) > 0 || !g_gate.synchronize(kGracePeriod)) {
+            std::cout << "CONTROL: " << plugin.name << " still has calls in flight, leaving it loaded" << std::endl;
+            return false;
+        }
+    }
+
+    std::cout << "CONTROL: Detaching " << plugin.name << std::endl;
+    char err_buf[256] = {0};
+    if (plugin.detach && !plugin.detach(err_buf, sizeof(err_buf))) {
+        std::cout << "CONTROL: " << plugin.name << " Detach failed: " << err_buf << std::endl;
+    }
+    LIB_CLOSE(plugin.handle);
+    plugin.handle = nullptr;
+    return true;
+}
+
+static void schedule_retry(bool pending);
+
+// Closes what swaps left behind: retired snapshots and plugins once no reader is left in
+// them, and plugins that were busy before. Returns the plugins still open afterwards.
+static std::vector<const LoadedPlugin*> close_retired(std::chrono::milliseconds grace) {
+    std::vector<retired_registry> retiring;
+    plugin_list closing;
+    {
+        std::lock_guard<std::mutex> lock(g_writer_lock);
+        // A change requested from inside a plugin call can't wait for that call to finish
+        if (!epoch_gate::reading()) retiring.swap(g_retired);
+        for (const auto& retired : retiring) {
+            for (const auto& plugin : retired.plugins) g_retiring.push_back(plugin.get());
+        }
+        for (auto& plugin : g_unclosed) closing.push_back(std::move(plugin));
+        g_unclosed.clear();
+    }
+
+    // Waited out without the lock, so other writers go ahead meanwhile. Whatever they
+    // retire in that time is younger than the wait and stays for the next attempt.
+    if (!retiring.empty()) {
+        bool drained = g_gate.synchronize(grace);
+        std::lock_guard<std::mutex> lock(g_writer_lock);
+        for (const auto& retired : retiring) {
+            for (const auto& plugin : retired.plugins) {
+                g_retiring.erase(std::find(g_retiring.begin(), g_retiring.end(), plugin.get()));
+            }
+        }
+        for (auto& retired : retiring) {
+            if (!drained) {
+                g_retired.push_back(std::move(retired));
+                continue;
+            }
+            delete retired.snapshot;
+            for (auto& plugin : retired.plugins) closing.push_back(std::move(plugin));
+        }
+    }
+
+    // Outside the lock: Detach may dispatch, and that may reach another writer. Plugins go
+    // before the ones they require.
+    std::vector<const LoadedPlugin*> order;
+    for (const auto& plugin : closing) order.push_back(plugin.get());
+    auto levels = requirement_levels(order);
+    plugin_list busy;
+    for (auto level = levels.rbegin(); level != levels.rend(); ++level) {
+        for (std::size_t i : *level) {
+            if (!release_plugin(*closing[i])) busy.push_back(closing[i]);
+        }
+    }
+
+    std::vector<const LoadedPlugin*> open;
+    bool pending;
+    {
+        std::lock_guard<std::mutex> lock(g_writer_lock);
+        for (auto& plugin : busy) g_unclosed.push_back(std::move(plugin));
+        for (const auto& retired : g_retired) {
+            for (const auto& plugin : retired.plugins) open.push_back(plugin.get());
+        }
+        for (const auto& plugin : g_unclosed) open.push_back(plugin.get());
+        open.insert(open.end(), g_retiring.begin(), g_retiring.end());
+        pending = !g_retired.empty() || !g_unclosed.empty() || !g_retiring.empty();
+    }
+    schedule_retry(pending);
+    return open;
+}
+
+// Keeps a timer going while anything is left to close; the attempts run on the pool,
+// since closing waits for calls in flight
+static void schedule_retry(bool pending) {
+    std::lock_guard<std::mutex> lock(g_retry_lock);
+    if (!pending) {
+        if (g_retry_timer) timer_cancel(g_retry_timer);
+        g_retry_timer = 0;
+        return;
+    }
+    if (g_retry_timer) return;
+    g_retry_timer = timer_schedule(kRetryEvery, kRetryEvery, std::make_shared<const std::function<void()>>([] {
+        pool_ref pool = control_pool();
+        if (!pool || g_retrying.exchange(true)) return;
+        if (!pool->submit([] {
+                auto open = close_retired(kGracePeriod);
+                if (open.empty()) std::cout << "CONTROL: Closed the plugins left open by earlier changes" << std::endl;
+                g_retrying.store(false);
+            })) {
+            g_retrying.store(false);
+        }
+    }));
+}
+
+// Publishes the plugin list edit makes from the current one, then closes the plugins it
+// moved into removed once no dispatch can still reach them. edit runs under the writer
+// lock and returns false to leave the registry as it is. closed, if given, tells whether
+// every removed plugin was closed; the ones that weren't are retried from the timer.
+using registry_edit = std::function<bool(plugin_list& plugins, plugin_list& removed)>;
+
+static bool registry_swap(const registry_edit& edit, bool* closed = nullptr) {
+    std::vector<const LoadedPlugin*> dropped;
+    {
+        std::lock_guard<std::mutex> lock(g_writer_lock);
+        const registry_snapshot* current = g_snapshot.load(std::memory_order_relaxed);
+        plugin_list plugins = current->plugins;
+        plugin_list removed;
+        if (!edit(plugins, removed)) return false;
+
+        g_snapshot.store(build_snapshot(std::move(plugins), current->generation + 1), std::memory_order_release);
+        for (const auto& plugin : removed) dropped.push_back(plugin.get());
+        g_retired.push_back({current, std::move(removed)});
+        // Tagged with the old generation, so nothing could hit them any more
+        cache_invalidate({});
+    }
+
+    auto open = close_retired(kGracePeriod);
+    bool all_closed = std::none_of(dropped.begin(), dropped.end(), [&](const LoadedPlugin* plugin) {
+        return std::find(open.begin(), open.end(), plugin) != open.end();
+    });
+    if (!all_closed) std::cout << "CONTROL: Registry still in use, closing replaced plugins later" << std::endl;
+    if (closed) *closed = all_closed;
+    return true;
 }
 
 void control_cleanup_registry() {
-    if (g_plugin_registry.empty()) return;
+    // Handed over by the host but never claimed by a discovery
+    for (auto& [path, library] : g_adopted) LIB_CLOSE(library.handle);
+    g_adopted.clear();
+
+    registry_swap([](plugin_list& plugins, plugin_list& removed) {
+        if (plugins.empty()) return false;
+        std::cout << "CONTROL: Cleaning up " << plugins.size() << " plugins..." << std::endl;
+        removed = std::move(plugins);
+        plugins.clear();
+        return true;
+    });
+    // Once more for what earlier changes left, now that the timer is gone
+    if (auto open = close_retired(kGracePeriod); !open.empty()) {
+        std::cout << "CONTROL: Leaving " << open.size() << " busy plugins loaded" << std::endl;
+    }
+    {
+        std::lock_guard<std::mutex> lock(g_retry_lock);
+        g_retry_timer = 0;  // went with the timer service
+    }
+    control_handles_reset();
+}
+
+static std::atomic<bool> g_lazy{true};
+static DispatchFn g_lazy_dispatch = nullptr;
+
+void control_set_lazy(bool lazy) {
+    g_lazy.store(lazy);
+}
+
+bool control_call_plugin(LoadedPlugin& plugin, const char* address, dispatch_payload payload,
+                         const char* options, std::string& response) {
+    if (!control_ensure_loaded(plugin)) return false;
+    call_probe probe(plugin.memstats, address ? address : "", plugin.name);
+
+    if (plugin.invoke_bytes || plugin.invoke2) {
+        libsresult result = {};
+        if (plugin.invoke_bytes) {
+            plugin.invoke_bytes(address, payload.data, payload.size, options, &result);
+        } else if (!payload.terminated && payload.data) {
+            std::string text(payload.data, payload.size);
+            plugin.invoke2(address, text.c_str(), options, &result);
+        } else {
+            plugin.invoke2(address, payload.data, options, &result);
+        }
+        if (!result.data) {
+            plugin.release(&result);
+            return false;
+        }
+        response.assign(result.data, result.size);
+        plugin.release(&result);
+        return true;
+    }
+
+    // Legacy Invoke returns a buffer owned by the plugin; copy it out under the lock
+    std::string text;
+    const char* data = payload.data;
+    if (!payload.terminated && data) {
+        text.assign(payload.data, payload.size);
+        data = text.c_str();
+    }
+    std::lock_guard<std::mutex> lock(*plugin.legacy_lock);
+    const char* result = plugin.invoke(address, data, options);
+    if (!result) return false;
+    response.assign(result);
+    return true;
+}
+
+bool control_call_cached(LoadedPlugin& plugin, std::uint64_t generation, const char* address,
+                         dispatch_payload payload, const char* options, std::string& response) {
+    if (!control_ensure_loaded(plugin)) return false;
+    auto policy = address ? plugin.cache_policy.find(std::string_view(address)) : plugin.cache_policy.end();
+    if (policy == plugin.cache_policy.end()) return control_call_plugin(plugin, address, payload, options, response);
+
+    if (cache_get(address, payload, options, generation, response)) return true;
+    std::uint64_t sequence = cache_sequence();
+    if (!control_call_plugin(plugin, address, payload, options, response)) return false;
+    if (!stats_failed(response)) cache_put(address, payload, options, generation, sequence, policy->second, response);
+    return true;
+}
+
+static long long micros_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+enum class candidate_status {
+    loaded,
+    invalid,  // opens, but isn't a plugin; remembered in the manifest
+    failed,   // didn't open or didn't attach; tried again next time
+};
+
+// Opens and validates one candidate without running any of its code. Runs on a pool
+// thread, so it only touches its own LoadedPlugin; the registry is filled in afterwards.
+// adopted, when set, is the host's handle for this file and replaces the dlopen.
+static candidate_status open_candidate(const std::filesystem::path& lib_path, const std::optional<adopted_library>& adopted,
+                                       LoadedPlugin& plugin) {
+    std::string filename = lib_path.filename().string();
+    std::cout << "CONTROL: " << (adopted ? "Adopting " : "Loading ") << filename << "..." << std::endl;
+
+    auto start = std::chrono::steady_clock::now();
+    void* handle = adopted ? adopted->handle : LIB_LOAD(lib_path.string().c_str());
+    if (!handle) {
+        std::cout << "CONTROL: Failed to load " << filename << ": " << LIB_ERROR() << std::endl;
+        return candidate_status::failed;
+    }
     
-    std::cout << "CONTROL: Cleaning up " << g_plugin_registry.size() << " plugins..." << std::endl;
-    for (auto& plugin : g_plugin_registry) {
-        std::cout << "CONTROL: Detaching " << plugin.name << std::endl;
-        char err_buf[256] = {0};
-        if (plugin.detach && !plugin.detach(err_buf, sizeof(err_buf))) {
-            std::cout << "CONTROL: " << plugin.name << " Detach failed: " << err_buf << std::endl;
+    AttachFn attach = (AttachFn)LIB_SYM(handle, "Attach");
+    DetachFn detach = (DetachFn)LIB_SYM(handle, "Detach");
+    InvokeFn invoke = (InvokeFn)LIB_SYM(handle, "Invoke");
+    ReportFn report = (ReportFn)LIB_SYM(handle, "Report");
+    RoutesFn routes = (RoutesFn)LIB_SYM(handle, "Routes");
+    Invoke2Fn invoke2 = (Invoke2Fn)LIB_SYM(handle, "Invoke2");
+    ReleaseFn release = (ReleaseFn)LIB_SYM(handle, "Release");
+    InvokeBytesFn invoke_bytes = (InvokeBytesFn)LIB_SYM(handle, "InvokeBytes");
+    ResolveHandlerFn resolve_handler = (ResolveHandlerFn)LIB_SYM(handle, "ResolveHandler");
+    InvokeHandlerFn invoke_handler = (InvokeHandlerFn)LIB_SYM(handle, "InvokeHandler");
+    InvokeDeferredFn invoke_deferred = (InvokeDeferredFn)LIB_SYM(handle, "InvokeDeferred");
+    ServicesFn services = (ServicesFn)LIB_SYM(handle, "Services");
+    RequiresFn requires_fn = (RequiresFn)LIB_SYM(handle, "Requires");
+    CacheableFn cacheable = (CacheableFn)LIB_SYM(handle, "Cacheable");
+    SubscriptionsFn subscriptions = (SubscriptionsFn)LIB_SYM(handle, "Subscriptions");
+    DeliverEventsFn deliver = (DeliverEventsFn)LIB_SYM(handle, "Deliver");
+    MemStatsFn memstats = (MemStatsFn)LIB_SYM(handle, "MemStats");
+    
+    if (!attach || !detach || !invoke || !report) {
+        std::cout << "CONTROL: " << filename << " missing required functions" << std::endl;
+        LIB_CLOSE(handle);
+        return candidate_status::invalid;
+    }
+    plugin.loaded_at = start;
+    plugin.load_us = micros_since(start);
+    
+    std::cout << "CONTROL: " << filename << " has valid plugin interface" << std::endl;
+
+    plugin.name = filename;
+    plugin.path = lib_path;
+    plugin.handle = handle;
+    plugin.adopted = adopted.has_value();
+    if (adopted) plugin.info = adopted->info;
+    plugin.attach = attach;
+    plugin.detach = detach;
+    plugin.invoke = invoke;
+    plugin.report = report;
+    plugin.routes = routes;
+    plugin.services = services;
+    plugin.invoke_deferred = invoke_deferred;
+    plugin.memstats = memstats;
+    plugin.subscriptions_fn = deliver ? subscriptions : nullptr;
+    plugin.deliver = subscriptions ? deliver : nullptr;
+    plugin.resolve_handler = release ? resolve_handler : nullptr;
+    plugin.invoke_handler = release ? invoke_handler : nullptr;
+    if (release && (invoke2 || invoke_bytes)) {
+        plugin.invoke2 = invoke2;
+        plugin.invoke_bytes = invoke_bytes;
+        plugin.release = release;
+    } else {
+        plugin.resolve_handler = nullptr;
+        plugin.invoke_handler = nullptr;
+        plugin.invoke2 = nullptr;
+        plugin.invoke_bytes = nullptr;
+        plugin.release = nullptr;
+        plugin.legacy_lock = std::make_shared<std::mutex>();
+    }
+    if (requires_fn) {
+        const char* const* names = nullptr;
+        std::size_t count = requires_fn(&names);
+        for (std::size_t i = 0; i < count; ++i) {
+            if (names[i]) plugin.depends_on.push_back(names[i]);
+        }
+    }
+    if (cacheable) {
+        const libscache* policies = nullptr;
+        std::size_t count = cacheable(&policies);
+        for (std::size_t i = 0; i < count; ++i) {
+            if (policies[i].address && policies[i].ttl_ms != 0) plugin.cache_policy[policies[i].address] = policies[i].ttl_ms;
+        }
+    }
+    return candidate_status::loaded;
+}
+
+// Attach and Services for an opened candidate; closes it if Attach fails. subscribe is
+// false when its topics were already subscribed from the manifest.
+static candidate_status attach_candidate(DispatchFn dispatch, LoadedPlugin& plugin, bool subscribe = true) {
+    auto start = std::chrono::steady_clock::now();
+    char err_buf[256] = {0};
+    if (!plugin.attach(dispatch, err_buf, sizeof(err_buf))) {
+        std::cout << "CONTROL: " << plugin.name << " Attach failed: " << err_buf << std::endl;
+        LIB_CLOSE(plugin.handle);
+        plugin.handle = nullptr;
+        return candidate_status::failed;
+    }
+    
+    std::cout << "CONTROL: " << plugin.name << " attached successfully" << std::endl;
+
+    if (plugin.services) {
+        plugin.services(control_host());
+    }
+    plugin.attach_us = micros_since(start);
+
+    if (plugin.subscriptions_fn && subscribe) {
+        const libstopic* topics = nullptr;
+        std::size_t count = plugin.subscriptions_fn(&topics);
+        for (std::size_t i = 0; i < count; ++i) {
+            if (!topics[i].topic || !*topics[i].topic) continue;
+            plugin.subscriptions.push_back(bus_subscribe(topics[i].topic, topics[i].capacity,
+                                                         libsoverflow(topics[i].overflow), plugin.deliver,
+                                                         plugin.name));
         }
-        if (plugin.handle) {
-            LIB_CLOSE(plugin.handle);
+    }
+
+    if (!plugin.adopted && !plugin.report(err_buf, sizeof(err_buf), &plugin.info)) {
+        plugin.info = {};
+    }
+    return candidate_status::loaded;
+}
+
+// Makes sure what a plugin requires is attached before it is. Requirements still
+// deferred are loaded now; ones that aren't registered at all are only reported, since
+// the plugin may cope without them.
+static void load_requirements(const LoadedPlugin& plugin) {
+    registry_read registry;
+    for (const auto& name : plugin.depends_on) {
+        LoadedPlugin* required = registry->find(name);
+        if (!required) {
+            std::cout << "CONTROL: " << plugin.name << " requires " << name << ", which isn't loaded" << std::endl;
+        } else if (required->name != plugin.name) {
+            control_ensure_loaded(*required);
         }
     }
-    g_plugin_registry.clear();
+}
+
+static candidate_status load_candidate(const std::filesystem::path& lib_path, DispatchFn dispatch, LoadedPlugin& plugin,
+                                       bool subscribe = true) {
+    candidate_status status = open_candidate(lib_path, std::nullopt, plugin);
+    if (status != candidate_status::loaded) return status;
+    load_requirements(plugin);
+    return attach_candidate(dispatch, plugin, subscribe);
+}
+
+bool control_ensure_loaded(LoadedPlugin& plugin) {
+    if (!plugin.lazy) return true;
+    lazy_load& lazy = *plugin.lazy;
+    if (lazy.ready.load(std::memory_order_acquire)) return plugin.handle != nullptr;
+
+    // A requirement cycle between deferred plugins leads back here on the same thread
+    thread_local std::vector<const lazy_load*> t_loading;
+    if (std::find(t_loading.begin(), t_loading.end(), &lazy) != t_loading.end()) return false;
+
+    std::lock_guard<std::mutex> lock(lazy.lock);
+    if (lazy.ready.load(std::memory_order_relaxed)) return plugin.handle != nullptr;
+
+    std::cout << "CONTROL: First use of " << plugin.name << ", loading it now" << std::endl;
+    t_loading.push_back(&lazy);
+    LoadedPlugin loaded;
+    // Topics the manifest listed are subscribed already and keep their queues
+    bool subscribed = !lazy.entry.topics.empty();
+    candidate_status status = load_candidate(lazy.path, g_lazy_dispatch, loaded, !subscribed);
+    t_loading.pop_back();
+    if (status == candidate_status::loaded) {
+        // Field by field: name and info stay as they were, since other threads may read them
+        plugin.handle = loaded.handle;
+        plugin.attach = loaded.attach;
+        plugin.detach = loaded.detach;
+        plugin.invoke = loaded.invoke;
+        plugin.report = loaded.report;
+        plugin.routes = loaded.routes;
+        plugin.services = loaded.services;
+        plugin.invoke2 = loaded.invoke2;
+        plugin.release = loaded.release;
+        plugin.invoke_bytes = loaded.invoke_bytes;
+        plugin.resolve_handler = loaded.resolve_handler;
+        plugin.invoke_handler = loaded.invoke_handler;
+        plugin.invoke_deferred = loaded.invoke_deferred;
+        plugin.deliver = loaded.deliver;
+        plugin.subscriptions_fn = loaded.subscriptions_fn;
+        if (!subscribed) plugin.subscriptions = std::move(loaded.subscriptions);
+        plugin.memstats = loaded.memstats;
+        plugin.legacy_lock = loaded.legacy_lock;
+        plugin.cache_policy = std::move(loaded.cache_policy);
+        plugin.loaded_at = loaded.loaded_at;
+        plugin.load_us = loaded.load_us;
+        plugin.attach_us = loaded.attach_us;
+    }
+    lazy.ready.store(true, std::memory_order_release);
+    return plugin.handle != nullptr;
+}
+
+static std::string text_or_empty(const char* text) {
+    return text ? text : "";
+}
+
+// Manifest line for a plugin that just loaded
+static manifest_entry manifest_for(const LoadedPlugin& plugin, const file_stamp& stamp) {
+    manifest_entry entry;
+    entry.stamp = stamp;
+    entry.valid = true;
+    entry.plugin_type = text_or_empty(plugin.info.plugin_type);
+    entry.plugin_id = plugin.info.plugin_id;
+    entry.product = text_or_empty(plugin.info.product);
+    entry.description_short = text_or_empty(plugin.info.description_short);
+    entry.description_long = text_or_empty(plugin.info.description_long);
+    entry.depends_on = plugin.depends_on;
+    if (plugin.routes) {
+        entry.has_routes = true;
+        const libsroute* routes = nullptr;
+        std::size_t count = plugin.routes(&routes);
+        for (std::size_t r = 0; r < count; ++r) {
+            if (routes[r].address) entry.addresses.push_back(routes[r].address);
+        }
+    }
+    if (plugin.subscriptions_fn) {
+        const libstopic* topics = nullptr;
+        std::size_t count = plugin.subscriptions_fn(&topics);
+        for (std::size_t i = 0; i < count; ++i) {
+            if (topics[i].topic && *topics[i].topic) {
+                entry.topics.push_back({topics[i].topic, topics[i].capacity, topics[i].overflow});
+            }
+        }
+    }
+    return entry;
+}
+
+// Delivery to a deferred plugin's subscriptions: the first event loads it, and the events
+// that queued meanwhile follow
+static void deliver_deferred(const libsevent* events, std::size_t count, void* user_data) {
+    auto& plugin = *static_cast<LoadedPlugin*>(user_data);
+    if (control_ensure_loaded(plugin) && plugin.deliver) plugin.deliver(events, count);
+}
+
+// Appends what a discovery found and returns the registry size. A plugin registered
+// meanwhile through control.load keeps its place and the duplicate is closed.
+static std::size_t register_found(plugin_list& found) {
+    std::size_t total = 0;
+    bool changed = registry_swap([&](plugin_list& plugins, plugin_list& removed) {
+        for (auto& plugin : found) {
+            if (find_plugin(plugins, plugin->name) != plugins.end()) {
+                removed.push_back(std::move(plugin));
+            } else {
+                plugins.push_back(std::move(plugin));
+            }
+        }
+        total = plugins.size();
+        return !found.empty();
+    });
+    if (!changed) total = registry_read()->plugins.size();
+    return total;
 }
 
 bool control_discover_and_load(DispatchFn dispatch) {
     std::cout << "CONTROL: Discovering plugins..." << std::endl;
+    auto start = std::chrono::steady_clock::now();
+    g_lazy_dispatch = dispatch;
     
-    std::filesystem::path exe_dir = std::filesystem::current_path();
+    std::filesystem::path exe_dir = canonical_path(std::filesystem::current_path());
     std::cout << "CONTROL: Scanning directory: " << exe_dir << std::endl;
     
+    std::filesystem::path manifest_file = exe_dir / kManifestName;
+    manifest_map manifest = manifest_read(manifest_file);
+    
     std::vector<std::filesystem::path> lib_paths;
+    std::filesystem::path self_path;
     
     for (const auto& entry : std::filesystem::directory_iterator(exe_dir)) {
         if (!entry.is_regular_file()) continue;
@@ -66,58 +732,280 @@ bool control_discover_and_load(DispatchFn dispatch) {
         if (extension != LIB_EXT) continue;
         if (filename.find("libcontrol") == 0) {
             std::cout << "CONTROL: Skipping self: " << filename << std::endl;
+            self_path = entry.path();
             continue;
         }
         if (filename.find("lib") != 0) continue;
         
-        lib_paths.push_back(entry.path());
+        lib_paths.push_back(canonical_path(entry.path()));
         std::cout << "CONTROL: Found candidate: " << filename << std::endl;
     }
+
+    // The host's libraries are candidates even when they live outside the working directory
+    for (const auto& [path, library] : g_adopted) {
+        if (std::find(lib_paths.begin(), lib_paths.end(), path) == lib_paths.end()) lib_paths.push_back(path);
+    }
     
+    // Directory order is unspecified; sort so the registry (and route conflicts) come out
+    // the same on every run no matter which load finishes first
+    std::sort(lib_paths.begin(), lib_paths.end(), [](const auto& a, const auto& b) {
+        if (a.filename() != b.filename()) return a.filename() < b.filename();
+        return a < b;
+    });
+
+    // Discovering again only picks up libraries that aren't registered yet
+    std::vector<char> registered(lib_paths.size(), 0);
+    {
+        registry_read current;
+        for (std::size_t i = 0; i < lib_paths.size(); ++i) {
+            registered[i] = current->find(lib_paths[i].filename().string()) != nullptr;
+        }
+    }
+
+    std::vector<std::optional<adopted_library>> claims(lib_paths.size());
+    for (std::size_t i = 0; i < lib_paths.size(); ++i) {
+        if (registered[i]) continue;
+        auto it = g_adopted.find(lib_paths[i]);
+        if (it == g_adopted.end()) continue;
+        claims[i] = it->second;
+        g_adopted.erase(it);
+    }
     std::cout << "CONTROL: Found " << lib_paths.size() << " plugin candidates" << std::endl;
-    
-    for (const auto& lib_path : lib_paths) {
-        std::string filename = lib_path.filename().string();
-        std::cout << "CONTROL: Loading " << filename << "..." << std::endl;
-        
-        void* handle = LIB_LOAD(lib_path.string().c_str());
-        if (!handle) {
-            std::cout << "CONTROL: Failed to load " << filename << ": " << LIB_ERROR() << std::endl;
+
+    // Unchanged files the manifest knows are not plugins aren't opened again, and unchanged
+    // plugins with a route list wait for their first dispatch, or their first event when
+    // they subscribe. One with neither has nothing that would load it, so it loads now.
+    bool lazy = g_lazy.load();
+    std::vector<file_stamp> stamps(lib_paths.size());
+    std::vector<char> stamped(lib_paths.size(), 0);
+    std::vector<char> skip(lib_paths.size(), 0);
+    std::vector<char> deferred(lib_paths.size(), 0);
+    for (std::size_t i = 0; i < lib_paths.size(); ++i) {
+        if (registered[i]) {
+            skip[i] = 1;
             continue;
         }
-        
-        AttachFn attach = (AttachFn)LIB_SYM(handle, "Attach");
-        DetachFn detach = (DetachFn)LIB_SYM(handle, "Detach");
-        InvokeFn invoke = (InvokeFn)LIB_SYM(handle, "Invoke");
-        ReportFn report = (ReportFn)LIB_SYM(handle, "Report");
-        
-        if (!attach || !detach || !invoke || !report) {
-            std::cout << "CONTROL: " << filename << " missing required functions" << std::endl;
-            LIB_CLOSE(handle);
-            continue;
+        if (lib_paths[i].parent_path() != exe_dir) continue;
+        stamped[i] = manifest_stamp(lib_paths[i], stamps[i]);
+        auto it = manifest.find(lib_paths[i].filename().string());
+        if (!stamped[i] || claims[i] || it == manifest.end() || !(it->second.stamp == stamps[i])) continue;
+        if (!it->second.valid) {
+            std::cout << "CONTROL: Skipping " << it->first << " (manifest: not a plugin)" << std::endl;
+            skip[i] = 1;
+        } else if (lazy && it->second.has_routes && (!it->second.addresses.empty() || !it->second.topics.empty())) {
+            std::cout << "CONTROL: Deferring " << it->first << " until first use" << std::endl;
+            skip[i] = 1;
+            deferred[i] = 1;
         }
-        
-        std::cout << "CONTROL: " << filename << " has valid plugin interface" << std::endl;
-        
-        char err_buf[256] = {0};
-        if (!attach(dispatch, err_buf, sizeof(err_buf))) {
-            std::cout << "CONTROL: " << filename << " Attach failed: " << err_buf << std::endl;
-            LIB_CLOSE(handle);
-            continue;
+    }
+    
+    // Opening runs no plugin code, so every candidate is opened concurrently
+    std::vector<LoadedPlugin> loaded(lib_paths.size());
+    std::vector<candidate_status> status(lib_paths.size(), candidate_status::invalid);
+    // Warm starts with everything deferred shouldn't pay for starting the pool
+    std::size_t to_load = std::size_t(std::count(skip.begin(), skip.end(), 0));
+    pool_ref pool = to_load > 1 ? control_pool() : pool_ref();
+    pool_for_each(pool.get(), lib_paths.size(), [&](std::size_t i) {
+        if (!skip[i]) status[i] = open_candidate(lib_paths[i], claims[i], loaded[i]);
+    });
+
+    // Deferred plugins are registered first, so a plugin that requires one can reach it
+    // while it attaches
+    plugin_list pending;
+    for (std::size_t i = 0; i < lib_paths.size(); ++i) {
+        if (!deferred[i]) continue;
+        std::string filename = lib_paths[i].filename().string();
+        LoadedPlugin placeholder;
+        placeholder.name = filename;
+        placeholder.path = lib_paths[i];
+        placeholder.lazy = std::make_shared<lazy_load>();
+        placeholder.lazy->path = lib_paths[i];
+        placeholder.lazy->entry = manifest[filename];
+        const manifest_entry& entry = placeholder.lazy->entry;
+        placeholder.info = {entry.plugin_type.c_str(), entry.product.c_str(), entry.description_long.c_str(),
+                            entry.description_short.c_str(), entry.plugin_id};
+        placeholder.depends_on = entry.depends_on;
+        auto deferred_plugin = std::make_shared<LoadedPlugin>(std::move(placeholder));
+        for (const auto& topic : entry.topics) {
+            deferred_plugin->subscriptions.push_back(bus_subscribe(topic.topic, topic.capacity,
+                                                                   libsoverflow(topic.overflow), deliver_deferred,
+                                                                   deferred_plugin.get(), filename));
         }
-        
-        std::cout << "CONTROL: " << filename << " attached successfully" << std::endl;
-        
-        LoadedPlugin plugin;
-        plugin.name = filename;
-        plugin.handle = handle;
-        plugin.attach = attach;
-        plugin.detach = detach;
-        plugin.invoke = invoke;
-        plugin.report = report;
-        
-        g_plugin_registry.push_back(plugin);
+        pending.push_back(std::move(deferred_plugin));
+    }
+    std::size_t total = register_found(pending);
+
+    // Then attach in requirement order: each level only needs earlier levels, which are
+    // registered by the time it starts, and its members attach concurrently
+    std::vector<std::size_t> opened;
+    std::vector<const LoadedPlugin*> order;
+    for (std::size_t i = 0; i < lib_paths.size(); ++i) {
+        if (status[i] != candidate_status::loaded) continue;
+        opened.push_back(i);
+        order.push_back(&loaded[i]);
+    }
+    for (const auto& level : requirement_levels(order)) {
+        pool_for_each(level.size() > 1 ? pool.get() : nullptr, level.size(), [&](std::size_t k) {
+            std::size_t i = opened[level[k]];
+            load_requirements(loaded[i]);
+            status[i] = attach_candidate(dispatch, loaded[i]);
+        });
+
+        plugin_list attached;
+        for (std::size_t k : level) {
+            LoadedPlugin& plugin = loaded[opened[k]];
+            if (status[opened[k]] != candidate_status::loaded) continue;
+            std::cout << "CONTROL: " << plugin.name << " load " << plugin.load_us
+                      << "us, attach " << plugin.attach_us << "us" << std::endl;
+            attached.push_back(std::make_shared<LoadedPlugin>(plugin));
+        }
+        total = register_found(attached);
     }
     
-    return !g_plugin_registry.empty();
+    // Control lists itself too, so hosts can find it without probing every library
+    manifest_map updated;
+    file_stamp self_stamp;
+    if (!self_path.empty() && manifest_stamp(self_path, self_stamp)) {
+        LoadedPlugin self;
+        char err_buf[256] = {0};
+        Report(err_buf, sizeof(err_buf), &self.info);
+        self.routes = Routes;
+        updated[self_path.filename().string()] = manifest_for(self, self_stamp);
+    }
+    for (std::size_t i = 0; i < lib_paths.size(); ++i) {
+        std::string filename = lib_paths[i].filename().string();
+        if (registered[i]) {
+            auto it = manifest.find(filename);
+            if (it != manifest.end()) updated[filename] = it->second;
+        } else if (stamped[i] && skip[i]) {
+            updated[filename] = manifest[filename];
+        } else if (stamped[i] && status[i] == candidate_status::invalid) {
+            updated[filename].stamp = stamps[i];
+        } else if (stamped[i] && status[i] == candidate_status::loaded) {
+            updated[filename] = manifest_for(loaded[i], stamps[i]);
+        }
+    }
+    manifest_write(manifest_file, updated);
+
+    std::cout << "CONTROL: Discovery took " << micros_since(start) << "us" << std::endl;
+    return total > 0;
+}
+
+std::filesystem::path control_library_path(std::string_view name) {
+    std::filesystem::path file(name);
+    if (file.extension() != LIB_EXT) file = "lib" + std::string(name) + LIB_EXT;
+    return std::filesystem::current_path() / file;
+}
+
+bool control_load_plugin(DispatchFn dispatch, const std::filesystem::path& path, std::string& err) {
+    std::filesystem::path lib_path = canonical_path(path);
+    std::string filename = lib_path.filename().string();
+    std::error_code ec;
+    if (!std::filesystem::is_regular_file(lib_path, ec)) {
+        err = "no such library: " + lib_path.string();
+        return false;
+    }
+    if (registry_read()->find(filename)) {
+        err = filename + " is already loaded";
+        return false;
+    }
+
+    LoadedPlugin plugin;
+    candidate_status status = load_candidate(lib_path, dispatch, plugin);
+    if (status != candidate_status::loaded) {
+        err = status == candidate_status::invalid ? filename + " is not a plugin" : "failed to load " + filename;
+        return false;
+    }
+
+    auto loaded = std::make_shared<LoadedPlugin>(std::move(plugin));
+    bool added = registry_swap([&](plugin_list& plugins, plugin_list& /* removed */) {
+        if (find_plugin(plugins, loaded->name) != plugins.end()) return false;
+        plugins.push_back(loaded);
+        return true;
+    });
+    if (!added) {
+        // Lost a race with another load of the same file; ours was never published
+        release_plugin(*loaded);
+        err = filename + " is already loaded";
+    }
+    return added;
+}
+
+bool control_unload_plugin(std::string_view name, bool& closed, std::string& err) {
+    err = "no plugin named " + std::string(name);
+    bool removed_any = registry_swap([&](plugin_list& plugins, plugin_list& removed) {
+        auto it = find_plugin(plugins, name);
+        if (it == plugins.end()) return false;
+        // Reload instead to replace a plugin others were attached against
+        for (const auto& plugin : plugins) {
+            for (const auto& required : plugin->depends_on) {
+                if (plugin != *it && name_matches((*it)->name, required)) {
+                    err = (*it)->name + " is required by " + plugin->name;
+                    return false;
+                }
+            }
+        }
+        std::cout << "CONTROL: Unloading " << (*it)->name << std::endl;
+        removed.push_back(std::move(*it));
+        plugins.erase(it);
+        return true;
+    }, &closed);
+    if (removed_any) err.clear();
+    return removed_any;
+}
+
+bool control_reload_plugin(DispatchFn dispatch, std::string_view name, bool& closed, std::string& err) {
+    std::filesystem::path path;
+    std::string filename;
+    {
+        registry_read current;
+        const LoadedPlugin* plugin = current->find(name);
+        if (!plugin) {
+            err = "no plugin named " + std::string(name);
+            return false;
+        }
+        path = plugin->path;
+        filename = plugin->name;
+    }
+
+    // Opening the same path again would hand back the image that is already mapped, so the
+    // new build is opened from a private copy. The copy is removed as soon as it's open;
+    // where the platform refuses that, it stays in the temp directory.
+    static std::atomic<unsigned> g_reloads{0};
+    std::error_code ec;
+    std::filesystem::path copy = std::filesystem::temp_directory_path(ec);
+    if (ec) copy = path.parent_path();
+    copy /= path.stem().string() + ".reload-" +
+            std::to_string(std::chrono::steady_clock::now().time_since_epoch().count()) + "-" +
+            std::to_string(g_reloads.fetch_add(1)) + LIB_EXT;
+    if (!std::filesystem::copy_file(path, copy, std::filesystem::copy_options::overwrite_existing, ec)) {
+        err = "cannot copy " + path.string() + ": " + ec.message();
+        return false;
+    }
+
+    LoadedPlugin plugin;
+    candidate_status status = load_candidate(copy, dispatch, plugin);
+    std::filesystem::remove(copy, ec);
+    if (status != candidate_status::loaded) {
+        err = status == candidate_status::invalid ? filename + " is no longer a plugin" : "failed to load " + filename;
+        return false;
+    }
+    plugin.name = filename;
+    plugin.path = path;
+
+    // Same position in the registry, so route conflicts resolve as they did before
+    auto replacement = std::make_shared<LoadedPlugin>(std::move(plugin));
+    bool swapped = registry_swap([&](plugin_list& plugins, plugin_list& removed) {
+        auto it = find_plugin(plugins, filename);
+        if (it == plugins.end()) return false;
+        std::cout << "CONTROL: Replacing " << filename << std::endl;
+        removed.push_back(std::move(*it));
+        *it = replacement;
+        return true;
+    }, &closed);
+    if (!swapped) {
+        release_plugin(*replacement);
+        err = filename + " was unloaded during the reload";
+    }
+    return swapped;
 }
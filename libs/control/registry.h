@@ -1,7 +1,18 @@
 #pragma once
 
 #include "contract.h"
+#include "dispatch.h"
+#include "bus.h"
+#include "manifest.h"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <string_view>
+#include <unordered_map>
 #include <vector>
 
 using DispatchFn = const char* (*)(const char* address, const char* payload, const char* options);
@@ -9,19 +20,140 @@ using AttachFn = bool (*)(DispatchFn dispatch, char* err_buf, std::size_t err_ca
 using DetachFn = bool (*)(char* err_buf, std::size_t err_cap);
 using InvokeFn = const char* (*)(const char* address, const char* payload, const char* options);
 using ReportFn = bool (*)(char* err_buf, std::size_t err_cap, libsinfo* out);
+using RoutesFn = std::size_t (*)(const libsroute** out);
+using Invoke2Fn = bool (*)(const char* address, const char* payload, const char* options, libsresult* out);
+using ReleaseFn = void (*)(libsresult* result);
+using ServicesFn = void (*)(const libshost* host);
+using InvokeBytesFn = bool (*)(const char* address, const char* payload, std::size_t payload_len,
+                               const char* options, libsresult* out);
+using ResolveHandlerFn = long (*)(const char* address);
+using InvokeHandlerFn = bool (*)(long index, const char* payload, std::size_t payload_len,
+                                 const char* options, libsresult* out);
+using RequiresFn = std::size_t (*)(const char* const** out);
+using CacheableFn = std::size_t (*)(const libscache** out);
+using InvokeDeferredFn = bool (*)(const char* address, const char* payload, std::size_t payload_len,
+                                  const char* options, CompletionFn callback, void* user_data);
+using SubscriptionsFn = std::size_t (*)(const libstopic** out);
+using DeliverEventsFn = void (*)(const libsevent* events, std::size_t count);
+using MemStatsFn = void (*)(libsmemory* total, libsmemory* thread);
+
+// Heterogeneous hash so lookups by string_view don't allocate
+struct route_hash {
+    using is_transparent = void;
+    std::size_t operator()(std::string_view sv) const { return std::hash<std::string_view>{}(sv); }
+};
+
+// A plugin known only from the manifest until the first dispatch to one of its
+// addresses, or the first event on a topic the manifest says it subscribes to. Shared by
+// copies of the LoadedPlugin, and never changed except for ready.
+struct lazy_load {
+    std::filesystem::path path;
+    manifest_entry entry;         // keeps the strings info points at
+    std::mutex lock;              // one loader; concurrent first callers wait on it
+    std::atomic<bool> ready{false};
+};
 
 struct LoadedPlugin {
     std::string name;
-    void* handle;
-    AttachFn attach;
-    DetachFn detach;
-    InvokeFn invoke;
-    ReportFn report;
+    std::filesystem::path path;  // where it was found; reload opens this again
+    void* handle = nullptr;
+    AttachFn attach = nullptr;
+    DetachFn detach = nullptr;
+    InvokeFn invoke = nullptr;
+    ReportFn report = nullptr;
+    RoutesFn routes = nullptr;    // optional; plugins without it are reached by broadcast
+    Invoke2Fn invoke2 = nullptr;  // optional reentrant entry point, paired with release
+    ReleaseFn release = nullptr;
+    InvokeBytesFn invoke_bytes = nullptr;  // optional binary-safe entry point, also paired with release
+    ResolveHandlerFn resolve_handler = nullptr;  // optional handler interning, see handles.h
+    InvokeHandlerFn invoke_handler = nullptr;
+    InvokeDeferredFn invoke_deferred = nullptr;  // optional; InvokeAsync completes through it
+    ServicesFn services = nullptr;
+    std::vector<std::string> depends_on;  // from Requires, or from the manifest while deferred
+    std::unordered_map<std::string, long, route_hash, std::equal_to<>> cache_policy;  // address -> ttl, from Cacheable
+    DeliverEventsFn deliver = nullptr;  // with Subscriptions; subscribed once attached
+    SubscriptionsFn subscriptions_fn = nullptr;
+    std::vector<std::shared_ptr<bus_subscription>> subscriptions;
+    MemStatsFn memstats = nullptr;  // optional heap counters, see call_probe in stats.h
+    std::shared_ptr<std::mutex> legacy_lock;  // serialises Invoke on plugins without Invoke2
+    // InvokeDeferred calls that haven't completed; the plugin isn't closed while there are any
+    std::shared_ptr<std::atomic<long>> deferred = std::make_shared<std::atomic<long>>(0);
+    libsinfo info = {};       // from Report, or from the host's call when adopted
+    bool adopted = false;     // handle came from the host rather than our own dlopen
+    std::shared_ptr<lazy_load> lazy;  // set when loading was deferred, see control_ensure_loaded
+    std::chrono::steady_clock::time_point loaded_at;  // when the library was opened
+    long long load_us = 0;    // dlopen and symbol lookup
+    long long attach_us = 0;  // Attach and Services
 };
 
-// Global plugin registry access
-std::vector<LoadedPlugin>& control_get_registry();
+// Control's service table, see host.cpp
+const libshost* control_host();
+
+// The plugins and their route table as of one registry change. Never modified once
+// published: load, unload, reload and discovery build a new snapshot and swap it in, and
+// the plugins dropped by the swap are only closed after every reader of the old one left.
+struct registry_snapshot {
+    std::uint64_t generation = 0;  // bumped by every swap, see handles.h
+    std::vector<std::shared_ptr<LoadedPlugin>> plugins;
+    std::unordered_map<std::string, LoadedPlugin*, route_hash, std::equal_to<>> routes;
+
+    LoadedPlugin* route(std::string_view address) const;
+    LoadedPlugin* find(std::string_view name) const;  // by file name, or "efs" for libefs
+};
+
+// Pins the current snapshot for the scope of the object. Lock-free and nestable; a
+// dispatch holds one while it calls into a plugin, which keeps that plugin loaded. Only
+// the outermost read on a thread touches the shared epoch counters, so a loop that holds
+// one across a batch of dispatches spares each of them that cost.
+class registry_read {
+public:
+    registry_read();
+    ~registry_read();
+    registry_read(const registry_read&) = delete;
+    registry_read& operator=(const registry_read&) = delete;
+
+    const registry_snapshot& operator*() const { return *snapshot_; }
+    const registry_snapshot* operator->() const { return snapshot_; }
+
+private:
+    unsigned slot_;
+    const registry_snapshot* snapshot_;
+};
 
 // Registry operations
 void control_cleanup_registry();
 bool control_discover_and_load(DispatchFn dispatch);
+
+// Where discovery would find the named plugin: "efs" or "libefs.dylib" in the working directory
+std::filesystem::path control_library_path(std::string_view name);
+
+// Runtime changes to single plugins. Each returns false with err set when nothing changed.
+// load takes a library path; unload and reload take a registered name. closed tells
+// whether the plugin taken out was closed as well: it stays open while a dispatch is still
+// inside it past the grace period, or when the change was made from inside a plugin call,
+// and control closes it from its timer once it is free.
+bool control_load_plugin(DispatchFn dispatch, const std::filesystem::path& path, std::string& err);
+bool control_unload_plugin(std::string_view name, bool& closed, std::string& err);
+bool control_reload_plugin(DispatchFn dispatch, std::string_view name, bool& closed, std::string& err);
+
+// Defer loading plugins the manifest already describes (on by default)
+void control_set_lazy(bool lazy);
+
+// Loads a deferred plugin on first use; safe to race. False if it can't be loaded, in
+// which case none of its entry points may be called.
+bool control_ensure_loaded(LoadedPlugin& plugin);
+
+// Libraries handed over by the host through AttachEx. Discovery takes these handles
+// instead of opening the files again; any it never claims are closed at cleanup.
+void control_adopt(const libshandoff* libs, std::size_t count);
+
+// Calls into a plugin through InvokeBytes or Invoke2 when present, otherwise through the
+// serialised legacy Invoke. Returns false if the plugin produced no result. The caller
+// must hold a registry_read that contains the plugin.
+bool control_call_plugin(LoadedPlugin& plugin, const char* address, dispatch_payload payload,
+                         const char* options, std::string& response);
+
+// control_call_plugin behind the result cache when the plugin declared address cacheable.
+// generation is that of the registry_read the caller holds.
+bool control_call_cached(LoadedPlugin& plugin, std::uint64_t generation, const char* address,
+                         dispatch_payload payload, const char* options, std::string& response);
@@ -0,0 +1,34 @@
+#include "contract.h"
+#include "handler.h"
+#include <vector>
+
+const handler_table& control_table();
+
+extern "C" std::size_t Routes(const libsroute** out) {
+    // sids and tags are string literals, so data() is NUL-terminated and outlives the table
+    static const std::vector<libsroute> routes = [] {
+        std::vector<libsroute> list;
+        list.reserve(control_table().size());
+        for (const auto& handler : control_table().list()) {
+            list.push_back({handler.sid.data(), handler.tag.data()});
+        }
+        return list;
+    }();
+
+    if (out) *out = routes.data();
+    return routes.size();
+}
+
+extern "C" std::size_t Cacheable(const libscache** out) {
+    // Only handlers that declare a cache_ms
+    static const std::vector<libscache> policies = [] {
+        std::vector<libscache> list;
+        for (const auto& handler : control_table().list()) {
+            if (handler.cache_ms != 0) list.push_back({handler.sid.data(), handler.cache_ms});
+        }
+        return list;
+    }();
+
+    if (out) *out = policies.data();
+    return policies.size();
+}
@@ -0,0 +1,466 @@
+#include "stats.h"
+#include "cputime.h"
+#include "json.h"
+#include "registry.h"
+#include "pool.h"
+#include "timer.h"
+#include "watchdog.h"
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+
+constexpr unsigned kSubBits = 4;
+constexpr unsigned kSub = 1u << kSubBits;
+constexpr unsigned kMaxExponent = 39;  // about nine minutes in ns; longer calls share the top bucket
+constexpr std::size_t kBuckets = (kMaxExponent - kSubBits + 2) * kSub;
+
+constexpr std::string_view kUnrouted = "(unrouted)";
+
+std::size_t bucket_of(std::uint64_t ns) {
+    if (ns < kSub) return std::size_t(ns);
+    unsigned exponent = unsigned(std::bit_width(ns)) - 1;
+    if (exponent > kMaxExponent) return kBuckets - 1;
+    std::size_t sub = std::size_t(ns >> (exponent - kSubBits)) & (kSub - 1);
+    return (exponent - kSubBits + 1) * kSub + sub;
+}
+
+// Highest value that lands in bucket, as HDR histograms report it
+std::uint64_t bucket_value(std::size_t bucket) {
+    if (bucket < kSub) return bucket;
+    unsigned exponent = unsigned(bucket / kSub) + kSubBits - 1;
+    std::uint64_t width = std::uint64_t(1) << (exponent - kSubBits);
+    return (kSub + bucket % kSub) * width + width - 1;
+}
+
+// Written only by the owning thread, so updates are plain loads and stores
+struct address_counters {
+    std::string owner;
+    std::atomic<std::uint64_t> calls{0};
+    std::atomic<std::uint64_t> errors{0};
+    std::atomic<std::uint64_t> refused{0};     // see stats_refused
+    std::atomic<std::uint64_t> bytes_in{0};
+    std::atomic<std::uint64_t> bytes_out{0};
+    std::atomic<std::uint64_t> buckets[kBuckets] = {};
+    std::atomic<std::uint64_t> queued{0};
+    std::atomic<std::uint64_t> wait_buckets[kBuckets] = {};
+    std::atomic<std::uint64_t> heap_bytes{0};  // see call_probe
+    std::atomic<std::uint64_t> heap_allocations{0};
+    std::atomic<std::uint64_t> cpu_ns{0};      // the handling library's own, see call_probe
+    std::atomic<std::uint64_t> overruns{0};    // see watchdog.h
+};
+
+void bump(std::atomic<std::uint64_t>& counter, std::uint64_t amount) {
+    counter.store(counter.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+}
+
+struct stats_shard {
+    // Held by the owner while it inserts and by reports while they walk the map; the
+    // owner's lookups don't need it, since only the owner changes the map
+    std::mutex lock;
+    std::unordered_map<std::string, address_counters, route_hash, std::equal_to<>> addresses;
+    // Counters by handle, see stats_record; only the owner touches it
+    std::vector<address_counters*> sites;
+};
+
+// Plain copy of the counters, summed over shards
+struct totals {
+    std::string owner;
+    std::uint64_t calls = 0;
+    std::uint64_t errors = 0;
+    std::uint64_t refused = 0;
+    std::uint64_t bytes_in = 0;
+    std::uint64_t bytes_out = 0;
+    std::vector<std::uint64_t> buckets = std::vector<std::uint64_t>(kBuckets, 0);
+    std::uint64_t queued = 0;
+    std::vector<std::uint64_t> wait_buckets = std::vector<std::uint64_t>(kBuckets, 0);
+    std::uint64_t heap_bytes = 0;
+    std::uint64_t heap_allocations = 0;
+    std::uint64_t cpu_ns = 0;
+    std::uint64_t overruns = 0;
+
+    void add(const address_counters& counters) {
+        calls += counters.calls.load(std::memory_order_relaxed);
+        errors += counters.errors.load(std::memory_order_relaxed);
+        refused += counters.refused.load(std::memory_order_relaxed);
+        bytes_in += counters.bytes_in.load(std::memory_order_relaxed);
+        bytes_out += counters.bytes_out.load(std::memory_order_relaxed);
+        for (std::size_t b = 0; b < kBuckets; ++b) buckets[b] += counters.buckets[b].load(std::memory_order_relaxed);
+        queued += counters.queued.load(std::memory_order_relaxed);
+        for (std::size_t b = 0; b < kBuckets; ++b) {
+            wait_buckets[b] += counters.wait_buckets[b].load(std::memory_order_relaxed);
+        }
+        heap_bytes += counters.heap_bytes.load(std::memory_order_relaxed);
+        heap_allocations += counters.heap_allocations.load(std::memory_order_relaxed);
+        cpu_ns += counters.cpu_ns.load(std::memory_order_relaxed);
+        overruns += counters.overruns.load(std::memory_order_relaxed);
+    }
+
+    void add(const totals& other) {
+        calls += other.calls;
+        errors += other.errors;
+        refused += other.refused;
+        bytes_in += other.bytes_in;
+        bytes_out += other.bytes_out;
+        for (std::size_t b = 0; b < kBuckets; ++b) buckets[b] += other.buckets[b];
+        queued += other.queued;
+        for (std::size_t b = 0; b < kBuckets; ++b) wait_buckets[b] += other.wait_buckets[b];
+        heap_bytes += other.heap_bytes;
+        heap_allocations += other.heap_allocations;
+        cpu_ns += other.cpu_ns;
+        overruns += other.overruns;
+    }
+
+    void subtract(const totals& other) {
+        calls -= std::min(calls, other.calls);
+        errors -= std::min(errors, other.errors);
+        refused -= std::min(refused, other.refused);
+        bytes_in -= std::min(bytes_in, other.bytes_in);
+        bytes_out -= std::min(bytes_out, other.bytes_out);
+        for (std::size_t b = 0; b < kBuckets; ++b) buckets[b] -= std::min(buckets[b], other.buckets[b]);
+        queued -= std::min(queued, other.queued);
+        for (std::size_t b = 0; b < kBuckets; ++b) wait_buckets[b] -= std::min(wait_buckets[b], other.wait_buckets[b]);
+        heap_bytes -= std::min(heap_bytes, other.heap_bytes);
+        heap_allocations -= std::min(heap_allocations, other.heap_allocations);
+        cpu_ns -= std::min(cpu_ns, other.cpu_ns);
+        overruns -= std::min(overruns, other.overruns);
+    }
+
+    std::uint64_t percentile(double q) const {
+        return percentile_of(buckets, q);
+    }
+
+    std::uint64_t wait_percentile(double q) const {
+        return percentile_of(wait_buckets, q);
+    }
+
+    static std::uint64_t percentile_of(const std::vector<std::uint64_t>& histogram, double q) {
+        std::uint64_t count = 0;
+        for (std::uint64_t n : histogram) count += n;
+        if (count == 0) return 0;
+        auto rank = std::uint64_t(q * double(count) + 0.999999);
+        std::uint64_t seen = 0;
+        for (std::size_t b = 0; b < kBuckets; ++b) {
+            seen += histogram[b];
+            if (seen >= std::max<std::uint64_t>(rank, 1)) return bucket_value(b);
+        }
+        return bucket_value(kBuckets - 1);
+    }
+};
+
+std::atomic<bool> g_enabled{true};
+std::atomic<bool> g_cpu{false};
+std::atomic<bool> g_heap{false};
+
+std::mutex g_shards_lock;
+std::vector<std::shared_ptr<stats_shard>> g_shards;  // kept after their threads exit
+std::map<std::string, totals> g_baseline;            // subtracted from reports, see stats_reset
+stats_clock::time_point g_since = stats_clock::now();
+
+stats_shard& local_shard() {
+    thread_local std::shared_ptr<stats_shard> shard = [] {
+        auto created = std::make_shared<stats_shard>();
+        std::lock_guard<std::mutex> lock(g_shards_lock);
+        g_shards.push_back(created);
+        return created;
+    }();
+    return *shard;
+}
+
+// Caller holds g_shards_lock
+std::map<std::string, totals> collect() {
+    std::map<std::string, totals> result;
+    for (const auto& shard : g_shards) {
+        std::lock_guard<std::mutex> lock(shard->lock);
+        for (const auto& [address, counters] : shard->addresses) {
+            totals& sum = result[address];
+            if (sum.owner.empty()) sum.owner = counters.owner;
+            sum.add(counters);
+        }
+    }
+    for (auto& [address, sum] : result) {
+        auto it = g_baseline.find(address);
+        if (it != g_baseline.end()) sum.subtract(it->second);
+    }
+    return result;
+}
+
+// The calling thread's counters for address, created on first use. Refusals and
+// overruns don't know the owner, so it is filled in by the first call that does.
+void adopt_owner(stats_shard& shard, address_counters& counters, std::string_view owner) {
+    if (!counters.owner.empty() || owner.empty()) return;
+    std::lock_guard<std::mutex> lock(shard.lock);
+    counters.owner = owner;
+}
+
+address_counters& local_counters(std::string_view address, std::string_view owner) {
+    stats_shard& shard = local_shard();
+    auto it = shard.addresses.find(address);
+    if (it == shard.addresses.end()) {
+        std::lock_guard<std::mutex> lock(shard.lock);
+        it = shard.addresses.try_emplace(std::string(address)).first;
+        it->second.owner = owner;
+    } else {
+        adopt_owner(shard, it->second, owner);
+    }
+    return it->second;
+}
+
+// The same through a handle: a handle's address never changes and counters are never
+// freed, so the pointer found on the thread's first call serves every later one
+address_counters& site_counters(std::size_t site, std::string_view address, std::string_view owner) {
+    if (site == 0) return local_counters(address, owner);
+    stats_shard& shard = local_shard();
+    if (site > shard.sites.size()) shard.sites.resize(site, nullptr);
+    address_counters*& cached = shard.sites[site - 1];
+    if (!cached) {
+        cached = &local_counters(address, owner);
+    } else {
+        adopt_owner(shard, *cached, owner);
+    }
+    return *cached;
+}
+
+void record_wait(address_counters& counters, stats_clock::duration queued) {
+    if (queued.count() <= 0) return;
+    bump(counters.queued, 1);
+    bump(counters.wait_buckets[bucket_of(
+        std::uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(queued).count()))], 1);
+}
+
+thread_local call_probe* t_probe = nullptr;  // innermost on this thread
+
+void write_totals(std::string& out, const totals& sum) {
+    out += R"("calls":)" + std::to_string(sum.calls) + R"(,"errors":)" + std::to_string(sum.errors) +
+           R"(,"refused":)" + std::to_string(sum.refused) +
+           R"(,"bytes_in":)" + std::to_string(sum.bytes_in) + R"(,"bytes_out":)" + std::to_string(sum.bytes_out) +
+           R"(,"p50_ns":)" + std::to_string(sum.percentile(0.5)) +
+           R"(,"p99_ns":)" + std::to_string(sum.percentile(0.99)) +
+           R"(,"p999_ns":)" + std::to_string(sum.percentile(0.999)) +
+           R"(,"max_ns":)" + std::to_string(sum.percentile(1.0)) +
+           R"(,"queued":)" + std::to_string(sum.queued) +
+           R"(,"wait_p50_ns":)" + std::to_string(sum.wait_percentile(0.5)) +
+           R"(,"wait_p99_ns":)" + std::to_string(sum.wait_percentile(0.99)) +
+           R"(,"wait_max_ns":)" + std::to_string(sum.wait_percentile(1.0)) +
+           R"(,"cpu_ns":)" + std::to_string(sum.cpu_ns) +
+           R"(,"cpu_per_call_ns":)" +
+           std::to_string(sum.cpu_ns / std::max<std::uint64_t>(sum.calls - sum.refused, 1)) +
+           R"(,"overruns":)" + std::to_string(sum.overruns);
+}
+
+}
+
+void stats_record(std::string_view address, std::string_view owner, bool handled, bool failed,
+                  std::size_t bytes_in, std::size_t bytes_out, stats_clock::time_point start,
+                  stats_clock::duration queued, std::size_t site) {
+    if (!g_enabled.load(std::memory_order_relaxed)) return;
+    auto ns = std::uint64_t(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(stats_clock::now() - start - queued).count());
+
+    address_counters& counters =
+        handled ? site_counters(site, address, owner) : local_counters(kUnrouted, {});
+    bump(counters.calls, 1);
+    if (failed || !handled) bump(counters.errors, 1);
+    bump(counters.bytes_in, bytes_in);
+    bump(counters.bytes_out, bytes_out);
+    bump(counters.buckets[bucket_of(ns)], 1);
+    record_wait(counters, queued);
+}
+
+void stats_refused(std::string_view address, std::size_t bytes_in, std::size_t bytes_out,
+                   stats_clock::duration queued, std::size_t site) {
+    if (!g_enabled.load(std::memory_order_relaxed)) return;
+    address_counters& counters = site_counters(site, address, {});
+    bump(counters.calls, 1);
+    bump(counters.errors, 1);
+    bump(counters.refused, 1);
+    bump(counters.bytes_in, bytes_in);
+    bump(counters.bytes_out, bytes_out);
+    record_wait(counters, queued);
+}
+
+bool stats_failed(std::string_view response) {
+    return response.starts_with(R"({"success":false)");
+}
+
+void stats_enable(bool enabled) {
+    g_enabled.store(enabled, std::memory_order_relaxed);
+}
+
+void stats_enable_cpu(bool enabled) {
+    g_cpu.store(enabled, std::memory_order_relaxed);
+}
+
+void stats_enable_heap(bool enabled) {
+    g_heap.store(enabled, std::memory_order_relaxed);
+}
+
+std::string stats_report() {
+    std::map<std::string, totals> addresses;
+    long long since_ms = 0;
+    {
+        std::lock_guard<std::mutex> lock(g_shards_lock);
+        addresses = collect();
+        since_ms = std::chrono::duration_cast<std::chrono::milliseconds>(stats_clock::now() - g_since).count();
+    }
+
+    std::map<std::string, totals> plugins;
+    for (const auto& [address, sum] : addresses) {
+        if (!sum.owner.empty()) plugins[sum.owner].add(sum);
+    }
+
+    std::string out = R"({"success":true,"since_ms":)" + std::to_string(since_ms) + R"(,"addresses":[)";
+    bool first = true;
+    for (const auto& [address, sum] : addresses) {
+        if (sum.calls == 0) continue;
+        if (!first) out += ",";
+        first = false;
+        out += R"({"address":")" + json_escape(address) + R"(","plugin":")" + json_escape(sum.owner) + R"(",)";
+        write_totals(out, sum);
+        out += "}";
+    }
+    out += R"(],"plugins":[)";
+    first = true;
+    for (const auto& [owner, sum] : plugins) {
+        if (sum.calls == 0) continue;
+        if (!first) out += ",";
+        first = false;
+        out += R"({"plugin":")" + json_escape(owner) + R"(",)";
+        write_totals(out, sum);
+        out += "}";
+    }
+    out += "]}";
+    return out;
+}
+
+call_probe::call_probe(void (*memstats)(libsmemory* total, libsmemory* thread), std::string_view address,
+                       std::string_view owner, std::size_t site)
+    : active_(g_enabled.load(std::memory_order_relaxed)),
+      memstats_(g_heap.load(std::memory_order_relaxed) ? memstats : nullptr), address_(address), owner_(owner),
+      site_(site), cpu_(g_cpu.load(std::memory_order_relaxed) || watchdog_watching()) {
+    active_ = active_ && (memstats_ || cpu_);
+    if (!active_) return;
+    if (memstats_) memstats_(nullptr, &start_);
+    outer_ = t_probe;
+    t_probe = this;
+    if (cpu_) cpu_start_ = thread_cpu_ns();
+}
+
+call_probe::~call_probe() {
+    if (!active_) return;
+    std::uint64_t cpu = cpu_ ? thread_cpu_ns() - cpu_start_ : 0;
+    t_probe = outer_;
+    if (outer_) outer_->cpu_nested_ += cpu;
+
+    std::uint64_t bytes = 0;
+    std::uint64_t allocations = 0;
+    if (memstats_) {
+        libsmemory end = {};
+        memstats_(nullptr, &end);
+        bytes = end.allocated - start_.allocated;
+        allocations = end.allocations - start_.allocations;
+
+        // The nearest enclosing probe into the same library leaves this call's share out of its own
+        for (call_probe* outer = outer_; outer; outer = outer->outer_) {
+            if (outer->memstats_ != memstats_) continue;
+            outer->nested_.allocated += bytes;
+            outer->nested_.allocations += allocations;
+            break;
+        }
+        bytes -= std::min(bytes, nested_.allocated);
+        allocations -= std::min(allocations, nested_.allocations);
+    }
+
+    address_counters& counters = site_counters(site_, address_, owner_);
+    bump(counters.cpu_ns, cpu - std::min(cpu, cpu_nested_));
+    if (allocations == 0) return;
+    bump(counters.heap_bytes, bytes);
+    bump(counters.heap_allocations, allocations);
+}
+
+void stats_overrun(std::string_view address) {
+    if (!g_enabled.load(std::memory_order_relaxed)) return;
+    bump(local_counters(address, {}).overruns, 1);
+}
+
+std::string stats_heap_report() {
+    std::map<std::string, totals> addresses;
+    long long since_ms = 0;
+    {
+        std::lock_guard<std::mutex> lock(g_shards_lock);
+        addresses = collect();
+        since_ms = std::chrono::duration_cast<std::chrono::milliseconds>(stats_clock::now() - g_since).count();
+    }
+
+    std::vector<std::pair<const std::string*, const totals*>> charged;
+    for (const auto& [address, sum] : addresses) {
+        if (sum.heap_allocations) charged.emplace_back(&address, &sum);
+    }
+    std::stable_sort(charged.begin(), charged.end(),
+                     [](const auto& a, const auto& b) { return a.second->heap_bytes > b.second->heap_bytes; });
+
+    double seconds = std::max(double(since_ms), 1.0) / 1000.0;
+    std::string out = R"({"since_ms":)" + std::to_string(since_ms) + R"(,"addresses":[)";
+    bool first = true;
+    for (const auto& [address, sum] : charged) {
+        if (!first) out += ",";
+        first = false;
+        std::uint64_t calls = std::max<std::uint64_t>(sum->calls, 1);
+        out += R"({"address":")" + json_escape(*address) + R"(","plugin":")" + json_escape(sum->owner) +
+               R"(","calls":)" + std::to_string(sum->calls) + R"(,"allocated":)" + std::to_string(sum->heap_bytes) +
+               R"(,"allocations":)" + std::to_string(sum->heap_allocations) +
+               R"(,"bytes_per_call":)" + std::to_string(sum->heap_bytes / calls) +
+               R"(,"allocations_per_call":)" + std::to_string(sum->heap_allocations / calls) +
+               R"(,"bytes_per_sec":)" + std::to_string(std::uint64_t(double(sum->heap_bytes) / seconds)) + "}";
+    }
+    out += "]}";
+    return out;
+}
+
+void stats_reset() {
+    std::lock_guard<std::mutex> lock(g_shards_lock);
+    g_baseline.clear();
+    std::map<std::string, totals> current = collect();
+    g_baseline = std::move(current);
+    g_since = stats_clock::now();
+}
+
+namespace {
+
+std::mutex g_dump_lock;
+timer_id g_dump_timer = 0;
+
+void dump_once() {
+    std::map<std::string, totals> addresses;
+    {
+        std::lock_guard<std::mutex> lock(g_shards_lock);
+        addresses = collect();
+    }
+    for (const auto& [address, sum] : addresses) {
+        if (sum.calls == 0) continue;
+        std::cout << "CONTROL: stats " << address << " calls=" << sum.calls << " errors=" << sum.errors
+                  << " p50=" << double(sum.percentile(0.5)) / 1000.0 << "us p99=" << double(sum.percentile(0.99)) / 1000.0
+                  << "us p999=" << double(sum.percentile(0.999)) / 1000.0 << "us" << std::endl;
+    }
+}
+
+}
+
+void stats_dump_every(std::chrono::milliseconds interval) {
+    std::lock_guard<std::mutex> lock(g_dump_lock);
+    if (g_dump_timer) timer_cancel(g_dump_timer);
+    g_dump_timer = 0;
+    if (interval.count() <= 0) return;
+    // The summary walks every shard, so it runs on the pool rather than the timer thread
+    g_dump_timer = timer_schedule(interval, interval, std::make_shared<const std::function<void()>>([] {
+        if (pool_ref pool = control_pool()) pool->submit(dump_once);
+    }));
+}
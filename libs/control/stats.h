@@ -0,0 +1,91 @@
+#pragma once
+
+#include "contract.h"
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// Per-address dispatch metrics: calls, errors, refusals, bytes in and out, log-linear histograms
+// of execution latency and of admission queue wait (16 buckets per power of two, so
+// percentiles are within about 6%), the CPU time and heap the handling library spent on
+// them, and watchdog overruns. Every thread records into its own shard without taking a
+// lock; reports sum the shards.
+
+using stats_clock = std::chrono::steady_clock;
+
+// Records one finished dispatch. owner is the plugin that handled it, "control" for
+// control's own handlers. Addresses nothing handled are counted together, so stray
+// callers can't grow the table. queued is the part of the time since start the call spent
+// waiting for admission; it goes to a histogram of its own and not into the latency.
+//
+// site, here and below, is a handle (see handles.h) the call came through, 0 for none:
+// each thread keeps its counters for a handle's address, so it hashes the address only on
+// its first call through the handle.
+void stats_record(std::string_view address, std::string_view owner, bool handled, bool failed,
+                  std::size_t bytes_in, std::size_t bytes_out, stats_clock::time_point start,
+                  stats_clock::duration queued = {}, std::size_t site = 0);
+
+// Records a call turned away before it ran, by its deadline, cancellation or admission
+// (see admission.h), under its address: a call and an error, counted as refused, with
+// its queue wait but no latency
+void stats_refused(std::string_view address, std::size_t bytes_in, std::size_t bytes_out,
+                   stats_clock::duration queued = {}, std::size_t site = 0);
+
+// True for responses of the form {"success":false,...}
+bool stats_failed(std::string_view response);
+
+// Turns recording on or off (on by default)
+void stats_enable(bool enabled);
+
+// Turns CPU time accounting on or off (off by default). It reads the thread's CPU clock
+// twice a call, which is a system call on some platforms; off, cpu_ns only counts calls
+// made under a watchdog budget (see watchdog.h), which reads that clock anyway.
+void stats_enable_cpu(bool enabled);
+
+// Turns heap accounting per address on or off (off by default). It calls the library's
+// MemStats twice a call; off, control.memstats still has each library's own totals.
+void stats_enable_heap(bool enabled);
+
+// JSON object with per-address and per-plugin totals since the last reset
+std::string stats_report();
+void stats_reset();
+
+// Charges what one call into a library uses on this thread, while the probe lives, to
+// address: the thread's CPU time, and the heap the library allocates as its MemStats
+// export counts it (memstats may be null for a library without one). Both are the call's
+// own share; dispatches it makes through control are charged to their own addresses,
+// CPU for any library and heap for the same one, since other libraries count their own.
+// A no-op while recording is off, or while neither kind of accounting applies to the call.
+class call_probe {
+public:
+    call_probe(void (*memstats)(libsmemory* total, libsmemory* thread), std::string_view address,
+               std::string_view owner, std::size_t site = 0);
+    ~call_probe();
+    call_probe(const call_probe&) = delete;
+    call_probe& operator=(const call_probe&) = delete;
+
+private:
+    bool active_;
+    void (*memstats_)(libsmemory* total, libsmemory* thread);
+    std::string_view address_;
+    std::string_view owner_;
+    std::size_t site_;
+    bool cpu_;
+    libsmemory start_ = {};   // the library's counts for this thread
+    libsmemory nested_ = {};  // taken by probes into the same library inside this one
+    std::uint64_t cpu_start_ = 0;
+    std::uint64_t cpu_nested_ = 0;  // taken by every probe directly inside this one
+    call_probe* outer_ = nullptr;
+};
+
+// Counts a call to address that ran past its budget, see watchdog.h
+void stats_overrun(std::string_view address);
+
+// JSON object with the heap charged to each address since the last reset: bytes and
+// allocations, per call and per second, largest first
+std::string stats_heap_report();
+
+// Prints a summary on the pool every interval, timed by control's timer; zero stops it
+void stats_dump_every(std::chrono::milliseconds interval);
@@ -0,0 +1,262 @@
+#pragma once
+
+#include "contract.h"
+#include "handler.h"
+#include <condition_variable>
+#include <coroutine>
+#include <exception>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+// Coroutine handlers. A handler that sets handler_def::co is a coroutine returning
+// task<std::string>; it can co_await other tasks and dispatch_async(), which gives the
+// thread back while the nested call runs on control's pool and resumes the handler on
+// whichever thread completes it. Control starts such handlers through InvokeDeferred, so
+// nothing waits for them; the synchronous entry points run them with sync_wait(), which
+// performs every awaited dispatch inline instead.
+
+template <typename T>
+class task;
+
+namespace task_detail {
+
+// Set while sync_wait drives a task on this thread
+inline thread_local bool t_blocking = false;
+
+// Resumes whoever awaited the task once it finishes
+struct final_awaiter {
+    std::coroutine_handle<> continuation;
+
+    bool await_ready() const noexcept { return false; }
+    template <typename Promise>
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise>) noexcept {
+        return continuation ? continuation : std::noop_coroutine();
+    }
+    void await_resume() const noexcept {}
+};
+
+struct promise_base {
+    std::coroutine_handle<> continuation;
+    std::exception_ptr error;
+
+    std::suspend_always initial_suspend() const noexcept { return {}; }
+    final_awaiter final_suspend() const noexcept { return {continuation}; }
+    void unhandled_exception() noexcept { error = std::current_exception(); }
+};
+
+template <typename T>
+struct promise : promise_base {
+    std::optional<T> value;
+
+    task<T> get_return_object();
+    template <typename U>
+    void return_value(U&& result) { value.emplace(std::forward<U>(result)); }
+
+    T take() {
+        if (error) std::rethrow_exception(error);
+        return std::move(*value);
+    }
+};
+
+template <>
+struct promise<void> : promise_base {
+    task<void> get_return_object();
+    void return_void() const noexcept {}
+
+    void take() const {
+        if (error) std::rethrow_exception(error);
+    }
+};
+
+// Fire and forget: runs as soon as it is called and frees itself when done
+struct detached {
+    struct promise_type {
+        detached get_return_object() const noexcept { return {}; }
+        std::suspend_never initial_suspend() const noexcept { return {}; }
+        std::suspend_never final_suspend() const noexcept { return {}; }
+        void return_void() const noexcept {}
+        void unhandled_exception() const noexcept { std::terminate(); }
+    };
+};
+
+}
+
+// Lazily started coroutine producing a T; starts when awaited and owns its frame
+template <typename T>
+class task {
+public:
+    using promise_type = task_detail::promise<T>;
+
+    explicit task(std::coroutine_handle<promise_type> handle) : handle_(handle) {}
+    task(task&& other) noexcept : handle_(std::exchange(other.handle_, nullptr)) {}
+    task& operator=(task&& other) noexcept {
+        if (this != &other) {
+            if (handle_) handle_.destroy();
+            handle_ = std::exchange(other.handle_, nullptr);
+        }
+        return *this;
+    }
+    task(const task&) = delete;
+    task& operator=(const task&) = delete;
+    ~task() {
+        if (handle_) handle_.destroy();
+    }
+
+    auto operator co_await() && noexcept {
+        struct awaiter {
+            std::coroutine_handle<promise_type> handle;
+
+            bool await_ready() const noexcept { return false; }
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) noexcept {
+                handle.promise().continuation = caller;
+                return handle;
+            }
+            T await_resume() { return handle.promise().take(); }
+        };
+        return awaiter{handle_};
+    }
+
+private:
+    std::coroutine_handle<promise_type> handle_;
+};
+
+template <typename T>
+task<T> task_detail::promise<T>::get_return_object() {
+    return task<T>(std::coroutine_handle<promise<T>>::from_promise(*this));
+}
+
+inline task<void> task_detail::promise<void>::get_return_object() {
+    return task<void>(std::coroutine_handle<promise<void>>::from_promise(*this));
+}
+
+// Starts work and calls done with its result (or the exception it threw) when it finishes,
+// on whichever thread that happens
+template <typename T, typename Done>
+task_detail::detached task_spawn(task<T> work, Done done) {
+    std::exception_ptr error;
+    if constexpr (std::is_void_v<T>) {
+        try {
+            co_await std::move(work);
+        } catch (...) {
+            error = std::current_exception();
+        }
+        done(error);
+    } else {
+        std::optional<T> value;
+        try {
+            value.emplace(co_await std::move(work));
+        } catch (...) {
+            error = std::current_exception();
+        }
+        done(std::move(value), error);
+    }
+}
+
+// Runs work to completion on the calling thread and returns its result
+template <typename T>
+T sync_wait(task<T> work) {
+    struct state {
+        std::mutex lock;
+        std::condition_variable done_cv;
+        bool done = false;
+        std::optional<std::conditional_t<std::is_void_v<T>, bool, T>> value;
+        std::exception_ptr error;
+
+        void finish(std::exception_ptr failure) {
+            std::lock_guard<std::mutex> guard(lock);
+            error = failure;
+            done = true;
+            done_cv.notify_all();
+        }
+    } shared;
+
+    bool was_blocking = std::exchange(task_detail::t_blocking, true);
+    if constexpr (std::is_void_v<T>) {
+        task_spawn(std::move(work), [&shared](std::exception_ptr error) { shared.finish(error); });
+    } else {
+        task_spawn(std::move(work), [&shared](std::optional<T> value, std::exception_ptr error) {
+            shared.value = std::move(value);
+            shared.finish(error);
+        });
+    }
+    task_detail::t_blocking = was_blocking;
+
+    std::unique_lock<std::mutex> lock(shared.lock);
+    shared.done_cv.wait(lock, [&] { return shared.done; });
+    if (shared.error) std::rethrow_exception(shared.error);
+    if constexpr (!std::is_void_v<T>) return std::move(*shared.value);
+}
+
+struct dispatch_result {
+    bool handled = false;
+    std::string response;
+};
+
+// co_await dispatch_async(host, "efs.read", payload) runs the call on control's pool and
+// resumes the awaiting coroutine with its result. Under sync_wait the call is made inline.
+class dispatch_async {
+public:
+    dispatch_async(const libshost* host, std::string address, std::string payload = {}, std::string options = {})
+        : host_(host), address_(std::move(address)), payload_(std::move(payload)), options_(std::move(options)) {}
+
+    bool await_ready() {
+        if (!host_) {
+            result_.response = R"({"success":false,"error":"no host services"})";
+            return true;
+        }
+        if (!task_detail::t_blocking) return false;
+
+        libsresult out = {};
+        result_.handled = host_->dispatch2(address_.c_str(), payload_.c_str(), options_.c_str(), &out);
+        if (out.data) result_.response.assign(out.data, out.size);
+        host_->release(&out);
+        return true;
+    }
+
+    // Once the call is queued the completion may resume the caller at any moment, so
+    // nothing here touches the object after that
+    bool await_suspend(std::coroutine_handle<> caller) {
+        caller_ = caller;
+        if (host_->dispatch_async(address_.c_str(), payload_.c_str(), options_.c_str(), &complete, this)) return true;
+        result_.response = R"({"success":false,"error":"dispatch pool is closed"})";
+        return false;
+    }
+
+    dispatch_result await_resume() { return std::move(result_); }
+
+private:
+    static void complete(bool handled, const libsresult* result, void* user_data) {
+        auto* self = static_cast<dispatch_async*>(user_data);
+        self->result_.handled = handled;
+        if (result && result->data) self->result_.response.assign(result->data, result->size);
+        self->caller_.resume();
+    }
+
+    const libshost* host_;
+    std::string address_;
+    std::string payload_;
+    std::string options_;
+    std::coroutine_handle<> caller_;
+    dispatch_result result_;
+};
+
+// Starts a coroutine handler for InvokeDeferred; callback gets the response when it
+// finishes, an exception becoming an error response as for plain handlers
+inline void handler_spawn(const handler_def& handler, const char* payload, std::size_t payload_len,
+                          const char* options, CompletionFn callback, void* user_data) {
+    task_spawn(handler.co(std::string(payload ? payload : "", payload_len), options ? options : ""),
+               [callback, user_data](std::optional<std::string> value, std::exception_ptr error) {
+                   std::string response;
+                   try {
+                       if (error) std::rethrow_exception(error);
+                       response = std::move(*value);
+                   } catch (const std::exception& ex) {
+                       response = R"({"success":false,"error":")" + std::string(ex.what()) + R"("})";
+                   }
+                   libsresult result = {response.c_str(), response.size(), nullptr};
+                   callback(true, &result, user_data);
+               });
+}
@@ -0,0 +1,1031 @@
+// Tests control's timer wheel, result cache, handles and dispatch paths. Links control's objects directly,
+// so the internals are called as they are inside the library; run from the directory the
+// plugins were built into (make test does).
+#include "contract.h"
+#include "admission.h"
+#include "cache.h"
+#include "deadline.h"
+#include "json.h"
+#include "reactor.h"
+#include "stats.h"
+#include "task.h"
+#include "timer.h"
+#include "watchdog.h"
+#include "typed.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+using test_clock = std::chrono::steady_clock;
+using std::chrono::milliseconds;
+
+// How late a timer may fire: the thread wakes on 1 ms ticks, plus whatever the machine adds
+constexpr milliseconds kSlack{100};
+
+static int g_failures = 0;
+
+static void check(bool ok, const std::string& what) {
+    std::cout << (ok ? "  ok   " : "  FAIL ") << what << std::endl;
+    if (!ok) ++g_failures;
+}
+
+static long long since(test_clock::time_point start) {
+    return std::chrono::duration_cast<milliseconds>(test_clock::now() - start).count();
+}
+
+// Sections are numbered in the order they run
+static void section(const std::string& title) {
+    static int number = 0;
+    std::cout << "\n=== TEST " << ++number << ": " << title << " ===" << std::endl;
+}
+
+static timer_fire make_fire(std::function<void()> fire) {
+    return std::make_shared<const std::function<void()>>(std::move(fire));
+}
+
+// A one-shot timer and when it went off, in ms after it was scheduled (-1 until then)
+struct probe_timer {
+    long long delay = 0;
+    test_clock::time_point scheduled;
+    std::atomic<long long> fired_after{-1};
+};
+
+static void schedule(probe_timer& timer, long long delay) {
+    timer.delay = delay;
+    timer.scheduled = test_clock::now();
+    timer_schedule(milliseconds(delay), milliseconds(0), make_fire([&timer] {
+        timer.fired_after = since(timer.scheduled);
+    }));
+}
+
+static bool wait_fired(const probe_timer& timer, milliseconds limit) {
+    auto until = test_clock::now() + limit;
+    while (timer.fired_after < 0 && test_clock::now() < until) std::this_thread::sleep_for(milliseconds(1));
+    return timer.fired_after >= 0;
+}
+
+static void check_on_time(const probe_timer& timer) {
+    long long fired = timer.fired_after;
+    check(fired >= timer.delay && fired <= timer.delay + kSlack.count(),
+          "timer of " + std::to_string(timer.delay) + " ms fired after " + std::to_string(fired) + " ms");
+}
+
+// Delays on either side of the root's 256 ticks and of its laps, scheduled once close to
+// a root wrap and once just after one
+static void test_wheel_boundaries(test_clock::time_point opened) {
+    section("Timers across root wraps and level boundaries");
+    const long long delays[] = {1, 5, 254, 255, 256, 257, 300, 511, 512, 513, 767, 1000};
+    for (long long offset : {250, 258}) {
+        // The wheel counts ticks from timer_open, so it wraps every 256 ms from there
+        long long at = (since(opened) / 256) * 256 + offset;
+        if (at - 256 > since(opened)) at -= 256;
+        if (at <= since(opened)) at += 256;
+        std::this_thread::sleep_until(opened + milliseconds(at));
+        std::vector<probe_timer> timers(std::size(delays));
+        for (std::size_t i = 0; i < timers.size(); ++i) schedule(timers[i], delays[i]);
+        for (auto& timer : timers) {
+            if (!wait_fired(timer, milliseconds(timer.delay) + kSlack * 4)) {
+                check(false, "timer of " + std::to_string(timer.delay) + " ms never fired");
+                continue;
+            }
+            check_on_time(timer);
+        }
+    }
+}
+
+// A periodic timer whose fire runs long skips the ticks it missed instead of bursting
+static void test_period_catch_up() {
+    section("Periodic timer catches up without a burst");
+    constexpr long long kPeriod = 10;
+    std::mutex lock;
+    std::vector<long long> fires;
+    std::atomic<long long> stalled_until{-1};
+    auto start = test_clock::now();
+    timer_id id = timer_schedule(milliseconds(kPeriod), milliseconds(kPeriod), make_fire([&] {
+        std::size_t count;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            fires.push_back(since(start));
+            count = fires.size();
+        }
+        if (count != 3) return;
+        std::this_thread::sleep_for(milliseconds(kPeriod * 5 + 5));
+        stalled_until = since(start);
+    }));
+    std::this_thread::sleep_for(milliseconds(300));
+    timer_cancel(id);
+
+    std::lock_guard<std::mutex> guard(lock);
+    check(fires.size() >= 10, std::to_string(fires.size()) + " fires in 300 ms");
+    check(fires.size() <= std::size_t(300 / kPeriod + 1), "no more fires than periods");
+    // The slot that was due during the stall fires late, then the schedule resumes; firing
+    // every missed tick would put about five here
+    std::size_t burst = 0;
+    for (long long fired : fires) {
+        if (fired >= stalled_until && fired < stalled_until + kPeriod) ++burst;
+    }
+    check(stalled_until >= 0 && burst <= 2,
+          std::to_string(burst) + " fires in the period after the stall");
+}
+
+static void test_cancel() {
+    section("Cancelling fired, cancelled and reused ids");
+    std::atomic<int> fired{0};
+    timer_id once = timer_schedule(milliseconds(5), milliseconds(0), make_fire([&] { ++fired; }));
+    std::this_thread::sleep_for(milliseconds(5) + kSlack);
+    check(fired == 1, "one-shot timer fired");
+    check(!timer_cancel(once), "cancelling a fired timer fails");
+
+    // Takes the slab entry the fired one left
+    std::atomic<int> reused_fired{0};
+    timer_id reused = timer_schedule(milliseconds(200), milliseconds(0), make_fire([&] { ++reused_fired; }));
+    check(std::uint32_t(reused) == std::uint32_t(once) && reused != once, "new timer reuses the entry");
+    check(!timer_cancel(once), "the old id doesn't cancel the new timer");
+    check(timer_cancel(reused), "the new id does");
+    check(!timer_cancel(reused), "cancelling twice fails");
+    std::this_thread::sleep_for(milliseconds(200) + kSlack);
+    check(reused_fired == 0, "cancelled timer never fired");
+    check(!timer_cancel(0) && !timer_cancel(~timer_id(0)), "unknown ids fail");
+}
+
+static dispatch_payload text(const std::string& value) {
+    return {value.c_str(), value.size(), true};
+}
+
+static void test_cache_eviction() {
+    section("Cache evicts down to its budget");
+    constexpr std::size_t kBudget = 64 * 1024;
+    cache_set_capacity(kBudget);
+    std::string response(1024, 'x');
+    std::uint64_t evicted = cache_stats().evictions;
+    for (int i = 0; i < 512; ++i) {
+        cache_put("test.evict", text(std::to_string(i)), nullptr, 1, cache_sequence(), 60000, response);
+    }
+    cache_counters after = cache_stats();
+    check(after.bytes <= kBudget, std::to_string(after.bytes) + " bytes held under a budget of " +
+                                      std::to_string(kBudget));
+    check(after.evictions > evicted, std::to_string(after.evictions - evicted) + " entries evicted");
+    std::string cached;
+    check(cache_get("test.evict", text("511"), nullptr, 1, cached) && cached == response, "newest entry kept");
+    check(!cache_get("test.evict", text("0"), nullptr, 1, cached), "oldest entry evicted");
+    check(!cache_get("test.evict", text("511"), nullptr, 2, cached), "another generation misses");
+    cache_set_capacity(std::size_t(64) << 20);
+}
+
+static void test_cache_invalidate_race() {
+    section("Put racing an invalidation is dropped");
+    std::string cached;
+    std::uint64_t stale = cache_stats().stale;
+
+    // The result was computed before the invalidation, and is put back after it
+    std::uint64_t before = cache_sequence();
+    cache_put("test.race", text("a"), nullptr, 1, before, 60000, "old");
+    cache_invalidate("test.race");
+    cache_put("test.race", text("a"), nullptr, 1, before, 60000, "old");
+    check(!cache_get("test.race", text("a"), nullptr, 1, cached), "stale put not stored");
+    check(cache_stats().stale == stale + 1, "stale put counted");
+
+    cache_put("test.race", text("a"), nullptr, 1, cache_sequence(), 60000, "new");
+    check(cache_get("test.race", text("a"), nullptr, 1, cached) && cached == "new", "fresh put stored");
+
+    // The same with the invalidation on another thread while puts keep coming
+    std::atomic<bool> stop{false};
+    std::thread writer([&] {
+        while (!stop) {
+            std::uint64_t sequence = cache_sequence();
+            cache_put("test.race", text("b"), nullptr, 1, sequence, 60000, "value");
+        }
+    });
+    std::this_thread::sleep_for(milliseconds(5));
+    std::uint64_t cut = cache_sequence();
+    cache_invalidate("test.race");
+    stop = true;
+    writer.join();
+    bool found = cache_get("test.race", text("b"), nullptr, 1, cached);
+    check(!found || cache_sequence() != cut, "nothing from before the invalidation survives it");
+    cache_invalidate({});
+}
+
+// \u escapes outside the basic plane come as surrogate pairs and decode to one code point
+static void test_surrogate_pairs() {
+    section("Escaped surrogate pairs decode to UTF-8");
+    const std::string grin = "\xF0\x9F\x98\x80";  // U+1F600
+    std::string decoded;
+    std::size_t pos = 0;
+    check(typed_detail::read_string(R"("a\uD83D\uDE00b")", pos, decoded) && decoded == "a" + grin + "b",
+          "typed fields join a pair into four bytes");
+    pos = 0;
+    check(typed_detail::read_string(R"("\u00e9\u20ac")", pos, decoded) && decoded == "\xC3\xA9\xE2\x82\xAC",
+          "two- and three-byte escapes are unchanged");
+    for (const char* lone : {R"("\uD83D")", R"("\uDE00x")", R"("\uD83Dx")", R"("\uD83D\u0041")"}) {
+        pos = 0;
+        check(!typed_detail::read_string(lone, pos, decoded), std::string("typed fields reject ") + lone);
+    }
+    check(json_text(R"("a\uD83D\uDE00b")") == "a" + grin + "b", "control's own payloads join a pair too");
+    check(json_text(R"("\uDE00\uD83Dx")") == "\xEF\xBF\xBD\xEF\xBF\xBDx", "and replace lone halves with U+FFFD");
+}
+
+// Scheduled when the tests start, so it runs while the others do
+static void test_far_timer(const probe_timer& far) {
+    section("Timer past the second level");
+    if (wait_fired(far, milliseconds(far.delay) + kSlack * 4)) {
+        check_on_time(far);
+    } else {
+        check(false, "timer of " + std::to_string(far.delay) + " ms never fired");
+    }
+}
+
+// Reloading rebinds a handle's slot instead of taking a new one, so the table can't fill
+static void test_handles_across_reloads() {
+    section("Handles survive reloads");
+    char err[256] = {0};
+    Attach(Invoke, err, sizeof(err));
+    Invoke("control.run", "{}", "{}");
+
+    std::uint64_t handle = Resolve("efs.list");
+    if (!handle) {
+        std::cout << "  skip no efs plugin in this directory" << std::endl;
+        Detach(err, sizeof(err));
+        return;
+    }
+    std::uint64_t control = Resolve("control.pool");
+    bool same = true;
+    bool dispatched = true;
+    for (int i = 0; i < 200; ++i) {
+        Invoke("control.reload", R"({"name":"efs"})", "{}");
+        same = same && Resolve("efs.list") == handle && Resolve("control.pool") == control;
+        libsresult out = {};
+        dispatched = InvokeHandle(handle, "{}", 2, "{}", &out) && dispatched;
+        Release(&out);
+    }
+    check(same, "200 reloads keep both handles");
+    check(dispatched, "the handle reaches each new build");
+
+    Invoke("control.unload", R"({"name":"efs"})", "{}");
+    libsresult out = {};
+    check(!InvokeHandle(handle, "{}", 2, "{}", &out) && std::string(out.data, out.size).find("no plugin") !=
+                                                           std::string::npos,
+          "with the plugin unloaded the handle reports no plugin");
+    Release(&out);
+    Invoke("control.load", R"({"name":"efs"})", "{}");
+    check(InvokeHandle(handle, "{}", 2, "{}", &out), "and works again once it is loaded");
+    Release(&out);
+    check(!InvokeHandle(0, "{}", 2, "{}", &out), "handle 0 is rejected");
+    Release(&out);
+    Detach(err, sizeof(err));
+}
+
+// The object in report's array under list whose key is value, empty when there is none
+static std::string find_entry(std::string_view report, std::string_view list, std::string_view key,
+                              std::string_view value) {
+    std::string found;
+    auto items = json_find(report, list);
+    json_array_each(items ? *items : "", [&](std::string_view item) {
+        auto raw = json_find(item, key);
+        if (found.empty() && raw && json_text(*raw) == value) found = item;
+    });
+    return found;
+}
+
+// Counters add up across threads and the latency histogram puts each call in its bucket
+static void test_stats_counters() {
+    section("Stats count calls and bucket their latency");
+    Invoke("control.stats", R"({"reset":true})", "{}");
+
+    auto record = [](int calls, milliseconds took, milliseconds queued, bool failed) {
+        for (int i = 0; i < calls; ++i) {
+            stats_record("test.latency", "test", true, failed, 10, 20, stats_clock::now() - took - queued, queued);
+        }
+    };
+    std::thread other([&] { record(48, milliseconds(1), {}, false); });
+    record(49, milliseconds(1), {}, false);
+    record(1, milliseconds(1), milliseconds(2), true);
+    record(2, milliseconds(50), {}, false);
+    other.join();
+    for (int i = 0; i < 10; ++i) Invoke("control.resolve", "control.pool", "{}");
+    for (int i = 0; i < 5; ++i) Invoke("control.resolve", "control.nothing", "{}");
+    for (int i = 0; i < 3; ++i) Invoke("test.unrouted", "{}", "{}");
+
+    std::string report = Invoke("control.stats", "{}", "{}");
+    std::string latency = find_entry(report, "addresses", "address", "test.latency");
+    check(json_int(latency, "calls", 0) == 100 && json_int(latency, "errors", 0) == 1,
+          "100 calls from two threads, one failed");
+    check(json_int(latency, "bytes_in", 0) == 1000 && json_int(latency, "bytes_out", 0) == 2000, "bytes summed");
+    long long p50 = json_int(latency, "p50_ns", 0);
+    long long p99 = json_int(latency, "p99_ns", 0);
+    check(p50 >= 1000000 && p50 < 1500000, "p50 of " + std::to_string(p50) + " ns is the 1 ms calls");
+    check(p99 >= 50000000 && p99 < 60000000, "p99 of " + std::to_string(p99) + " ns is the 50 ms calls");
+    check(json_int(latency, "max_ns", 0) >= p99, "max is at least p99");
+    long long wait = json_int(latency, "wait_max_ns", 0);
+    check(json_int(latency, "queued", 0) == 1 && wait >= 2000000 && wait < 2500000,
+          "the queued call's 2 ms wait has a histogram of its own");
+
+    std::string resolve = find_entry(report, "addresses", "address", "control.resolve");
+    check(json_int(resolve, "calls", 0) == 15 && json_int(resolve, "errors", 0) == 5,
+          "dispatches counted, failed replies as errors");
+    std::string unrouted = find_entry(report, "addresses", "address", "(unrouted)");
+    check(json_int(unrouted, "calls", 0) == 3 && json_int(unrouted, "errors", 0) == 3,
+          "unrouted addresses are counted together");
+    std::string plugin = find_entry(report, "plugins", "plugin", "test");
+    check(json_int(plugin, "calls", 0) == 100, "and summed by plugin");
+
+    Invoke("control.stats", R"({"reset":true})", "{}");
+    report = Invoke("control.stats", "{}", "{}");
+    check(find_entry(report, "addresses", "address", "test.latency").empty(), "reset starts the counts over");
+}
+
+// A trace session writes each dispatch as a span, those made inside another as its children
+static void test_trace_spans() {
+    section("Trace sessions write nested spans");
+    const std::string path = (std::filesystem::temp_directory_path() / "test_control_trace.json").string();
+    std::string started = Invoke("control.trace", (R"({"action":"start","path":")" + json_escape(path) + R"("})").c_str(),
+                                 "{}");
+    check(json_bool(started, "success", false), "tracing starts");
+    Invoke("control.batch", R"([{"address":"control.resolve","payload":"control.pool"},
+                               {"address":"control.resolve","payload":"control.pool"},
+                               {"address":"control.resolve","payload":"control.pool"}])",
+           "{}");
+    Invoke("control.pool", "{}", "{}");
+    std::string stopped = Invoke("control.trace", R"({"action":"stop"})", "{}");
+    check(json_int(stopped, "spans", 0) >= 5 && json_int(stopped, "dropped", -1) == 0,
+          std::to_string(json_int(stopped, "spans", 0)) + " spans written, none dropped");
+
+    std::ifstream in(path);
+    std::string trace((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    in.close();
+    std::filesystem::remove(path);
+    long long batch = 0;
+    long long pool_parent = -1;
+    std::vector<long long> children;
+    bool sized = true;
+    auto events = json_find(trace, "traceEvents");
+    check(events && json_array_each(*events, [&](std::string_view event) {
+              auto name = json_find(event, "name");
+              auto args = json_find(event, "args");
+              if (!name || !args || json_text(json_find(event, "ph").value_or("\"\"")) != "X") return;
+              std::string address = json_text(*name);
+              if (address == "control.batch") batch = json_int(*args, "span", 0);
+              if (address == "control.pool") pool_parent = json_int(*args, "parent", -1);
+              if (address == "control.resolve") {
+                  children.push_back(json_int(*args, "parent", 0));
+                  sized = sized && json_int(*args, "bytes_in", 0) == 12 && json_int(*args, "bytes_out", 0) > 0;
+              }
+          }),
+          "the file is Chrome trace-event JSON");
+    check(batch != 0 && children.size() == 3 &&
+              std::all_of(children.begin(), children.end(), [&](long long parent) { return parent == batch; }),
+          "the batch's three calls hang off its span, on whichever thread ran them");
+    check(sized, "spans carry their payload and response sizes");
+    check(pool_parent == 0, "a top-level call has no parent");
+    check(!json_bool(Invoke("control.trace", "{}", "{}"), "tracing", true), "and the session is over");
+}
+
+// Options' deadlines and cancel tokens hold for the call and everything dispatched under it
+static void test_deadline_and_abort() {
+    section("Deadlines expire and control.abort cancels");
+    const std::string expired = R"({"success":false,"error":"deadline exceeded"})";
+    const std::string cancelled = R"({"success":false,"error":"cancelled"})";
+    auto refused = [] {
+        std::string entry = find_entry(Invoke("control.stats", "{}", "{}"), "addresses", "address", "control.pool");
+        return json_int(entry, "refused", 0);
+    };
+    long long before = refused();
+    check(Invoke("control.pool", "{}", R"({"deadline_ms":0})") == expired, "a spent deadline refuses the call");
+    check(refused() == before + 1, "and counts it as refused");
+    check(json_bool(Invoke("control.pool", "{}", R"({"deadline_ms":10000})"), "success", false),
+          "an ample one lets it run");
+
+    {
+        call_scope outer(R"({"deadline_ms":30})");
+        check(!Cancelled() && json_bool(Invoke("control.pool", "{}", "{}"), "success", false),
+              "nested calls run inside the deadline");
+        std::this_thread::sleep_for(milliseconds(40));
+        call_scope inner(R"({"deadline_ms":10000})");
+        check(Cancelled() && call_interrupted() == std::string("deadline exceeded"),
+              "a nested call can't extend it once it has passed");
+        check(Invoke("control.pool", "{}", "{}") == expired, "so its own calls are refused");
+    }
+    check(!Cancelled(), "the deadline ends with its scope");
+
+    std::atomic<bool> running{false};
+    std::atomic<bool> stopped{false};
+    std::string nested;
+    struct reply {
+        std::string text;
+        std::atomic<bool> done{false};
+    } queued;
+    std::thread worker([&] {
+        call_scope scope(R"({"cancel":"test.job"})");
+        running = true;
+        for (int i = 0; i < 2000 && !Cancelled(); ++i) std::this_thread::sleep_for(milliseconds(1));
+        stopped = Cancelled();
+        nested = Invoke("control.pool", "{}", "{}");
+        InvokeAsync("control.pool", "{}", "{}", [](bool, const libsresult* result, void* user_data) {
+            auto* into = static_cast<reply*>(user_data);
+            into->text.assign(result->data, result->size);
+            into->done = true;
+        }, &queued);
+    });
+    while (!running) std::this_thread::yield();
+    std::this_thread::sleep_for(milliseconds(10));
+    check(json_bool(Invoke("control.abort", R"({"cancel":"test.job"})", "{}"), "aborted", false),
+          "control.abort trips a running call's token");
+    worker.join();
+    for (int i = 0; i < 2000 && !queued.done; ++i) std::this_thread::sleep_for(milliseconds(1));
+    check(stopped, "the call sees it through Cancelled()");
+    check(nested == cancelled, "calls it makes afterwards are refused");
+    check(queued.done && queued.text == cancelled, "and so are those it hands to the pool");
+    check(!json_bool(Invoke("control.abort", R"({"cancel":"test.job"})", "{}"), "aborted", true),
+          "with the call gone there is nothing to abort");
+    check(json_bool(Invoke("control.pool", "{}", R"({"cancel":"test.job"})"), "success", false),
+          "and a new call under the same name runs");
+}
+
+// With every slot taken, calls queue up to the limit, higher classes first, and the rest are shed
+static void test_admission() {
+    section("Admission queues and sheds past the limit");
+    Invoke("control.limit", R"({"address":"test.gate","concurrency":1,"queue":2})", "{}");
+    auto gate = [](std::string_view field) {
+        std::string entry = find_entry(Invoke("control.limit", "{}", "{}"), "limits", "address", "test.gate");
+        return json_int(entry, field, -1);
+    };
+    auto wait_for = [&](std::string_view field, long long count) {
+        for (int i = 0; i < 2000 && gate(field) != count; ++i) std::this_thread::sleep_for(milliseconds(1));
+        return gate(field) == count;
+    };
+
+    std::mutex lock;
+    std::vector<std::string> outcomes;
+    auto waiter = [&](std::string name, const char* options) {
+        return std::thread([&, name, options] {
+            call_scope scope(options);
+            admission_ticket ticket("test.gate");
+            std::lock_guard<std::mutex> guard(lock);
+            outcomes.push_back(name + (ticket.refused() ? std::string(" ") + ticket.refused() : ""));
+        });
+    };
+
+    std::optional<admission_ticket> held;
+    held.emplace("test.gate");
+    check(!held->refused() && gate("running") == 1, "the first call takes the only slot");
+    std::thread first = waiter("first", "{}");
+    check(wait_for("waiting", 1), "the next one queues");
+    std::thread second = waiter("second", "{}");
+    check(wait_for("waiting", 2), "and so does the one after");
+    {
+        admission_ticket full("test.gate");
+        check(full.refused() == std::string("overloaded"), "a full queue sheds a call of the same class");
+    }
+    std::thread urgent = waiter("urgent", R"({"priority":"interactive"})");
+    second.join();
+    check(outcomes.size() == 1 && outcomes[0] == "second overloaded",
+          "an interactive call displaces the newest normal waiter");
+    {
+        auto start = test_clock::now();
+        admission_ticket late("test.gate");
+        check(late.refused() == std::string("overloaded") && since(start) < 20,
+              "with no lower class left to displace, the next is shed at once");
+    }
+
+    held.reset();
+    urgent.join();
+    first.join();
+    check(outcomes.size() == 3 && outcomes[1] == "urgent" && outcomes[2] == "first",
+          "freed slots go to the interactive waiter, then in arrival order");
+
+    held.emplace("test.gate");
+    {
+        call_scope scope(R"({"deadline_ms":20})");
+        admission_ticket late("test.gate");
+        check(late.refused() == std::string("deadline exceeded") && late.waited() >= milliseconds(20),
+              "a queued call is turned away at its deadline");
+    }
+    held.reset();
+    check(gate("admitted") == 4 && gate("shed") == 3 && gate("queued") == 4,
+          "the gate counts admitted, queued and shed calls");
+
+    Invoke("control.limit", R"({"address":"control.pool","concurrency":1,"queue":0})", "{}");
+    held.emplace("control.pool");
+    std::string shed;
+    std::thread caller([&] { shed = Invoke("control.pool", "{}", "{}"); });
+    caller.join();
+    held.reset();
+    check(shed == R"({"success":false,"error":"overloaded"})", "a dispatch past the limit is shed as overloaded");
+    check(json_bool(Invoke("control.pool", "{}", "{}"), "success", false), "and admitted once the slot is free");
+    Invoke("control.limit", R"({"address":"control.pool","concurrency":0})", "{}");
+    Invoke("control.limit", R"({"address":"test.gate","concurrency":0})", "{}");
+    check(gate("running") == -1, "lifting a limit removes the gate");
+}
+
+// Each address runs on the loop that owns it, and a completion returns to the loop that called
+static void test_reactor_affinity() {
+    section("Reactor calls stay on their cores");
+    check(reactor_start(2) && reactor_running() && !reactor_on_loop(), "two loops start");
+
+    struct landing {
+        std::string address;
+        std::mutex lock;
+        std::vector<std::thread::id> threads;
+        std::atomic<int> done{0};
+        bool on_loop = true;
+    };
+    std::vector<landing> landings(16);
+    for (std::size_t i = 0; i < landings.size(); ++i) landings[i].address = "test.core" + std::to_string(i);
+    CompletionFn land = [](bool, const libsresult*, void* user_data) {
+        auto* at = static_cast<landing*>(user_data);
+        std::lock_guard<std::mutex> guard(at->lock);
+        at->threads.push_back(std::this_thread::get_id());
+        at->on_loop = at->on_loop && reactor_on_loop();
+        ++at->done;
+    };
+    for (int round = 0; round < 4; ++round) {
+        for (auto& at : landings) InvokeAsync(at.address.c_str(), "{}", "{}", land, &at);
+    }
+    auto landed = [&](int calls) {
+        for (int i = 0; i < 2000; ++i) {
+            if (std::all_of(landings.begin(), landings.end(), [&](const landing& at) { return at.done >= calls; })) {
+                return true;
+            }
+            std::this_thread::sleep_for(milliseconds(1));
+        }
+        return false;
+    };
+    check(landed(4), "every call from outside completes");
+
+    bool pinned = true;
+    bool on_loop = true;
+    std::vector<std::thread::id> homes;
+    for (auto& at : landings) {
+        std::lock_guard<std::mutex> guard(at.lock);
+        pinned = pinned && std::all_of(at.threads.begin(), at.threads.end(),
+                                       [&](std::thread::id thread) { return thread == at.threads.front(); });
+        on_loop = on_loop && at.on_loop;
+        if (std::find(homes.begin(), homes.end(), at.threads.front()) == homes.end()) homes.push_back(at.threads.front());
+    }
+    check(pinned && on_loop, "an address's callbacks all run on its own loop");
+    if (homes.size() < 2) {
+        std::cout << "  skip every address hashed to one core" << std::endl;
+        reactor_stop();
+        return;
+    }
+
+    // From a loop, a call to an address another core owns crosses and comes back
+    landing* from = &landings.front();
+    landing* other = nullptr;
+    for (auto& at : landings) {
+        if (at.threads.front() != from->threads.front()) other = &at;
+    }
+    struct hop {
+        landing* to = nullptr;
+        std::atomic<bool> done{false};
+        std::thread::id returned;
+        bool on_loop = false;
+    } crossing;
+    crossing.to = other;
+    auto sent = [] {
+        std::uint64_t total = 0;
+        for (const auto& core : reactor_stats()) total += core.sent;
+        return total;
+    };
+    std::uint64_t before = sent();
+    InvokeAsync(from->address.c_str(), "{}", "{}", [](bool, const libsresult*, void* user_data) {
+        InvokeAsync(static_cast<hop*>(user_data)->to->address.c_str(), "{}", "{}",
+                    [](bool, const libsresult*, void* user_data) {
+                        auto* trip = static_cast<hop*>(user_data);
+                        trip->returned = std::this_thread::get_id();
+                        trip->on_loop = reactor_on_loop();
+                        trip->done = true;
+                    },
+                    user_data);
+    }, &crossing);
+    for (int i = 0; i < 2000 && !crossing.done; ++i) std::this_thread::sleep_for(milliseconds(1));
+    check(crossing.done && crossing.on_loop && crossing.returned == from->threads.front(),
+          "the completion of a call to another core runs back on the caller's loop");
+    check(sent() >= before + 2, "the call and its completion went through the mailboxes");
+    reactor_stop();
+    check(!reactor_running(), "and the loops stop");
+}
+
+// A subscriber whose first delivery waits until it is opened, so the queue behind it fills
+struct gated_subscriber {
+    std::mutex lock;
+    std::condition_variable changed;
+    bool started = false;
+    bool open = false;
+    std::vector<std::string> events;
+
+    static void deliver(const libsevent* events, std::size_t count, void* user_data) {
+        auto* self = static_cast<gated_subscriber*>(user_data);
+        std::unique_lock<std::mutex> guard(self->lock);
+        self->started = true;
+        self->changed.notify_all();
+        self->changed.wait(guard, [&] { return self->open; });
+        for (std::size_t i = 0; i < count; ++i) self->events.emplace_back(events[i].data, events[i].size);
+        self->changed.notify_all();
+    }
+
+    bool wait_started() {
+        std::unique_lock<std::mutex> guard(lock);
+        return changed.wait_for(guard, std::chrono::seconds(2), [&] { return started; });
+    }
+
+    void release() {
+        std::lock_guard<std::mutex> guard(lock);
+        open = true;
+        changed.notify_all();
+    }
+
+    std::vector<std::string> wait_for(std::size_t count) {
+        std::unique_lock<std::mutex> guard(lock);
+        changed.wait_for(guard, std::chrono::seconds(2), [&] { return events.size() >= count; });
+        return events;
+    }
+};
+
+static void publish_numbers(const char* topic, int from, int to) {
+    for (int i = from; i < to; ++i) {
+        std::string event = std::to_string(i);
+        Publish(topic, event.data(), event.size());
+    }
+}
+
+// A full queue either drops its oldest events or holds the publisher until there is room
+static void test_bus_overflow() {
+    section("Bus queues drop the oldest or block when full");
+    auto counters = [](std::uint64_t id) {
+        std::string report = Invoke("control.topics", "{}", "{}");
+        std::string found;
+        auto items = json_find(report, "subscriptions");
+        json_array_each(items ? *items : "", [&](std::string_view item) {
+            if (json_int(item, "id", 0) == (long long)id) found = item;
+        });
+        return found;
+    };
+
+    gated_subscriber dropping;
+    std::uint64_t drop_id = Subscribe("test.drop", 4, LIBS_DROP_OLDEST, gated_subscriber::deliver, &dropping);
+    publish_numbers("test.drop", 0, 1);
+    check(dropping.wait_started(), "the first event is being delivered");
+    publish_numbers("test.drop", 1, 11);
+    dropping.release();
+    check(dropping.wait_for(5) == std::vector<std::string>{"0", "7", "8", "9", "10"},
+          "the four newest events behind it survive, in order");
+    check(json_int(counters(drop_id), "dropped", 0) == 6, "the six oldest are counted as dropped");
+    Unsubscribe(drop_id);
+
+    gated_subscriber blocking;
+    std::uint64_t block_id = Subscribe("test.block", 2, LIBS_BLOCK, gated_subscriber::deliver, &blocking);
+    publish_numbers("test.block", 0, 1);
+    check(blocking.wait_started(), "the first event is being delivered");
+    publish_numbers("test.block", 1, 3);
+    {
+        call_scope scope(R"({"deadline_ms":20})");
+        auto start = test_clock::now();
+        check(Publish("test.block", "late", 4) == 0 && since(start) >= 20,
+              "a publisher waits for room until its deadline, then drops the event");
+    }
+    std::atomic<bool> published{false};
+    std::thread publisher([&] {
+        publish_numbers("test.block", 3, 5);
+        published = true;
+    });
+    std::this_thread::sleep_for(milliseconds(30));
+    check(!published, "without a deadline it waits");
+    blocking.release();
+    publisher.join();
+    check(blocking.wait_for(5) == std::vector<std::string>{"0", "1", "2", "3", "4"},
+          "until the subscriber makes room, and nothing after it is lost");
+    std::string blocked = counters(block_id);
+    check(json_int(blocked, "dropped", 0) == 1 && json_int(blocked, "waits", 0) >= 2,
+          "only the event past its deadline is dropped");
+    Unsubscribe(block_id);
+    check(counters(block_id).empty(), "unsubscribing removes the queue");
+}
+
+// Each call is charged what its library allocated during it, less what nested calls took
+static void test_memstats_deltas() {
+    section("Heap deltas are charged to the calls that allocate");
+    auto charged = [](std::string_view address) {
+        std::string report = Invoke("control.memstats", "{}", "{}");
+        auto dispatch = json_find(report, "dispatch");
+        return find_entry(dispatch ? *dispatch : "", "addresses", "address", address);
+    };
+    auto allocate = [] {
+        call_probe outer(MemStats, "test.heap", "test");
+        std::vector<char> block(1 << 20);
+        call_probe inner(MemStats, "test.inner", "test");
+        std::vector<char> small(4096);
+    };
+    Invoke("control.stats", R"({"reset":true})", "{}");
+    allocate();
+    check(charged("test.heap").empty(), "nothing is charged while heap accounting is off");
+
+    // What AttachEx's {"memstats":true} turns on; the first round creates the counters
+    stats_enable_heap(true);
+    allocate();
+    Invoke("control.stats", R"({"reset":true})", "{}");
+    allocate();
+    std::string outer = charged("test.heap");
+    std::string inner = charged("test.inner");
+    // Each allocation is counted with the allocator's small header
+    auto about = [](std::string_view entry, long long bytes) {
+        long long allocated = json_int(entry, "allocated", 0);
+        return allocated >= bytes && allocated < bytes + 64 && json_int(entry, "allocations", 0) == 1;
+    };
+    check(about(outer, 1 << 20), "the outer call is charged its own megabyte");
+    check(about(inner, 4096), "and the nested one its 4096 bytes, not counted twice");
+
+    if (Resolve("efs.read")) {
+        const char* request = R"({"path":"desk/lin/activities.png"})";
+        for (int i = 0; i < 10; ++i) Invoke("efs.read", request, "{}");
+        std::string read = charged("efs.read");
+        check(json_int(read, "calls", 0) == 10 && json_int(read, "bytes_per_call", 0) > 27000,
+              "a plugin's calls are charged what its own allocator counted");
+        std::string report = Invoke("control.memstats", "{}", "{}");
+        check(json_bool(find_entry(report, "plugins", "plugin", "libefs.so"), "tracked", false),
+              "and the plugin reports its heap");
+    }
+    stats_enable_heap(false);
+    Invoke("control.stats", R"({"reset":true})", "{}");
+}
+
+// A call past its budget is flagged and published, and with the cancel action stopped
+static void test_watchdog_cancel() {
+    section("Watchdog flags overruns and cancels");
+    struct overruns {
+        std::mutex lock;
+        std::vector<std::string> events;
+    } seen;
+    std::uint64_t subscription = Subscribe("control.overrun", 0, LIBS_DROP_OLDEST,
+                                           [](const libsevent* events, std::size_t count, void* user_data) {
+                                               auto* into = static_cast<overruns*>(user_data);
+                                               std::lock_guard<std::mutex> guard(into->lock);
+                                               for (std::size_t i = 0; i < count; ++i) {
+                                                   into->events.emplace_back(events[i].data, events[i].size);
+                                               }
+                                           },
+                                           &seen);
+    auto report = [] {
+        std::string reply = Invoke("control.watchdog", "{}", "{}");
+        return std::string(json_find(reply, "watchdog").value_or("{}"));
+    };
+    long long flagged = json_int(report(), "flagged", 0);
+    long long cancelled = json_int(report(), "cancelled", 0);
+    auto stop_when_cancelled = [] {
+        auto start = test_clock::now();
+        while (!Cancelled() && since(start) < 2000) std::this_thread::sleep_for(milliseconds(1));
+        return since(start);
+    };
+
+    {
+        watch_ticket unwatched("test.slow");
+        check(!watchdog_watching(), "an address without a budget isn't watched");
+    }
+    Invoke("control.watchdog", R"({"address":"test.slow","wall_ms":20,"action":"cancel"})", "{}");
+    Invoke("control.watchdog", R"({"address":"test.flag","wall_ms":20})", "{}");
+    Invoke("control.watchdog", R"({"address":"test.spin","cpu_ms":20,"action":"cancel"})", "{}");
+    {
+        auto start = stats_clock::now();
+        watch_ticket watch("test.slow");
+        check(watchdog_watching(), "one with a budget is");
+        long long took = stop_when_cancelled();
+        check(Cancelled() && took >= 20 && took < 20 + kSlack.count(),
+              "the call is cancelled " + std::to_string(took) + " ms in, past its 20 ms wall budget");
+        stats_record("test.slow", "test", true, true, 0, 0, start);
+    }
+    check(!Cancelled() && !watchdog_watching(), "the cancellation ends with the call");
+    {
+        watch_ticket watch("test.flag");
+        std::this_thread::sleep_for(milliseconds(20) + kSlack);
+        check(!Cancelled(), "an overrun without the cancel action goes on");
+    }
+    {
+        watch_ticket watch("test.spin");
+        auto start = test_clock::now();
+        volatile std::uint64_t spins = 0;
+        while (!Cancelled() && since(start) < 2000) spins = spins + 1;
+        check(Cancelled(), "spinning past the CPU budget cancels it " + std::to_string(since(start)) + " ms in");
+    }
+
+    std::string after = report();
+    check(json_int(after, "flagged", 0) == flagged + 3 && json_int(after, "cancelled", 0) == cancelled + 2,
+          "three overruns flagged, two of them cancelled");
+    std::string spin = find_entry(after, "recent", "address", "test.spin");
+    check(json_text(json_find(spin, "over").value_or("\"\"")) == "cpu", "the spinning call went over on CPU");
+    check(json_int(find_entry(Invoke("control.stats", "{}", "{}"), "addresses", "address", "test.slow"), "overruns",
+                   0) == 1,
+          "overruns are counted against the address");
+    for (int i = 0; i < 500; ++i) {
+        {
+            std::lock_guard<std::mutex> guard(seen.lock);
+            if (seen.events.size() >= 3) break;
+        }
+        std::this_thread::sleep_for(milliseconds(1));
+    }
+    Unsubscribe(subscription);
+    check(seen.events.size() == 3 && json_bool(seen.events[0], "cancelled", false) &&
+              json_text(json_find(seen.events[1], "address").value_or("\"\"")) == "test.flag",
+          "each is published on control.overrun as it is found");
+
+    for (const char* address : {"test.slow", "test.flag", "test.spin"}) {
+        Invoke("control.watchdog", (R"({"address":")" + std::string(address) + R"(","wall_ms":0})").c_str(), "{}");
+    }
+    check(json_find(report(), "budgets").value_or("") == "[]", "lifting the budgets leaves none");
+}
+
+// Results come back in the order the calls were given, whichever worker ran each
+static void test_batch_order() {
+    section("Batch results keep their call order");
+    const std::vector<std::string> targets = {"control.pool", "control.stats", "control.list", "control.topics",
+                                              "control.cache", "control.limit", "control.trace", "control.watchdog"};
+    std::string calls = "[";
+    std::vector<std::string> expected;
+    for (int round = 0; round < 4; ++round) {
+        for (const auto& target : targets) {
+            if (calls.size() > 1) calls += ",";
+            calls += R"({"address":"control.resolve","payload":")" + target + R"("})";
+            expected.push_back(target);
+        }
+    }
+    calls += R"(,{"address":"control.nothing"}])";
+    expected.push_back({});
+
+    for (const char* options : {R"({"parallel":true})", R"({"parallel":false})"}) {
+        std::string reply = Invoke("control.batch", calls.c_str(), options);
+        check(json_int(reply, "count", 0) == long(expected.size()), std::string(options) + " runs every call");
+        std::size_t index = 0;
+        bool ordered = true;
+        bool handled = true;
+        auto results = json_find(reply, "results");
+        json_array_each(results ? *results : "", [&](std::string_view entry) {
+            bool routed = index < expected.size() && !expected[index].empty();
+            auto result = json_find(entry, "result");
+            std::string address = result ? json_text(json_find(*result, "address").value_or("\"\"")) : "";
+            ordered = ordered && index < expected.size() && address == expected[index];
+            handled = handled && json_bool(entry, "handled", !routed) == routed;
+            ++index;
+        });
+        check(index == expected.size() && ordered, "each result sits where its call was");
+        check(handled, "and only the unrouted call is unhandled");
+    }
+    std::string reply = Invoke("control.batch", R"({"calls":"none"})", "{}");
+    check(!json_bool(reply, "success", true), "a payload without an array of calls is refused");
+}
+
+// A binary file crosses InvokeBytes whole, zero bytes and all, and again from the cache
+static void test_bytes_with_zeros() {
+    section("InvokeBytes carries embedded zero bytes");
+    if (!Resolve("efs.read_one")) {
+        std::cout << "  skip no efs plugin in this directory" << std::endl;
+        return;
+    }
+    const std::string request = R"({"path":"desk/lin/activities.png"})";
+    const std::string signature("\x89PNG\r\n\x1a\n\0\0\0\x0dIHDR", 16);
+    std::string first;
+    for (int round = 0; round < 2; ++round) {
+        std::uint64_t hits = cache_stats().hits;
+        libsresult out = {};
+        bool handled = InvokeBytes("efs.read_one", request.data(), request.size(), "{}", &out);
+        std::string image(out.data ? out.data : "", out.size);
+        Release(&out);
+        const char* when = round == 0 ? "from the plugin" : "from the cache";
+        check(handled && image.compare(0, signature.size(), signature) == 0,
+              std::string("the image starts with its signature ") + when);
+        check(image.size() > std::strlen(image.c_str()), std::to_string(image.size()) + " bytes past the first zero " +
+                                                             when);
+        if (round == 0) {
+            first = image;
+        } else {
+            check(cache_stats().hits > hits, "the second read is a cache hit");
+            check(image == first, "both reads return the same bytes");
+        }
+    }
+    std::string truncated = Invoke("efs.read_one", request.c_str(), "{}");
+    check(truncated.size() < first.size(), "the C string entry point stops at the first zero");
+}
+
+// What a plugin gets from control: its own exports, as the registry hands them over
+static libshost test_host() {
+    libshost host = {};
+    host.size = sizeof(host);
+    host.dispatch = Invoke;
+    host.dispatch2 = Invoke2;
+    host.release = Release;
+    host.dispatch_async = InvokeAsync;
+    return host;
+}
+
+// A coroutine handler as InvokeDeferred starts it: it gives the thread back at each
+// dispatch_async and its callback runs once, from whichever thread resumes it last
+static void test_coroutine_completion() {
+    section("Coroutine handlers complete through their callback");
+    static const libshost host = test_host();
+    handler_def chain = {
+        .sid = "test.chain",
+        .tag = "test",
+        .co = [](std::string payload, std::string /* options */) -> task<std::string> {
+            if (payload == "throw") throw std::runtime_error("thrown");
+            std::thread::id started = std::this_thread::get_id();
+            dispatch_result first = co_await dispatch_async(&host, "control.pool", "{}");
+            dispatch_result second = co_await dispatch_async(&host, "control.nothing", "{}");
+            co_return std::string(first.handled && first.response.find(R"("success":true)") != std::string::npos &&
+                                          !second.handled
+                                      ? "ok"
+                                      : "bad") +
+                (std::this_thread::get_id() != started ? " moved" : "");
+        },
+    };
+
+    struct tally {
+        std::mutex lock;
+        int calls = 0;
+        int ok = 0;
+        int moved = 0;
+    } seen;
+    CompletionFn count = [](bool handled, const libsresult* result, void* user_data) {
+        auto* into = static_cast<tally*>(user_data);
+        std::string response(result->data, result->size);
+        std::lock_guard<std::mutex> guard(into->lock);
+        ++into->calls;
+        if (handled && response.rfind("ok", 0) == 0) ++into->ok;
+        if (response.find("moved") != std::string::npos) ++into->moved;
+    };
+    constexpr int kCalls = 64;
+    for (int i = 0; i < kCalls; ++i) handler_spawn(chain, "x", 1, "{}", count, &seen);
+    for (int i = 0; i < 500; ++i) {
+        {
+            std::lock_guard<std::mutex> guard(seen.lock);
+            if (seen.calls >= kCalls) break;
+        }
+        std::this_thread::sleep_for(milliseconds(10));
+    }
+    std::this_thread::sleep_for(milliseconds(20));
+    std::lock_guard<std::mutex> guard(seen.lock);
+    check(seen.calls == kCalls, std::to_string(seen.calls) + " of " + std::to_string(kCalls) + " callbacks ran");
+    check(seen.ok == kCalls, "each saw both nested results");
+    check(seen.moved > 0, std::to_string(seen.moved) + " resumed on a pool thread");
+
+    check(sync_wait(chain.co("x", "")) == "ok", "sync_wait runs the nested calls inline");
+    std::string thrown;
+    handler_spawn(chain, "throw", 5, "{}", [](bool, const libsresult* result, void* user_data) {
+        static_cast<std::string*>(user_data)->assign(result->data, result->size);
+    }, &thrown);
+    check(thrown == R"({"success":false,"error":"thrown"})", "a throw becomes an error response");
+}
+
+int main() {
+    std::cout << "=== TESTING CONTROL ===" << std::endl;
+
+    timer_open();
+    auto opened = test_clock::now();
+
+    // Started first and checked last: crosses from the second level into the third
+    probe_timer far;
+    schedule(far, 16400);
+
+    test_wheel_boundaries(opened);
+    test_period_catch_up();
+    test_cancel();
+    test_cache_eviction();
+    test_cache_invalidate_race();
+    test_surrogate_pairs();
+
+    test_far_timer(far);
+    timer_shutdown();
+
+    // Attach opens the timer again, and Detach closes it
+    test_handles_across_reloads();
+
+    // The rest run against an attached control
+    char err[256] = {0};
+    Attach(Invoke, err, sizeof(err));
+    Invoke("control.run", "{}", "{}");
+    test_batch_order();
+    test_stats_counters();
+    test_trace_spans();
+    test_deadline_and_abort();
+    test_admission();
+    test_reactor_affinity();
+    test_bus_overflow();
+    test_memstats_deltas();
+    test_watchdog_cancel();
+    test_bytes_with_zeros();
+    test_coroutine_completion();
+    Detach(err, sizeof(err));
+
+    std::cout << "\n" << (g_failures ? std::to_string(g_failures) + " FAILED" : std::string("ALL PASSED")) << std::endl;
+    return g_failures ? 1 : 0;
+}
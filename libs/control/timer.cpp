@@ -0,0 +1,293 @@
+#include "timer.h"
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <condition_variable>
+#include <iostream>
+#include <limits>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using tick = std::uint64_t;
+
+constexpr auto kTick = std::chrono::milliseconds(1);
+constexpr unsigned kRootBits = 8;   // level 0: 256 slots of one tick
+constexpr unsigned kLevelBits = 6;  // levels above: 64 slots, each a whole lap of the level below
+constexpr unsigned kLevels = 5;
+constexpr std::size_t kRootSlots = std::size_t(1) << kRootBits;
+constexpr std::size_t kLevelSlots = std::size_t(1) << kLevelBits;
+constexpr std::uint32_t kNone = std::numeric_limits<std::uint32_t>::max();
+constexpr tick kNever = std::numeric_limits<tick>::max();
+
+constexpr unsigned shift_of(unsigned level) {
+    return level == 0 ? 0 : kRootBits + kLevelBits * (level - 1);
+}
+
+// Ticks ahead that a level can hold
+constexpr tick reach_of(unsigned level) {
+    return tick(1) << (level == 0 ? kRootBits : kRootBits + kLevelBits * level);
+}
+
+// Slab entry; timers link into their slot by index, so a cancel unlinks in O(1)
+struct timer_node {
+    std::uint32_t prev = kNone;
+    std::uint32_t next = kNone;
+    std::uint32_t generation = 1;  // bumped on reuse, so stale ids don't match
+    bool armed = false;
+    std::uint8_t level = 0;
+    std::uint16_t slot = 0;
+    tick due = 0;
+    tick period = 0;
+    timer_fire fire;
+};
+
+struct wheel_level {
+    std::vector<std::uint32_t> heads;
+    std::array<std::uint64_t, kRootSlots / 64> occupied = {};  // bit per nonempty slot
+
+    void mark(std::size_t slot, bool set) {
+        std::uint64_t bit = std::uint64_t(1) << (slot % 64);
+        if (set) {
+            occupied[slot / 64] |= bit;
+        } else {
+            occupied[slot / 64] &= ~bit;
+        }
+    }
+};
+
+std::mutex g_lock;
+std::condition_variable g_wake;
+bool g_open = false;
+bool g_stopping = false;
+std::thread g_thread;
+
+std::chrono::steady_clock::time_point g_epoch;
+tick g_current = 0;        // last tick processed
+tick g_planned = kNever;   // tick the thread sleeps until
+std::array<wheel_level, kLevels> g_levels;
+std::vector<timer_node> g_nodes;
+std::vector<std::uint32_t> g_free;
+timer_counters g_counters;
+
+// Everything below runs under g_lock
+
+tick now_tick() {
+    return tick((std::chrono::steady_clock::now() - g_epoch) / kTick);
+}
+
+void link(std::uint32_t index) {
+    timer_node& node = g_nodes[index];
+    tick delta = node.due - g_current;
+    unsigned level = 0;
+    while (level + 1 < kLevels && delta >= reach_of(level)) ++level;
+
+    // Beyond the top level's reach: park in its furthest slot and look again from there
+    tick position = delta < reach_of(level) ? node.due : g_current + reach_of(level) - (tick(1) << shift_of(level));
+    std::size_t slots = level == 0 ? kRootSlots : kLevelSlots;
+    std::size_t slot = std::size_t(position >> shift_of(level)) & (slots - 1);
+
+    wheel_level& target = g_levels[level];
+    node.level = std::uint8_t(level);
+    node.slot = std::uint16_t(slot);
+    node.prev = kNone;
+    node.next = target.heads[slot];
+    if (node.next != kNone) g_nodes[node.next].prev = index;
+    target.heads[slot] = index;
+    target.mark(slot, true);
+}
+
+void unlink(std::uint32_t index) {
+    timer_node& node = g_nodes[index];
+    wheel_level& level = g_levels[node.level];
+    if (node.prev != kNone) {
+        g_nodes[node.prev].next = node.next;
+    } else {
+        level.heads[node.slot] = node.next;
+    }
+    if (node.next != kNone) g_nodes[node.next].prev = node.prev;
+    if (level.heads[node.slot] == kNone) level.mark(node.slot, false);
+    node.prev = node.next = kNone;
+}
+
+void release(std::uint32_t index) {
+    timer_node& node = g_nodes[index];
+    node.armed = false;
+    node.fire.reset();
+    ++node.generation;
+    g_free.push_back(index);
+    --g_counters.active;
+}
+
+// Takes the whole list out of a slot
+std::uint32_t take_slot(unsigned level, std::size_t slot) {
+    wheel_level& from = g_levels[level];
+    std::uint32_t head = from.heads[slot];
+    from.heads[slot] = kNone;
+    from.mark(slot, false);
+    return head;
+}
+
+// The next tick with something to do: an occupied root slot before the root wraps, or
+// the wrap itself, where the levels above cascade
+tick next_event() {
+    if (g_counters.active == 0) return kNever;
+    tick wrap = (g_current | (kRootSlots - 1)) + 1;
+    std::size_t from = std::size_t(g_current & (kRootSlots - 1)) + 1;
+    const wheel_level& root = g_levels[0];
+    for (std::size_t word = from / 64; word < root.occupied.size(); ++word) {
+        std::uint64_t bits = root.occupied[word];
+        if (word == from / 64) bits &= ~std::uint64_t(0) << (from % 64);
+        if (bits) {
+            std::size_t slot = word * 64 + std::size_t(std::countr_zero(bits));
+            return (g_current & ~tick(kRootSlots - 1)) + slot;
+        }
+    }
+    return wrap;
+}
+
+// Advances to now, which must be next_event(), and collects what fires. actual is the
+// current tick, later than now when the thread fell behind; periodic timers move past it.
+void process(tick now, tick actual, std::vector<timer_fire>& due) {
+    g_current = now;
+
+    if ((now & (kRootSlots - 1)) == 0) {
+        for (unsigned level = 1; level < kLevels; ++level) {
+            std::size_t slot = std::size_t(now >> shift_of(level)) & (kLevelSlots - 1);
+            for (std::uint32_t index = take_slot(level, slot); index != kNone;) {
+                std::uint32_t next = g_nodes[index].next;
+                link(index);
+                ++g_counters.cascaded;
+                index = next;
+            }
+            if (slot != 0) break;
+        }
+    }
+
+    std::size_t slot = std::size_t(now & (kRootSlots - 1));
+    for (std::uint32_t index = take_slot(0, slot); index != kNone;) {
+        timer_node& node = g_nodes[index];
+        std::uint32_t next = node.next;
+        if (node.due > now) {
+            link(index);  // came down early from a parked slot
+        } else {
+            due.push_back(node.fire);
+            ++g_counters.fired;
+            if (node.period) {
+                node.due += node.period;
+                if (node.due <= actual) node.due += node.period * ((actual - node.due) / node.period + 1);
+                link(index);
+            } else {
+                release(index);
+            }
+        }
+        index = next;
+    }
+}
+
+void timer_loop() {
+    std::vector<timer_fire> due;
+    std::unique_lock<std::mutex> lock(g_lock);
+    while (!g_stopping) {
+        tick next = next_event();
+        if (next == kNever) {
+            g_planned = kNever;
+            g_wake.wait(lock);
+            continue;
+        }
+        if (now_tick() < next) {
+            g_planned = next;
+            g_wake.wait_until(lock, g_epoch + next * kTick);
+            continue;  // woken early by an earlier timer, or on time; look again either way
+        }
+
+        process(next, now_tick(), due);
+        lock.unlock();
+        for (const auto& fire : due) (*fire)();
+        due.clear();
+        lock.lock();
+    }
+}
+
+}
+
+timer_id timer_schedule(std::chrono::milliseconds delay, std::chrono::milliseconds period, timer_fire fire) {
+    if (!fire) return 0;
+    std::unique_lock<std::mutex> lock(g_lock);
+    if (!g_open) return 0;
+    if (!g_thread.joinable()) {
+        g_thread = std::thread(timer_loop);
+        std::cout << "CONTROL: Started timer thread" << std::endl;
+    }
+
+    std::uint32_t index;
+    if (g_free.empty()) {
+        index = std::uint32_t(g_nodes.size());
+        g_nodes.emplace_back();
+    } else {
+        index = g_free.back();
+        g_free.pop_back();
+    }
+    timer_node& node = g_nodes[index];
+    node.armed = true;
+    // now_tick() rounds down, so one more tick keeps the timer from firing early
+    node.due = std::max(now_tick() + tick(std::max<std::int64_t>(delay / kTick, 0)) + 1, g_current + 1);
+    node.period = tick(std::max<std::int64_t>(period / kTick, 0));
+    node.fire = std::move(fire);
+    link(index);
+    ++g_counters.active;
+    ++g_counters.scheduled;
+
+    if (node.due < g_planned) g_wake.notify_one();
+    return (timer_id(node.generation) << 32) | index;
+}
+
+bool timer_cancel(timer_id id) {
+    std::uint32_t index = std::uint32_t(id);
+    std::uint32_t generation = std::uint32_t(id >> 32);
+    std::lock_guard<std::mutex> lock(g_lock);
+    if (index >= g_nodes.size()) return false;
+    timer_node& node = g_nodes[index];
+    if (!node.armed || node.generation != generation) return false;
+    unlink(index);
+    release(index);
+    ++g_counters.cancelled;
+    return true;
+}
+
+timer_counters timer_stats() {
+    std::lock_guard<std::mutex> lock(g_lock);
+    return g_counters;
+}
+
+void timer_open() {
+    std::lock_guard<std::mutex> lock(g_lock);
+    if (g_open) return;
+    g_open = true;
+    g_stopping = false;
+    g_epoch = std::chrono::steady_clock::now();
+    g_current = 0;
+    g_planned = kNever;
+    g_levels[0].heads.assign(kRootSlots, kNone);
+    for (unsigned level = 1; level < kLevels; ++level) g_levels[level].heads.assign(kLevelSlots, kNone);
+    for (auto& level : g_levels) level.occupied = {};
+}
+
+void timer_shutdown() {
+    std::thread finished;
+    {
+        std::lock_guard<std::mutex> lock(g_lock);
+        g_open = false;
+        g_stopping = true;
+        finished = std::move(g_thread);
+        g_wake.notify_all();
+    }
+    if (finished.joinable()) finished.join();
+
+    std::lock_guard<std::mutex> lock(g_lock);
+    g_nodes.clear();
+    g_free.clear();
+    g_counters.active = 0;
+}
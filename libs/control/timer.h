@@ -0,0 +1,43 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+
+// Delayed and periodic work for all of control on one thread. Timers sit in a
+// hierarchical wheel of 1 ms ticks: 256 slots for the next quarter second, then four
+// levels of 64 slots, each covering 64 times the span of the one below, to about 49
+// days; later ones wait at the top and move down as they come closer. Inserting and
+// cancelling are O(1), and each timer moves down at most once per level on its way to
+// expiry. The thread sleeps until the next occupied slot or the next cascade, and not at
+// all while there are no timers.
+//
+// fire runs on the timer thread, so it must return quickly: anything longer than a look
+// at some shared state goes to an executor (the pool, or InvokeAsync).
+
+using timer_id = std::uint64_t;
+using timer_fire = std::shared_ptr<const std::function<void()>>;
+
+// Fires after delay and then every period, if period is nonzero; a periodic timer keeps
+// to its schedule and skips the ticks it fell behind on rather than firing them late.
+// Returns 0 once control is detached.
+timer_id timer_schedule(std::chrono::milliseconds delay, std::chrono::milliseconds period, timer_fire fire);
+
+// False when id already fired (for one-shot timers), was cancelled or never existed
+bool timer_cancel(timer_id id);
+
+struct timer_counters {
+    std::size_t active = 0;
+    std::uint64_t scheduled = 0;
+    std::uint64_t fired = 0;
+    std::uint64_t cancelled = 0;
+    std::uint64_t cascaded = 0;  // moves from a coarser level to a finer one
+};
+timer_counters timer_stats();
+
+// Opens the service; timers are accepted until timer_shutdown, which drops every timer
+// and joins the thread. Attach and Detach call them.
+void timer_open();
+void timer_shutdown();
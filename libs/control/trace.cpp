@@ -0,0 +1,219 @@
+#include "trace.h"
+#include "json.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <vector>
+
+namespace {
+
+// Addresses longer than this are cut in the trace
+constexpr std::size_t kAddressCap = 48;
+
+struct trace_event {
+    std::uint64_t span;
+    std::uint64_t parent;
+    std::int64_t start_ns;
+    std::int64_t duration_ns;
+    std::uint64_t bytes_in;
+    std::uint64_t bytes_out;
+    char address[kAddressCap];
+};
+
+// Written only by its thread. count is published after each event is complete, so the
+// writer at stop reads every event below it and nothing that is still being filled.
+struct trace_buffer {
+    std::uint64_t session = 0;
+    std::uint32_t tid = 0;
+    std::vector<trace_event> events;
+    std::atomic<std::size_t> count{0};
+    std::atomic<std::size_t> dropped{0};
+};
+
+using trace_clock = std::chrono::steady_clock;
+
+std::atomic<bool> g_active{false};
+std::atomic<std::uint64_t> g_session{0};
+std::atomic<std::uint32_t> g_next_tid{1};
+
+// Session state; only start, stop and a thread's first span in a session take the lock
+std::mutex g_lock;
+std::string g_path;
+std::size_t g_capacity = 0;
+trace_clock::time_point g_epoch;
+std::vector<std::shared_ptr<trace_buffer>> g_buffers;
+
+thread_local std::uint64_t t_current = 0;
+thread_local std::uint64_t t_next_span = 0;
+thread_local std::shared_ptr<trace_buffer> t_buffer;
+
+std::uint32_t thread_tid() {
+    thread_local std::uint32_t tid = g_next_tid.fetch_add(1, std::memory_order_relaxed);
+    return tid;
+}
+
+// Span ids are unique without a shared counter: thread id above, per-thread sequence below
+std::uint64_t next_span_id() {
+    return (std::uint64_t(thread_tid()) << 40) | ++t_next_span;
+}
+
+std::int64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(trace_clock::now() - g_epoch).count();
+}
+
+trace_buffer* local_buffer(std::uint64_t session) {
+    if (t_buffer && t_buffer->session == session) return t_buffer.get();
+
+    std::lock_guard<std::mutex> lock(g_lock);
+    if (session != g_session.load(std::memory_order_relaxed) || !g_active.load(std::memory_order_relaxed)) {
+        return nullptr;
+    }
+    auto buffer = std::make_shared<trace_buffer>();
+    buffer->session = session;
+    buffer->tid = thread_tid();
+    buffer->events.resize(g_capacity);
+    g_buffers.push_back(buffer);
+    t_buffer = std::move(buffer);
+    return t_buffer.get();
+}
+
+std::string micros(std::int64_t ns) {
+    std::ostringstream out;
+    out << ns / 1000 << '.' << std::setw(3) << std::setfill('0') << (ns % 1000 + 1000) % 1000;
+    return out.str();
+}
+
+}
+
+bool trace_start(const std::string& path, std::size_t capacity, std::string& err) {
+    std::lock_guard<std::mutex> lock(g_lock);
+    if (g_active.load(std::memory_order_relaxed)) {
+        err = "a trace is already running";
+        return false;
+    }
+    if (path.empty() || capacity == 0) {
+        err = "trace needs a path and a capacity";
+        return false;
+    }
+    g_path = path;
+    g_capacity = capacity;
+    g_epoch = trace_clock::now();
+    g_buffers.clear();
+    g_session.fetch_add(1, std::memory_order_relaxed);
+    g_active.store(true, std::memory_order_release);
+    return true;
+}
+
+bool trace_stop(trace_summary& summary, std::string& err) {
+    std::vector<std::shared_ptr<trace_buffer>> buffers;
+    {
+        std::lock_guard<std::mutex> lock(g_lock);
+        if (!g_active.load(std::memory_order_relaxed)) {
+            err = "no trace is running";
+            return false;
+        }
+        g_active.store(false, std::memory_order_release);
+        buffers = std::move(g_buffers);
+        g_buffers.clear();
+        summary.path = g_path;
+    }
+
+    std::ostringstream out;
+    out << R"({"displayTimeUnit":"ns","traceEvents":[)";
+    bool first = true;
+    for (const auto& buffer : buffers) {
+        if (!first) out << ',';
+        first = false;
+        out << R"({"name":"thread_name","ph":"M","pid":1,"tid":)" << buffer->tid
+            << R"(,"args":{"name":"thread )" << buffer->tid << R"("}})";
+
+        std::size_t count = std::min(buffer->count.load(std::memory_order_acquire), buffer->events.size());
+        for (std::size_t i = 0; i < count; ++i) {
+            const trace_event& event = buffer->events[i];
+            out << R"(,{"name":")" << json_escape(event.address) << R"(","cat":"dispatch","ph":"X","ts":)"
+                << micros(event.start_ns) << R"(,"dur":)" << micros(event.duration_ns) << R"(,"pid":1,"tid":)"
+                << buffer->tid << R"(,"args":{"span":)" << event.span << R"(,"parent":)" << event.parent
+                << R"(,"bytes_in":)" << event.bytes_in << R"(,"bytes_out":)" << event.bytes_out << "}}";
+        }
+        summary.spans += count;
+        summary.dropped += buffer->dropped.load(std::memory_order_relaxed);
+    }
+    out << "]}";
+
+    std::ofstream file(summary.path, std::ios::binary | std::ios::trunc);
+    file << out.str();
+    if (!file) {
+        err = "cannot write " + summary.path;
+        return false;
+    }
+    return true;
+}
+
+bool trace_active() {
+    return g_active.load(std::memory_order_relaxed);
+}
+
+trace_open trace_begin() {
+    trace_open span;
+    span.parent = t_current;
+    if (!g_active.load(std::memory_order_acquire)) return span;
+    span.session = g_session.load(std::memory_order_relaxed);
+    span.id = next_span_id();
+    span.start_ns = now_ns();
+    return span;
+}
+
+void trace_end(const trace_open& span, std::string_view address, std::size_t bytes_in, std::size_t bytes_out) {
+    if (!span.id) return;
+
+    // A span that outlived its session would land in the next one with the wrong clock
+    if (!g_active.load(std::memory_order_acquire) || g_session.load(std::memory_order_relaxed) != span.session) return;
+    trace_buffer* buffer = local_buffer(span.session);
+    if (!buffer) return;
+
+    std::size_t index = buffer->count.load(std::memory_order_relaxed);
+    if (index >= buffer->events.size()) {
+        buffer->dropped.store(buffer->dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        return;
+    }
+    trace_event& event = buffer->events[index];
+    event.span = span.id;
+    event.parent = span.parent;
+    event.start_ns = span.start_ns;
+    event.duration_ns = now_ns() - span.start_ns;
+    event.bytes_in = bytes_in;
+    event.bytes_out = bytes_out;
+    std::size_t length = std::min(address.size(), kAddressCap - 1);
+    std::memcpy(event.address, address.data(), length);
+    event.address[length] = '\0';
+    buffer->count.store(index + 1, std::memory_order_release);
+}
+
+trace_span::trace_span(std::string_view address, std::size_t bytes_in, const std::string& response)
+    : response_(response), address_(address), bytes_in_(bytes_in), open_(trace_begin()) {
+    if (open_.id) t_current = open_.id;
+}
+
+trace_span::~trace_span() {
+    if (!open_.id) return;
+    t_current = open_.parent;
+    trace_end(open_, address_, bytes_in_, response_.size());
+}
+
+std::uint64_t trace_current() {
+    return t_current;
+}
+
+trace_parent::trace_parent(std::uint64_t span) : saved_(t_current) {
+    t_current = span;
+}
+
+trace_parent::~trace_parent() {
+    t_current = saved_;
+}
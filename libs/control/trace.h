@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// Opt-in dispatch tracing. While a session runs, every dispatch becomes a span with its
+// thread, address, parent span and payload sizes, written to a fixed per-thread buffer
+// with no locks; stopping the session writes all buffers out as Chrome trace-event JSON,
+// which chrome://tracing and Perfetto open directly. A thread whose buffer fills drops
+// further spans and the count is reported.
+
+// Spans per thread when the caller doesn't say; about 6 MB per traced thread
+constexpr std::size_t kTraceCapacity = 65536;
+
+// Starts a session that will be written to path. capacity is spans per thread.
+bool trace_start(const std::string& path, std::size_t capacity, std::string& err);
+
+// Ends the session and writes the file
+struct trace_summary {
+    std::string path;
+    std::size_t spans = 0;
+    std::size_t dropped = 0;
+};
+bool trace_stop(trace_summary& summary, std::string& err);
+
+bool trace_active();
+
+// A span that closes away from where it opened, such as a call a plugin completes later on
+// another thread. Opening it doesn't make it this thread's current span; a trace_parent
+// with current() does, for the work that should hang off it.
+struct trace_open {
+    std::uint64_t id = 0;      // 0 when no session was running at the start
+    std::uint64_t session = 0;
+    std::uint64_t parent = 0;  // the span current where it opened
+    std::int64_t start_ns = 0;
+
+    // What work inside the span takes as its parent: the span, or its own parent untraced
+    std::uint64_t current() const { return id ? id : parent; }
+};
+
+trace_open trace_begin();
+
+// Records the span, from any thread; nothing if its session has ended
+void trace_end(const trace_open& span, std::string_view address, std::size_t bytes_in, std::size_t bytes_out);
+
+// One dispatch. Spans opened on a thread while another is open there become its children.
+// response is read when the span closes, for the size of what was returned.
+class trace_span {
+public:
+    trace_span(std::string_view address, std::size_t bytes_in, const std::string& response);
+    ~trace_span();
+    trace_span(const trace_span&) = delete;
+    trace_span& operator=(const trace_span&) = delete;
+
+private:
+    const std::string& response_;
+    std::string_view address_;
+    std::size_t bytes_in_;
+    trace_open open_;
+};
+
+// The innermost open span on this thread, 0 if none. Work handed to another thread takes
+// it along in a trace_parent so its spans still hang off the caller's.
+std::uint64_t trace_current();
+
+class trace_parent {
+public:
+    explicit trace_parent(std::uint64_t span);
+    ~trace_parent();
+    trace_parent(const trace_parent&) = delete;
+    trace_parent& operator=(const trace_parent&) = delete;
+
+private:
+    std::uint64_t saved_;
+};
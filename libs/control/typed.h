@@ -0,0 +1,458 @@
+#pragma once
+
+#include "handler.h"
+#include <charconv>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+
+// Typed handlers. A handler is written against its real request and response types:
+//
+//     struct read_request {
+//         std::string path;
+//         static constexpr auto fields() { return std::tuple{typed_field{"path", &read_request::path}}; }
+//     };
+//     read_response read(const read_request& req, std::string& err);
+//
+//     handler_def read_with() { return typed_handler<read>("x.read", "tag"); }
+//
+// The JSON decoder and encoder for each type are generated from its fields() at compile
+// time, and the handler lands in handler_def::bytes as a plain function pointer, so the
+// call does no std::any boxing. Members may be strings, bools, numbers, nested typed
+// structs, std::vector and std::optional of those. Unknown request keys are ignored.
+//
+// A handler reports failure by setting err; the response is then
+// {"success":false,"error":err}. Otherwise it is {"success":true, ...fields}.
+
+template <typename T, typename M>
+struct typed_field {
+    std::string_view name;
+    M T::* member;
+};
+
+template <typename T>
+concept typed_struct = requires { T::fields(); };
+
+namespace typed_detail {
+
+inline void skip_ws(std::string_view text, std::size_t& pos) {
+    while (pos < text.size() && (text[pos] == ' ' || text[pos] == '\t' || text[pos] == '\n' || text[pos] == '\r')) {
+        ++pos;
+    }
+}
+
+inline bool skip_value(std::string_view text, std::size_t& pos);
+
+inline bool skip_string(std::string_view text, std::size_t& pos) {
+    if (pos >= text.size() || text[pos] != '"') return false;
+    for (++pos; pos < text.size(); ++pos) {
+        if (text[pos] == '\\') {
+            ++pos;
+        } else if (text[pos] == '"') {
+            ++pos;
+            return true;
+        }
+    }
+    return false;
+}
+
+inline bool skip_value(std::string_view text, std::size_t& pos) {
+    skip_ws(text, pos);
+    if (pos >= text.size()) return false;
+    if (text[pos] == '"') return skip_string(text, pos);
+    if (text[pos] == '{' || text[pos] == '[') {
+        // Strings are skipped whole, so brackets inside them don't count
+        int depth = 0;
+        while (pos < text.size()) {
+            char c = text[pos];
+            if (c == '"') {
+                if (!skip_string(text, pos)) return false;
+                continue;
+            }
+            if (c == '{' || c == '[') ++depth;
+            if (c == '}' || c == ']') --depth;
+            ++pos;
+            if (depth == 0) return true;
+        }
+        return false;
+    }
+    std::size_t start = pos;
+    while (pos < text.size() && text[pos] != ',' && text[pos] != '}' && text[pos] != ']' &&
+           text[pos] != ' ' && text[pos] != '\t' && text[pos] != '\n' && text[pos] != '\r') {
+        ++pos;
+    }
+    return pos > start;
+}
+
+inline void append_utf8(std::string& out, unsigned code) {
+    if (code < 0x80) {
+        out += char(code);
+    } else if (code < 0x800) {
+        out += char(0xC0 | (code >> 6));
+        out += char(0x80 | (code & 0x3F));
+    } else if (code < 0x10000) {
+        out += char(0xE0 | (code >> 12));
+        out += char(0x80 | ((code >> 6) & 0x3F));
+        out += char(0x80 | (code & 0x3F));
+    } else {
+        out += char(0xF0 | (code >> 18));
+        out += char(0x80 | ((code >> 12) & 0x3F));
+        out += char(0x80 | ((code >> 6) & 0x3F));
+        out += char(0x80 | (code & 0x3F));
+    }
+}
+
+// The four hex digits of a \u escape starting at pos; a string still has its closing
+// quote after them
+inline bool read_hex4(std::string_view text, std::size_t pos, unsigned& code) {
+    if (pos + 4 >= text.size()) return false;
+    auto [end, ec] = std::from_chars(text.data() + pos, text.data() + pos + 4, code, 16);
+    return ec == std::errc() && end == text.data() + pos + 4;
+}
+
+// Position of the next quote or backslash at or after pos, or text.size(). memchr is
+// vectorised, and backslashes are rare enough to look for only before the quote.
+inline std::size_t string_special(std::string_view text, std::size_t pos) {
+    if (pos >= text.size()) return text.size();
+    const char* begin = text.data() + pos;
+    const char* quote = static_cast<const char*>(std::memchr(begin, '"', text.size() - pos));
+    const char* limit = quote ? quote : text.data() + text.size();
+    const char* slash = static_cast<const char*>(std::memchr(begin, '\\', std::size_t(limit - begin)));
+    return std::size_t((slash ? slash : limit) - text.data());
+}
+
+inline bool read_string(std::string_view text, std::size_t& pos, std::string& out) {
+    if (pos >= text.size() || text[pos] != '"') return false;
+    out.clear();
+    for (++pos; pos < text.size(); ++pos) {
+        // Copy unescaped runs in one go
+        std::size_t run = string_special(text, pos);
+        if (run == text.size()) return false;
+        out.append(text.data() + pos, run - pos);
+        pos = run;
+        if (text[pos] == '"') {
+            ++pos;
+            return true;
+        }
+        if (++pos >= text.size()) return false;
+        switch (text[pos]) {
+            case 'n': out += '\n'; break;
+            case 'r': out += '\r'; break;
+            case 't': out += '\t'; break;
+            case 'b': out += '\b'; break;
+            case 'f': out += '\f'; break;
+            case 'u': {
+                unsigned code = 0;
+                if (!read_hex4(text, pos + 1, code)) return false;
+                pos += 4;
+                // A surrogate pair is one code point; half of one on its own isn't text
+                if (code >= 0xD800 && code <= 0xDFFF) {
+                    unsigned low = 0;
+                    if (code > 0xDBFF || pos + 2 >= text.size() || text[pos + 1] != '\\' || text[pos + 2] != 'u' ||
+                        !read_hex4(text, pos + 3, low) || low < 0xDC00 || low > 0xDFFF) {
+                        return false;
+                    }
+                    code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+                    pos += 6;
+                }
+                append_utf8(out, code);
+                break;
+            }
+            default: out += text[pos]; break;
+        }
+    }
+    return false;
+}
+
+// Object keys without escapes are compared in place; the rest are decoded into scratch
+inline bool read_key(std::string_view text, std::size_t& pos, std::string_view& key, std::string& scratch) {
+    if (pos >= text.size() || text[pos] != '"') return false;
+    std::size_t end = string_special(text, pos + 1);
+    if (end < text.size() && text[end] == '"') {
+        key = text.substr(pos + 1, end - pos - 1);
+        pos = end + 1;
+        return true;
+    }
+    if (!read_string(text, pos, scratch)) return false;
+    key = scratch;
+    return true;
+}
+
+inline bool plain_char(char c) {
+    return c != '"' && c != '\\' && (unsigned char)c >= 0x20;
+}
+
+// Branch-free count, so the common no-escape case is one vectorised pass and one append
+inline std::size_t escape_count(std::string_view text) {
+    std::size_t count = 0;
+    for (char c : text) count += !plain_char(c);
+    return count;
+}
+
+inline void write_string(std::string& out, std::string_view text) {
+    static const char* kHex = "0123456789abcdef";
+    out += '"';
+    if (escape_count(text) == 0) {
+        out.append(text);
+        out += '"';
+        return;
+    }
+    for (std::size_t i = 0; i < text.size(); ++i) {
+        // Append runs that need no escaping in one go
+        std::size_t run = i;
+        while (run < text.size() && plain_char(text[run])) ++run;
+        if (run > i) {
+            out.append(text.data() + i, run - i);
+            i = run;
+            if (i == text.size()) break;
+        }
+        char c = text[i];
+        switch (c) {
+            case '"': out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\r': out += "\\r"; break;
+            case '\t': out += "\\t"; break;
+            default:
+                if ((unsigned char)c < 0x20) {
+                    out += "\\u00";
+                    out += kHex[(c >> 4) & 0xF];
+                    out += kHex[c & 0xF];
+                } else {
+                    out += c;
+                }
+        }
+    }
+    out += '"';
+}
+
+template <typename T> struct is_vector : std::false_type {};
+template <typename T> struct is_vector<std::vector<T>> : std::true_type {};
+template <typename T> struct is_optional : std::false_type {};
+template <typename T> struct is_optional<std::optional<T>> : std::true_type {};
+
+template <typename T>
+bool decode(std::string_view text, std::size_t& pos, T& value);
+
+template <typename T>
+bool decode_object(std::string_view text, std::size_t& pos, T& value) {
+    if (pos >= text.size() || text[pos] != '{') return false;
+    ++pos;
+    skip_ws(text, pos);
+    if (pos < text.size() && text[pos] == '}') {
+        ++pos;
+        return true;
+    }
+    std::string_view key;
+    std::string scratch;
+    while (pos < text.size()) {
+        if (!read_key(text, pos, key, scratch)) return false;
+        skip_ws(text, pos);
+        if (pos >= text.size() || text[pos] != ':') return false;
+        ++pos;
+        skip_ws(text, pos);
+
+        // Unrolled at compile time into one comparison per field
+        bool ok = true;
+        bool matched = std::apply([&](const auto&... field) {
+            return ((key == field.name && ((ok = decode(text, pos, value.*(field.member))), true)) || ...);
+        }, T::fields());
+        if (!ok) return false;
+        if (!matched && !skip_value(text, pos)) return false;
+
+        skip_ws(text, pos);
+        if (pos < text.size() && text[pos] == '}') {
+            ++pos;
+            return true;
+        }
+        if (pos >= text.size() || text[pos] != ',') return false;
+        ++pos;
+        skip_ws(text, pos);
+    }
+    return false;
+}
+
+template <typename T>
+bool decode(std::string_view text, std::size_t& pos, T& value) {
+    skip_ws(text, pos);
+    if constexpr (std::is_same_v<T, std::string>) {
+        return read_string(text, pos, value);
+    } else if constexpr (std::is_same_v<T, bool>) {
+        if (text.substr(pos, 4) == "true") {
+            value = true;
+            pos += 4;
+            return true;
+        }
+        if (text.substr(pos, 5) == "false") {
+            value = false;
+            pos += 5;
+            return true;
+        }
+        return false;
+    } else if constexpr (std::is_integral_v<T>) {
+        auto [end, ec] = std::from_chars(text.data() + pos, text.data() + text.size(), value);
+        if (ec != std::errc()) return false;
+        pos = std::size_t(end - text.data());
+        return true;
+    } else if constexpr (std::is_floating_point_v<T>) {
+        std::size_t start = pos;
+        if (!skip_value(text, pos)) return false;
+        std::string number(text.substr(start, pos - start));
+        char* end = nullptr;
+        value = T(std::strtod(number.c_str(), &end));
+        return end == number.c_str() + number.size();
+    } else if constexpr (is_optional<T>::value) {
+        if (text.substr(pos, 4) == "null") {
+            value.reset();
+            pos += 4;
+            return true;
+        }
+        return decode(text, pos, value.emplace());
+    } else if constexpr (is_vector<T>::value) {
+        if (pos >= text.size() || text[pos] != '[') return false;
+        value.clear();
+        ++pos;
+        skip_ws(text, pos);
+        if (pos < text.size() && text[pos] == ']') {
+            ++pos;
+            return true;
+        }
+        while (pos < text.size()) {
+            if (!decode(text, pos, value.emplace_back())) return false;
+            skip_ws(text, pos);
+            if (pos < text.size() && text[pos] == ']') {
+                ++pos;
+                return true;
+            }
+            if (pos >= text.size() || text[pos] != ',') return false;
+            ++pos;
+        }
+        return false;
+    } else {
+        static_assert(typed_struct<T>, "typed handler members must be strings, numbers, bools, "
+                                       "vectors, optionals or structs with fields()");
+        return decode_object(text, pos, value);
+    }
+}
+
+template <typename T>
+void encode(std::string& out, const T& value);
+
+// Writes the members of value, each preceded by a comma when first is false
+template <typename T>
+void encode_members(std::string& out, const T& value, bool first) {
+    std::apply([&](const auto&... field) {
+        auto one = [&](const auto& f) {
+            const auto& member = value.*(f.member);
+            if constexpr (is_optional<std::decay_t<decltype(member)>>::value) {
+                if (!member) return;
+            }
+            // Field names are identifiers, so they go out unescaped
+            out += first ? "\"" : ",\"";
+            first = false;
+            out += f.name;
+            out += "\":";
+            encode(out, member);
+        };
+        (one(field), ...);
+    }, T::fields());
+}
+
+template <typename T>
+void encode(std::string& out, const T& value) {
+    if constexpr (std::is_same_v<T, std::string> || std::is_same_v<T, std::string_view>) {
+        write_string(out, value);
+    } else if constexpr (std::is_same_v<T, bool>) {
+        out += value ? "true" : "false";
+    } else if constexpr (std::is_integral_v<T>) {
+        char buf[32];
+        auto [end, ec] = std::to_chars(buf, buf + sizeof(buf), value);
+        out.append(buf, end);
+    } else if constexpr (std::is_floating_point_v<T>) {
+        char buf[32];
+        int len = std::snprintf(buf, sizeof(buf), "%.17g", double(value));
+        out.append(buf, std::size_t(len));
+    } else if constexpr (is_optional<T>::value) {
+        if (value) {
+            encode(out, *value);
+        } else {
+            out += "null";
+        }
+    } else if constexpr (is_vector<T>::value) {
+        out += '[';
+        for (std::size_t i = 0; i < value.size(); ++i) {
+            if (i > 0) out += ',';
+            encode(out, value[i]);
+        }
+        out += ']';
+    } else {
+        static_assert(typed_struct<T>, "typed handler members must be strings, numbers, bools, "
+                                       "vectors, optionals or structs with fields()");
+        out += '{';
+        encode_members(out, value, true);
+        out += '}';
+    }
+}
+
+template <typename Fn> struct handler_traits;
+template <typename Req, typename Res>
+struct handler_traits<Res (*)(const Req&, std::string&)> {
+    using request = Req;
+    using response = Res;
+};
+
+}
+
+// Decodes a JSON object into value; false on malformed input or mismatched types.
+// An empty payload decodes to a default-constructed value.
+template <typed_struct T>
+bool typed_decode(std::string_view text, T& value) {
+    std::size_t pos = 0;
+    typed_detail::skip_ws(text, pos);
+    if (pos == text.size()) return true;
+    if (!typed_detail::decode_object(text, pos, value)) return false;
+    typed_detail::skip_ws(text, pos);
+    return pos == text.size();
+}
+
+template <typed_struct T>
+std::string typed_encode(const T& value) {
+    std::string out;
+    typed_detail::encode(out, value);
+    return out;
+}
+
+// The generated handler_bytes_fn: one direct call into Fn between decode and encode
+template <auto Fn>
+std::string typed_call(std::string_view payload, const char* /* options */, std::string& err) {
+    using traits = typed_detail::handler_traits<decltype(Fn)>;
+    typename traits::request request{};
+    if (!typed_decode(payload, request)) {
+        return R"({"success":false,"error":"malformed request"})";
+    }
+
+    typename traits::response response = Fn(request, err);
+    std::string out;
+    out.reserve(64);
+    if (!err.empty()) {
+        out = R"({"success":false,"error":)";
+        typed_detail::write_string(out, err);
+        out += '}';
+        return out;
+    }
+    out = R"({"success":true)";
+    typed_detail::encode_members(out, response, false);
+    out += '}';
+    return out;
+}
+
+template <auto Fn>
+handler_def typed_handler(std::string_view sid, std::string_view tag, long cache_ms = 0) {
+    return {.sid = sid, .tag = tag, .bytes = &typed_call<Fn>, .cache_ms = cache_ms};
+}
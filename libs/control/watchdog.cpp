@@ -0,0 +1,284 @@
+#include "watchdog.h"
+#include "bus.h"
+#include "json.h"
+#include "pool.h"
+#include "registry.h"
+#include "stats.h"
+#include "timer.h"
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+
+constexpr std::size_t kShards = 16;
+constexpr auto kScanEvery = std::chrono::milliseconds(5);
+constexpr std::size_t kRecent = 32;
+constexpr std::string_view kEveryAddress = "*";
+constexpr std::string_view kTopic = "control.overrun";
+
+struct overrun {
+    std::string address;
+    const char* over = nullptr;  // "wall" or "cpu"
+    std::uint64_t wall_us = 0;
+    std::uint64_t cpu_us = 0;
+    bool cancelled = false;
+};
+
+std::uint64_t micros(std::chrono::nanoseconds span) {
+    return std::uint64_t(std::chrono::duration_cast<std::chrono::microseconds>(span).count());
+}
+
+}
+
+// The tickets of the threads that map to it, linked through the tickets themselves
+struct watch_shard {
+    std::mutex lock;
+    watch_ticket* head = nullptr;
+
+    void link(watch_ticket& ticket) {
+        std::lock_guard<std::mutex> guard(lock);
+        ticket.next_ = head;
+        if (head) head->prev_ = &ticket;
+        head = &ticket;
+    }
+
+    void unlink(watch_ticket& ticket) {
+        std::lock_guard<std::mutex> guard(lock);
+        if (ticket.prev_) {
+            ticket.prev_->next_ = ticket.next_;
+        } else {
+            head = ticket.next_;
+        }
+        if (ticket.next_) ticket.next_->prev_ = ticket.prev_;
+    }
+
+    // Flags the calls past their budget, trips those with the cancel action, and reports
+    // each once. A ticket only leaves under the lock, so its thread is alive while its
+    // clock is read.
+    void scan(std::chrono::steady_clock::time_point now, std::vector<overrun>& found, std::size_t& running) {
+        std::lock_guard<std::mutex> guard(lock);
+        for (watch_ticket* ticket = head; ticket; ticket = ticket->next_) {
+            ++running;
+            if (ticket->flagged_) continue;
+            const watchdog_budget& budget = ticket->budget_;
+            auto wall = now - ticket->start_;
+            std::uint64_t cpu_ns = thread_cpu_ns(ticket->clock_) - ticket->cpu_start_;
+            const char* over = nullptr;
+            if (budget.wall.count() > 0 && wall >= budget.wall) {
+                over = "wall";
+            } else if (budget.cpu.count() > 0 &&
+                       std::chrono::nanoseconds(cpu_ns) >= std::chrono::nanoseconds(budget.cpu)) {
+                over = "cpu";
+            }
+            if (!over) continue;
+
+            ticket->flagged_ = true;
+            if (ticket->token_) call_trip(*ticket->token_);
+            found.push_back({std::string(ticket->address_), over, micros(wall), micros(std::chrono::nanoseconds(cpu_ns)),
+                             ticket->token_ != nullptr});
+        }
+    }
+};
+
+namespace {
+
+std::atomic<bool> g_any{false};
+std::shared_mutex g_budgets_lock;
+std::unordered_map<std::string, watchdog_budget, route_hash, std::equal_to<>> g_budgets;
+std::atomic<std::uint64_t> g_version{1};  // bumped under g_budgets_lock by every change
+
+// What this thread last found for each handle, good while the version holds
+struct site_budget {
+    std::uint64_t version = 0;
+    std::optional<watchdog_budget> budget;
+};
+thread_local std::vector<site_budget> t_sites;
+
+// Tickets with a budget open on this thread
+thread_local unsigned t_watching = 0;
+
+// Caller holds g_budgets_lock
+std::optional<watchdog_budget> find_budget(std::string_view address) {
+    auto it = g_budgets.find(address);
+    if (it == g_budgets.end()) it = g_budgets.find(kEveryAddress);
+    if (it == g_budgets.end()) return std::nullopt;
+    return it->second;
+}
+
+std::optional<watchdog_budget> budget_for(std::string_view address, std::size_t site) {
+    if (site == 0) {
+        std::shared_lock<std::shared_mutex> lock(g_budgets_lock);
+        return find_budget(address);
+    }
+    if (site > t_sites.size()) t_sites.resize(site);
+    site_budget& cached = t_sites[site - 1];
+    if (cached.version != g_version.load(std::memory_order_acquire)) {
+        std::shared_lock<std::shared_mutex> lock(g_budgets_lock);
+        cached.budget = find_budget(address);
+        cached.version = g_version.load(std::memory_order_relaxed);
+    }
+    return cached.budget;
+}
+
+watch_shard g_shards[kShards];
+std::atomic<std::size_t> g_next_shard{0};
+
+// The scan timer, the counts and the latest overruns
+std::mutex g_state_lock;
+timer_id g_scan_timer = 0;
+std::uint64_t g_flagged = 0;
+std::uint64_t g_cancelled = 0;
+std::size_t g_running = 0;  // watched calls in flight at the last scan
+std::deque<overrun> g_recent;
+
+watch_shard& local_shard() {
+    thread_local std::size_t shard = g_next_shard.fetch_add(1, std::memory_order_relaxed) % kShards;
+    return g_shards[shard];
+}
+
+std::string overrun_json(const overrun& found) {
+    return R"({"address":")" + json_escape(found.address) + R"(","over":")" + found.over + R"(","wall_us":)" +
+           std::to_string(found.wall_us) + R"(,"cpu_us":)" + std::to_string(found.cpu_us) + R"(,"cancelled":)" +
+           (found.cancelled ? "true" : "false") + "}";
+}
+
+// Runs on the timer thread, which is why publishing goes through the pool: a subscriber
+// with the blocking policy could otherwise hold up every timer
+void scan() {
+    auto now = std::chrono::steady_clock::now();
+    std::vector<overrun> found;
+    std::size_t running = 0;
+    for (auto& shard : g_shards) shard.scan(now, found, running);
+
+    std::lock_guard<std::mutex> lock(g_state_lock);
+    g_running = running;
+    for (auto& item : found) {
+        std::cout << "CONTROL: Watchdog: " << item.address << " over its " << item.over << " budget after "
+                  << item.wall_us / 1000 << " ms (" << item.cpu_us / 1000 << " ms CPU)"
+                  << (item.cancelled ? ", cancelled" : "") << std::endl;
+        stats_overrun(item.address);
+        ++g_flagged;
+        if (item.cancelled) ++g_cancelled;
+        if (pool_ref pool = control_pool()) {
+            pool->submit([event = overrun_json(item)] { bus_publish(kTopic, event.data(), event.size()); });
+        }
+        g_recent.push_back(std::move(item));
+        if (g_recent.size() > kRecent) g_recent.pop_front();
+    }
+}
+
+// Caller holds g_state_lock
+void schedule_scan(bool wanted) {
+    if (wanted && !g_scan_timer) {
+        g_scan_timer = timer_schedule(kScanEvery, kScanEvery, std::make_shared<const std::function<void()>>(scan));
+    } else if (!wanted && g_scan_timer) {
+        timer_cancel(g_scan_timer);
+        g_scan_timer = 0;
+    }
+}
+
+}
+
+void watchdog_set(std::string_view address, watchdog_budget budget) {
+    bool any;
+    {
+        std::unique_lock<std::shared_mutex> lock(g_budgets_lock);
+        if (budget.wall.count() <= 0 && budget.cpu.count() <= 0) {
+            if (auto it = g_budgets.find(address); it != g_budgets.end()) g_budgets.erase(it);
+        } else {
+            g_budgets.insert_or_assign(std::string(address), budget);
+        }
+        g_version.fetch_add(1, std::memory_order_release);
+        any = !g_budgets.empty();
+        g_any.store(any, std::memory_order_release);
+    }
+    std::lock_guard<std::mutex> lock(g_state_lock);
+    schedule_scan(any);
+}
+
+watchdog_budget watchdog_parse(std::string_view text) {
+    watchdog_budget budget;
+    budget.wall = std::chrono::milliseconds(std::max<long long>(json_int(text, "wall_ms", 0), 0));
+    budget.cpu = std::chrono::milliseconds(std::max<long long>(json_int(text, "cpu_ms", 0), 0));
+    auto action = json_find(text, "action");
+    budget.cancel = action && json_text(*action) == "cancel";
+    return budget;
+}
+
+std::string watchdog_report() {
+    std::map<std::string, watchdog_budget> budgets;
+    {
+        std::shared_lock<std::shared_mutex> lock(g_budgets_lock);
+        budgets.insert(g_budgets.begin(), g_budgets.end());
+    }
+
+    std::string out = R"({"budgets":[)";
+    bool first = true;
+    for (const auto& [address, budget] : budgets) {
+        if (!first) out += ",";
+        first = false;
+        out += R"({"address":")" + json_escape(address) + R"(","wall_ms":)" + std::to_string(budget.wall.count()) +
+               R"(,"cpu_ms":)" + std::to_string(budget.cpu.count()) + R"(,"action":")" +
+               (budget.cancel ? "cancel" : "flag") + R"("})";
+    }
+
+    std::lock_guard<std::mutex> lock(g_state_lock);
+    out += R"(],"running":)" + std::to_string(g_running) + R"(,"flagged":)" + std::to_string(g_flagged) +
+           R"(,"cancelled":)" + std::to_string(g_cancelled) + R"(,"recent":[)";
+    for (std::size_t i = 0; i < g_recent.size(); ++i) {
+        if (i > 0) out += ",";
+        out += overrun_json(g_recent[i]);
+    }
+    out += "]}";
+    return out;
+}
+
+void watchdog_reset() {
+    {
+        std::unique_lock<std::shared_mutex> lock(g_budgets_lock);
+        g_budgets.clear();
+        g_version.fetch_add(1, std::memory_order_release);
+        g_any.store(false, std::memory_order_release);
+    }
+    std::lock_guard<std::mutex> lock(g_state_lock);
+    schedule_scan(false);
+}
+
+watch_ticket::watch_ticket(std::string_view address, std::size_t site) {
+    if (!g_any.load(std::memory_order_acquire)) return;
+    std::optional<watchdog_budget> budget = budget_for(address, site);
+    if (!budget) return;
+    budget_ = *budget;
+
+    address_ = address;
+    start_ = std::chrono::steady_clock::now();
+    clock_ = thread_cpu_self();
+    cpu_start_ = thread_cpu_ns(clock_);
+    if (budget_.cancel) {
+        token_ = call_token();
+        call_context context = call_current();
+        context.tokens.push_back(token_);
+        scope_.emplace(std::move(context));
+    }
+    shard_ = &local_shard();
+    shard_->link(*this);
+    ++t_watching;
+}
+
+watch_ticket::~watch_ticket() {
+    if (!shard_) return;
+    shard_->unlink(*this);
+    --t_watching;
+}
+
+bool watchdog_watching() {
+    return t_watching > 0;
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "cputime.h"
+#include "deadline.h"
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+
+// Run-time budgets per address, checked while calls run. A budget caps the wall time of a
+// call from when it was admitted, the CPU time its thread spends on it, or both. Every few
+// milliseconds control's timer thread looks over the calls in flight; one past its budget
+// is counted against its address in control.stats, logged, listed by control.watchdog and
+// published on the "control.overrun" topic. With the cancel action the watchdog also trips
+// the call's cancellation, so call_cancelled() (libshost::cancelled for plugins) turns
+// true and a handler that polls it stops. While no address has a budget, calls are not
+// tracked at all.
+
+struct watchdog_budget {
+    std::chrono::milliseconds wall{0};  // 0 for no limit
+    std::chrono::milliseconds cpu{0};
+    bool cancel = false;                // otherwise overruns are only flagged
+};
+
+// Zero wall and cpu remove the budget. "*" covers every address without one of its own.
+void watchdog_set(std::string_view address, watchdog_budget budget);
+
+// A budget as JSON: {"wall_ms":N,"cpu_ms":N,"action":"flag"|"cancel"}
+watchdog_budget watchdog_parse(std::string_view text);
+
+// JSON object with the budgets, how many calls were flagged and cancelled, and the
+// latest overruns
+std::string watchdog_report();
+
+// Drops every budget and stops scanning, at Detach
+void watchdog_reset();
+
+// True while a call on this thread runs under a budget
+bool watchdog_watching();
+
+// Watches one call on this thread for the scope of the object, if its address has a budget.
+// site is the handle (see handles.h) the call came through, 0 for none: each thread keeps
+// the budget it found for a handle until a budget changes.
+class watch_ticket {
+public:
+    explicit watch_ticket(std::string_view address, std::size_t site = 0);
+    ~watch_ticket();
+    watch_ticket(const watch_ticket&) = delete;
+    watch_ticket& operator=(const watch_ticket&) = delete;
+
+private:
+    friend struct watch_shard;
+
+    std::string_view address_;
+    watchdog_budget budget_;
+    std::chrono::steady_clock::time_point start_;
+    thread_cpu_clock clock_;
+    std::uint64_t cpu_start_ = 0;
+    std::shared_ptr<cancel_token> token_;  // with the cancel action
+    std::optional<call_scope> scope_;      // puts token_ in force
+    struct watch_shard* shard_ = nullptr;
+    watch_ticket* prev_ = nullptr;
+    watch_ticket* next_ = nullptr;
+    bool flagged_ = false;
+};
@@ -4,13 +4,52 @@
 handler_def control_run_with();
 handler_def control_discover_with();
 handler_def control_load_with();
+handler_def control_unload_with();
+handler_def control_reload_with();
 handler_def control_list_with();
+handler_def control_pool_with();
+handler_def control_batch_with();
+handler_def control_resolve_with();
+handler_def control_stats_with();
+handler_def control_trace_with();
+handler_def control_cache_with();
+handler_def control_invalidate_with();
+handler_def control_abort_with();
+handler_def control_limit_with();
+handler_def control_publish_with();
+handler_def control_topics_with();
+handler_def control_schedule_with();
+handler_def control_cancel_with();
+handler_def control_memstats_with();
+handler_def control_watchdog_with();
 
 handler_list control_with() {
     return {
         control_run_with(),
         control_discover_with(),
         control_load_with(),
+        control_unload_with(),
+        control_reload_with(),
         control_list_with(),
+        control_pool_with(),
+        control_batch_with(),
+        control_resolve_with(),
+        control_stats_with(),
+        control_trace_with(),
+        control_cache_with(),
+        control_invalidate_with(),
+        control_abort_with(),
+        control_limit_with(),
+        control_publish_with(),
+        control_topics_with(),
+        control_schedule_with(),
+        control_cancel_with(),
+        control_memstats_with(),
+        control_watchdog_with(),
     };
 }
+
+const handler_table& control_table() {
+    static const handler_table table(control_with());
+    return table;
+}
@@ -2,9 +2,11 @@
 #include <iostream>
 
 extern DispatchFn g_dispatch;
+extern const libshost* g_host;
 
 extern "C" bool Detach(char* /* err_buf */, std::size_t /* err_cap */) {
     g_dispatch = nullptr;
+    g_host = nullptr;
     std::cout << "EFS: Detach() called" << std::endl;
     return true;
 }
@@ -22,6 +22,8 @@ handler_def efs_list_with() {
             
             result += "]}";
             return result;
-        }
+        },
+        // The embedded file set is fixed at build time
+        .cache_ms = -1,
     };
 }
@@ -2,10 +2,17 @@
 
 extern handler_def efs_list_with();
 extern handler_def efs_read_with();
+extern handler_def efs_read_one_with();
 
 handler_list efs_with() {
     return {
         efs_list_with(),
         efs_read_with(),
+        efs_read_one_with(),
     };
 }
+
+const handler_table& efs_table() {
+    static const handler_table table(efs_with());
+    return table;
+}
@@ -1,17 +1,36 @@
 #pragma once
 
+#include <algorithm>
 #include <any>
-#include <functional>
 #include <initializer_list>
 #include <string>
+#include <string_view>
+#include <utility>
 #include <vector>
 
-using handler_fn = std::function<std::any(const char*, const char*, std::string&)>;
+// Handlers are captureless, so a plain function pointer replaces std::function
+using handler_fn = std::any (*)(const char*, const char*, std::string&);
 
+// Binary-safe form: the payload arrives with its length and the result is raw bytes
+using handler_bytes_fn = std::string (*)(std::string_view payload, const char* options, std::string& err);
+
+// Coroutine form, see task.h. Payload and options are owned, since the handler may
+// suspend past the caller's buffers; errors are returned as a response or thrown.
+template <typename T>
+class task;
+using handler_task_fn = task<std::string> (*)(std::string payload, std::string options);
+
+// sid and tag always refer to string literals, so they are NUL-terminated.
+// A handler sets fun, bytes, co, or more than one; bytes wins, then co.
+// cache_ms lets control reuse a successful result for the same payload and options: for
+// that many milliseconds, or until invalidated when negative. Zero never caches.
 struct handler_def {
-    std::string sid;
-    std::string tag;
-    handler_fn fun;
+    std::string_view sid;
+    std::string_view tag;
+    handler_fn fun = nullptr;
+    handler_bytes_fn bytes = nullptr;
+    handler_task_fn co = nullptr;
+    long cache_ms = 0;
 };
 
 using handler_list = std::vector<handler_def>;
@@ -23,3 +42,37 @@ inline handler_list spread(std::initializer_list<handler_list> lists) {
     }
     return result;
 }
+
+// Immutable handler table: sorted by sid once, then searched by binary search.
+// Lookups never allocate.
+class handler_table {
+public:
+    explicit handler_table(handler_list list) : handlers_(std::move(list)) {
+        std::sort(handlers_.begin(), handlers_.end(),
+                  [](const handler_def& a, const handler_def& b) { return a.sid < b.sid; });
+    }
+
+    const handler_def* find(std::string_view sid) const {
+        auto it = std::lower_bound(handlers_.begin(), handlers_.end(), sid,
+                                   [](const handler_def& h, std::string_view s) { return h.sid < s; });
+        if (it == handlers_.end() || it->sid != sid) return nullptr;
+        return &*it;
+    }
+
+    // Stable position of a handler, for callers that resolve once and call by index
+    long index_of(std::string_view sid) const {
+        const handler_def* handler = find(sid);
+        return handler ? long(handler - handlers_.data()) : -1;
+    }
+
+    const handler_def* at(long index) const {
+        if (index < 0 || std::size_t(index) >= handlers_.size()) return nullptr;
+        return &handlers_[index];
+    }
+
+    const handler_list& list() const { return handlers_; }
+    std::size_t size() const { return handlers_.size(); }
+
+private:
+    handler_list handlers_;
+};
@@ -5,3 +5,8 @@ handler_list ege_with() {
         // EGE plugin has no addresses yet - placeholder
     };
 }
+
+const handler_table& ege_table() {
+    static const handler_table table(ege_with());
+    return table;
+}
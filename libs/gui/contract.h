@@ -1,6 +1,7 @@
 #pragma once
 
 #include <cstddef>
+#include <cstdint>
 
 struct libsinfo {
     const char* plugin_type;
@@ -10,12 +11,195 @@ struct libsinfo {
     unsigned long plugin_id;
 };
 
+// Route descriptor - one entry per address a plugin handles
+struct libsroute {
+    const char* address;
+    const char* tag;
+};
+
+// Cache policy for one address: results for the same payload and options are reused for
+// ttl_ms milliseconds, or until invalidated when ttl_ms is negative
+struct libscache {
+    const char* address;
+    long ttl_ms;
+};
+
+// One published event; topic and data are only valid during the delivery call. data is
+// size bytes and need not be NUL-terminated.
+struct libsevent {
+    const char* topic;
+    const char* data;
+    std::size_t size;
+};
+
+// What publishing does when a subscriber's queue is full
+enum libsoverflow : int {
+    LIBS_DROP_OLDEST = 0,  // the oldest queued event makes room
+    LIBS_BLOCK = 1,        // the publisher waits for room, until its deadline or cancel token;
+                           // one on a reactor loop doesn't wait and the event is dropped
+};
+
+// A topic a plugin subscribes to, see Subscriptions. capacity 0 takes control's default.
+struct libstopic {
+    const char* topic;
+    std::size_t capacity;
+    int overflow;  // libsoverflow
+};
+
+// Receives a batch of events of one topic, in the order they were published
+typedef void (*DeliverFn)(const libsevent* events, std::size_t count, void* user_data);
+
+// Heap use of one library, see MemStats. Sizes are of whole blocks, as the allocator
+// hands them out.
+struct libsmemory {
+    std::uint64_t allocated;    // bytes, since the library was loaded
+    std::uint64_t freed;
+    std::uint64_t allocations;
+    std::uint64_t frees;
+    std::uint64_t live;         // allocated less freed
+    std::uint64_t peak;         // highest live so far
+};
+
+// Owned result - filled by Invoke2, handed back to the same library's Release
+struct libsresult {
+    const char* data;
+    std::size_t size;
+    void* owner;
+};
+
+// A library the host already opened and reported, handed to control through AttachEx
+// so that it is not opened a second time
+struct libshandoff {
+    const char* path;
+    void* handle;
+    libsinfo info;
+};
+
 // Dispatch callback - allows plugins to invoke other plugins via host
 typedef const char* (*DispatchFn)(const char* address, const char* payload, const char* options);
 
+// Libraries only log the dispatches they handle when this environment variable is set,
+// read once in Attach; control also takes {"log_calls":true} in AttachEx's options
+constexpr const char* kLogCallsEnv = "JAM_LOG_CALLS";
+
+// Completion callback for asynchronous dispatch; result is only valid during the call
+typedef void (*CompletionFn)(bool handled, const libsresult* result, void* user_data);
+
+// Host services handed to plugins that export Services. Fields are only ever appended,
+// so check size before using one added after the first version.
+struct libshost {
+    std::size_t size;
+    DispatchFn dispatch;
+    bool (*dispatch2)(const char* address, const char* payload, const char* options, libsresult* out);
+    void (*release)(libsresult* result);
+    bool (*dispatch_async)(const char* address, const char* payload, const char* options,
+                           CompletionFn callback, void* user_data);
+    bool (*dispatch_bytes)(const char* address, const char* payload, std::size_t payload_len,
+                           const char* options, libsresult* out);
+    std::uint64_t (*resolve)(const char* address);
+    bool (*dispatch_handle)(std::uint64_t handle, const char* payload, std::size_t payload_len,
+                            const char* options, libsresult* out);
+    // Drops cached results for address, or every cached result when address is null.
+    // Returns how many were dropped.
+    std::size_t (*invalidate)(const char* address);
+    // True once the dispatch running on this thread is past its deadline, was aborted
+    // through its cancel token (see control.abort) or ran over a budget with the cancel
+    // action (see control.watchdog); long loops should poll it and stop
+    bool (*cancelled)();
+    // Queues an event for every subscriber of topic and returns how many that was. Delivery
+    // happens later on control's pool, in batches; see Subscriptions.
+    std::size_t (*publish)(const char* topic, const char* data, std::size_t size);
+};
+
 extern "C" {
     bool Attach(DispatchFn dispatch, char* err_buf, std::size_t err_cap);
     bool Detach(char* err_buf, std::size_t err_cap);
     bool Report(char* err_buf, std::size_t err_cap, libsinfo* out);
     const char* Invoke(const char* address, const char* payload, const char* options);
+
+    // Optional: exposes the plugin's address table so control can route without probing
+    std::size_t Routes(const libsroute** out);
+
+    // Optional: addresses whose results control may cache, see libscache. Only successful
+    // results are cached, keyed by address, options and payload.
+    std::size_t Cacheable(const libscache** out);
+
+    // Optional: reentrant entry point. Each call gets its own result, which stays valid
+    // until passed to Release. Returns false when no handler owns the address.
+    bool Invoke2(const char* address, const char* payload, const char* options, libsresult* out);
+    void Release(libsresult* result);
+
+    // Optional: binary-safe variant of Invoke2. The payload is payload_len bytes and need not
+    // be NUL-terminated; the result's size covers any embedded zero bytes.
+    bool InvokeBytes(const char* address, const char* payload, std::size_t payload_len,
+                     const char* options, libsresult* out);
+
+    // Optional: address interning. ResolveHandler returns a handler index (or -1) that stays
+    // valid while the library is loaded; InvokeHandler runs it without any string lookup.
+    long ResolveHandler(const char* address);
+    bool InvokeHandler(long index, const char* payload, std::size_t payload_len,
+                       const char* options, libsresult* out);
+
+    // Optional: starts the call and returns; callback runs exactly once, on this thread or
+    // later on another one, with a result that is only valid during the call. Lets coroutine
+    // handlers (task.h) give their thread back while they wait. Returns false, without
+    // calling back, when no handler owns the address.
+    bool InvokeDeferred(const char* address, const char* payload, std::size_t payload_len,
+                        const char* options, CompletionFn callback, void* user_data);
+
+    // Optional: topics to subscribe to while the library is loaded, each with its own
+    // bounded queue. Deliver gets the events of one topic at a time, in batches, never
+    // concurrently for the same topic. A plugin the manifest defers subscribes once
+    // something loads it. The list must stay valid while the library is loaded.
+    std::size_t Subscriptions(const libstopic** out);
+    void Deliver(const libsevent* events, std::size_t count);
+
+    // Optional: the library's heap counters, kept by the operator new and delete it links in
+    // (memory.cpp). total covers every thread, though peak only sees swings that last a
+    // few dozen allocations; thread is the calling thread's alone and has no live or peak.
+    // Either may be null. Control reads thread around its calls into the library to charge
+    // what they allocate to their addresses.
+    void MemStats(libsmemory* total, libsmemory* thread);
+
+    // Optional: receives control's service table right after Attach
+    void Services(const libshost* host);
+
+    // Optional: plugins that must be attached before this one, by name ("efs" or the file
+    // name). Control attaches plugins in that order, independent ones concurrently, and
+    // detaches in reverse. The list must stay valid while the library is loaded.
+    std::size_t Requires(const char* const** out);
+
+    // Control only: Attach plus the libraries the host has already opened. Control takes
+    // ownership of every handle; path strings only need to live for the call. options is a
+    // JSON object of control settings and may be null.
+    bool AttachEx(DispatchFn dispatch, const libshandoff* libs, std::size_t count, const char* options,
+                  char* err_buf, std::size_t err_cap);
+
+    // Control only: queues a dispatch on control's pool; callback runs on a pool thread. With
+    // the reactor executor the call runs on the loop that owns the address, and the callback
+    // on the loop that made the call, or the owning one for callers outside the reactor.
+    bool InvokeAsync(const char* address, const char* payload, const char* options,
+                     CompletionFn callback, void* user_data);
+
+    // Control only: interns an address into a handle (0 if unroutable) bound to the owning
+    // plugin and handler; InvokeHandle dispatches by it with no string work
+    std::uint64_t Resolve(const char* address);
+    bool InvokeHandle(std::uint64_t handle, const char* payload, std::size_t payload_len,
+                      const char* options, libsresult* out);
+
+    // Control only: drops cached results, see libshost::invalidate
+    std::size_t Invalidate(const char* address);
+
+    // Control only: see libshost::cancelled
+    bool Cancelled();
+
+    // Control only: see libshost::publish
+    std::size_t Publish(const char* topic, const char* data, std::size_t size);
+
+    // Control only: subscriptions for the host application. deliver runs on a pool thread
+    // as for plugins; Subscribe returns 0 for an empty topic. Unsubscribe waits for a
+    // delivery in progress, unless called from it, and drops what is still queued.
+    std::uint64_t Subscribe(const char* topic, std::size_t capacity, int overflow, DeliverFn deliver,
+                            void* user_data);
+    bool Unsubscribe(std::uint64_t id);
 }
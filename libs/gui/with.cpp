@@ -5,3 +5,8 @@ handler_list gui_with() {
         // GUI plugin has no addresses yet - placeholder
     };
 }
+
+const handler_table& gui_table() {
+    static const handler_table table(gui_with());
+    return table;
+}
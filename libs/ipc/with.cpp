@@ -5,3 +5,8 @@ handler_list ipc_with() {
         // IPC plugin has no addresses yet - placeholder
     };
 }
+
+const handler_table& ipc_table() {
+    static const handler_table table(ipc_with());
+    return table;
+}
@@ -1,11 +1,46 @@
 #include "handler.h"
 #include "llm_types.h"
 #include "contract.h"
+#include "task.h"
+#include "typed.h"
 #include <iostream>
 #include <fstream>
 #include <sstream>
 
 extern DispatchFn g_dispatch;
+extern const libshost* g_host;
+
+// The request efs.read takes for the model configuration
+extern const char* const kConfigRequest = R"({"path":"json/llm.json"})";
+
+// The members of efs.read's reply this library reads
+struct efs_read_reply {
+    bool success = false;
+    std::string content;
+    std::string error;
+
+    static constexpr auto fields() {
+        return std::tuple{typed_field{"success", &efs_read_reply::success},
+                          typed_field{"content", &efs_read_reply::content},
+                          typed_field{"error", &efs_read_reply::error}};
+    }
+};
+
+// The text of json/llm.json from efs.read's reply; false with err set when nothing handled
+// the read, it failed, or the reply is not one efs.read sends
+bool config_content(const char* reply, std::string& content, std::string& err) {
+    efs_read_reply decoded;
+    if (!reply || !typed_decode(reply, decoded)) {
+        err = "config not found";
+        return false;
+    }
+    if (!decoded.success) {
+        err = decoded.error.empty() ? "config not found" : decoded.error;
+        return false;
+    }
+    content = std::move(decoded.content);
+    return true;
+}
 
 // Simple JSON parser for config (subset needed for ModelConfig)
 ModelConfig parse_model_config(const std::string& json, const std::string& model_name) {
@@ -76,20 +111,21 @@ handler_def llm_config_with() {
     return {
         .sid = "llm.config",
         .tag = "llm",
-        .fun = [](const char* payload, const char* /* options */, std::string& err) -> std::any {
+        // A coroutine, so an asynchronous caller's thread isn't held while EFS reads
+        .co = [](std::string payload, std::string /* options */) -> task<std::string> {
             try {
-                std::string model_name = payload ? payload : "default";
+                std::string model_name = payload.empty() ? "default" : payload;
                 
                 // Read config via EFS
-                const char* json_data = g_dispatch("efs.read", "json/llm.json", nullptr);
-                if (!json_data || std::strlen(json_data) == 0) {
-                    err = "Failed to read json/llm.json or file is empty";
-                    return std::string(R"({"success":false,"error":"config not found"})");
+                dispatch_result config = co_await dispatch_async(g_host, "efs.read", kConfigRequest);
+                std::string json, err;
+                if (!config_content(config.handled ? config.response.c_str() : nullptr, json, err)) {
+                    co_return std::string(R"({"success":false,"error":")" + err + R"("})");
                 }
                 
-                std::cout << "LLM: Read " << std::strlen(json_data) << " bytes from json/llm.json" << std::endl;
+                std::cout << "LLM: Read " << json.size() << " bytes from json/llm.json" << std::endl;
                 
-                ModelConfig cfg = parse_model_config(json_data, model_name);
+                ModelConfig cfg = parse_model_config(json, model_name);
                 
                 // Return config as JSON
                 std::ostringstream result;
@@ -100,11 +136,12 @@ handler_def llm_config_with() {
                 result << R"("gpu_layers":)" << cfg.gpu_layers << ",";
                 result << R"("max_tokens":)" << cfg.max_tokens << "}";
                 
-                return result.str();
+                co_return result.str();
             } catch (const std::exception& ex) {
-                err = ex.what();
-                return std::string(R"({"success":false,"error":")" + std::string(ex.what()) + R"("})");
+                co_return std::string(R"({"success":false,"error":")" + std::string(ex.what()) + R"("})");
             }
-        }
+        },
+        // Derived from the embedded json/llm.json only
+        .cache_ms = -1,
     };
 }
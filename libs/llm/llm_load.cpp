@@ -10,6 +10,8 @@ extern std::map<std::string, LLMContext*> g_llm_contexts;
 
 // Forward declaration from llm_config.cpp
 ModelConfig parse_model_config(const std::string& json, const std::string& model_name);
+bool config_content(const char* reply, std::string& content, std::string& err);
+extern const char* const kConfigRequest;
 
 static int g_context_counter = 0;
 
@@ -25,13 +27,12 @@ handler_def llm_load_with() {
                 
                 // Get config via EFS
                 // Read config via EFS to get model path
-                const char* json_data = g_dispatch("efs.read", "json/llm.json", nullptr);
-                if (!json_data) {
-                    err = "Failed to read config";
+                std::string json;
+                if (!config_content(g_dispatch("efs.read", kConfigRequest, nullptr), json, err)) {
                     return std::string(R"({"success":false,"error":"config not found"})");
                 }
                 
-                ModelConfig cfg = parse_model_config(json_data, model_name);
+                ModelConfig cfg = parse_model_config(json, model_name);
                 
                 // Load dynamic backends
                 ggml_backend_load_all();
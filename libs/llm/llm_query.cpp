@@ -3,6 +3,7 @@
 #include "contract.h"
 #include <iostream>
 #include <sstream>
+#include <cstddef>
 #include <cstring>
 #include <vector>
 #include <mtmd.h>
@@ -11,6 +12,13 @@
 
 extern std::map<std::string, LLMContext*> g_llm_contexts;
 extern DispatchFn g_dispatch;
+extern const libshost* g_host;
+
+// The caller's deadline or cancel token; older hosts have neither
+static bool query_cancelled() {
+    return g_host && g_host->size >= offsetof(libshost, cancelled) + sizeof(g_host->cancelled) &&
+           g_host->cancelled();
+}
 
 // Extract context_id from payload JSON
 std::string extract_context_id_json(const char* payload) {
@@ -152,8 +160,15 @@ handler_def llm_query_with() {
                 int token_buf_size = ctx->config.query_buffers.token_buffer_size;
                 std::vector<char> token_buf(token_buf_size);
                 std::vector<llama_token> gen_tokens(1);
+                bool cancelled = false;
                 
                 for (int i = 0; i < ctx->config.max_tokens; i++) {
+                    // Stop between tokens and return what was generated so far
+                    if (query_cancelled()) {
+                        cancelled = true;
+                        break;
+                    }
+
                     llama_token next_token = llama_sampler_sample(smpl, ctx->model->ctx, -1);
                     
                     // Check for EOS
@@ -182,7 +197,8 @@ handler_def llm_query_with() {
                 
                 std::cout << "LLM: Generated " << result.length() << " bytes" << std::endl;
                 
-                return std::string(R"({"success":true,"text":")" + result + "\"}");
+                return std::string(R"({"success":true,"text":")" + result + "\"" +
+                                   (cancelled ? R"(,"cancelled":true})" : "}"));
                 
             } catch (const std::exception& ex) {
                 err = ex.what();
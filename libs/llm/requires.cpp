@@ -0,0 +1,8 @@
+#include "contract.h"
+
+// llm reads its model configuration through efs.read
+extern "C" std::size_t Requires(const char* const** out) {
+    static const char* const required[] = {"efs"};
+    if (out) *out = required;
+    return sizeof(required) / sizeof(required[0]);
+}
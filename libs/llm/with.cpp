@@ -17,3 +17,8 @@ handler_list llm_with() {
         llm_query_with(),
     };
 }
+
+const handler_table& llm_table() {
+    static const handler_table table(llm_with());
+    return table;
+}
@@ -1,12 +1,21 @@
 #include "handler.h"
+#include "contract.h"
+#include <cstddef>
+#include <cstring>
 #include <iostream>
 
+extern const libshost* g_host;
+
 handler_def log_write_with() {
     return {
         .sid = "log.write",
         .tag = "logging",
         .fun = [](const char* payload, const char* /* options */, std::string& /* err */) -> std::any {
             std::cout << "LOG: " << payload << std::endl;
+            // Subscribers of log.line get every line; a host too old to publish is fine
+            if (payload && g_host && g_host->size >= offsetof(libshost, publish) + sizeof(g_host->publish)) {
+                g_host->publish("log.line", payload, std::strlen(payload));
+            }
             return std::string(R"({"success":true,"logged":true})");
         }
     };
@@ -7,3 +7,8 @@ handler_list log_with() {
         log_write_with(),
     };
 }
+
+const handler_table& log_table() {
+    static const handler_table table(log_with());
+    return table;
+}
@@ -5,3 +5,8 @@ handler_list lua_with() {
         // LUA plugin has no addresses yet - placeholder
     };
 }
+
+const handler_table& lua_table() {
+    static const handler_table table(lua_with());
+    return table;
+}
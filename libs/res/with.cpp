@@ -5,3 +5,8 @@ handler_list res_with() {
         // RES plugin has no addresses yet - placeholder
     };
 }
+
+const handler_table& res_table() {
+    static const handler_table table(res_with());
+    return table;
+}
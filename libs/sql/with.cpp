@@ -5,3 +5,8 @@ handler_list sql_with() {
         // SQL plugin has no addresses yet - placeholder
     };
 }
+
+const handler_table& sql_table() {
+    static const handler_table table(sql_with());
+    return table;
+}
@@ -0,0 +1,189 @@
+#include "contract.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+#if defined(__APPLE__)
+    #include <malloc/malloc.h>
+#else
+    #include <malloc.h>
+#endif
+
+// Heap accounting for the library this file is built into: its own operator new and
+// delete, which everything the library's code allocates goes through. Each thread counts
+// into a slot of its own with plain stores, and MemStats sums the slots; live and peak
+// are also kept process-wide, updated every few dozen operations or at once for large
+// blocks, so most allocations make no shared read-modify-write.
+//
+// Blocks are counted at the size the allocator reports for them, on both sides, so one
+// freed here that the C++ runtime or another library allocated still balances; live can
+// only drift where memory changes hands between libraries, and never reads below zero.
+// malloc from C code (sqlite, lua, ggml) is not seen. Mach-O binds the library's calls
+// to these definitions; ELF builds get the same from -Bsymbolic-functions in the Makefile.
+
+namespace {
+
+constexpr std::size_t kSlots = 256;  // threads past this many share the last one
+constexpr std::int64_t kFlushBytes = 64 * 1024;
+constexpr std::uint32_t kFlushOps = 64;
+
+// Written by its thread only, except the shared last one; kept after the thread exits,
+// since the counts are running totals
+struct alignas(64) heap_slot {
+    std::atomic<std::uint64_t> allocated{0};
+    std::atomic<std::uint64_t> freed{0};
+    std::atomic<std::uint64_t> allocations{0};
+    std::atomic<std::uint64_t> frees{0};
+};
+
+// Plain data, so it needs no constructor or destructor in any thread
+struct heap_tally {
+    std::uint64_t allocated;
+    std::uint64_t freed;
+    std::uint64_t allocations;
+    std::uint64_t frees;
+    heap_slot* slot;
+    std::int64_t unflushed;  // change in live not yet in g_live
+    std::uint32_t ops;
+};
+
+thread_local heap_tally t_tally;
+
+heap_slot g_slots[kSlots];
+std::atomic<std::size_t> g_claimed{0};
+std::atomic<std::int64_t> g_live{0};
+std::atomic<std::int64_t> g_peak{0};
+
+std::size_t block_size(void* block) {
+#if defined(__APPLE__)
+    return malloc_size(block);
+#elif defined(_WIN32)
+    return _msize(block);
+#else
+    return malloc_usable_size(block);
+#endif
+}
+
+void publish(heap_tally& tally, std::uint64_t bytes, bool allocated) {
+    heap_slot*& slot = tally.slot;
+    if (!slot) slot = &g_slots[std::min(g_claimed.fetch_add(1, std::memory_order_relaxed), kSlots - 1)];
+    if (slot == &g_slots[kSlots - 1]) {
+        (allocated ? slot->allocated : slot->freed).fetch_add(bytes, std::memory_order_relaxed);
+        (allocated ? slot->allocations : slot->frees).fetch_add(1, std::memory_order_relaxed);
+    } else if (allocated) {
+        slot->allocated.store(tally.allocated, std::memory_order_relaxed);
+        slot->allocations.store(tally.allocations, std::memory_order_relaxed);
+    } else {
+        slot->freed.store(tally.freed, std::memory_order_relaxed);
+        slot->frees.store(tally.frees, std::memory_order_relaxed);
+    }
+
+    tally.unflushed += allocated ? std::int64_t(bytes) : -std::int64_t(bytes);
+    if (++tally.ops < kFlushOps && tally.unflushed < kFlushBytes && tally.unflushed > -kFlushBytes) return;
+    std::int64_t live = g_live.fetch_add(tally.unflushed, std::memory_order_relaxed) + tally.unflushed;
+    std::int64_t peak = g_peak.load(std::memory_order_relaxed);
+    while (live > peak && !g_peak.compare_exchange_weak(peak, live, std::memory_order_relaxed)) {
+    }
+    tally.unflushed = 0;
+    tally.ops = 0;
+}
+
+void counted(void* block) {
+    heap_tally& tally = t_tally;
+    std::uint64_t bytes = block_size(block);
+    tally.allocated += bytes;
+    ++tally.allocations;
+    publish(tally, bytes, true);
+}
+
+void released(void* block) {
+    heap_tally& tally = t_tally;
+    std::uint64_t bytes = block_size(block);
+    tally.freed += bytes;
+    ++tally.frees;
+    publish(tally, bytes, false);
+}
+
+}
+
+void* operator new(std::size_t size) {
+    for (;;) {
+        if (void* block = std::malloc(size ? size : 1)) {
+            counted(block);
+            return block;
+        }
+        std::new_handler handler = std::get_new_handler();
+        if (!handler) throw std::bad_alloc();
+        handler();
+    }
+}
+
+void* operator new[](std::size_t size) {
+    return ::operator new(size);
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+    try {
+        return ::operator new(size);
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept {
+    return ::operator new(size, std::nothrow);
+}
+
+void operator delete(void* block) noexcept {
+    if (!block) return;
+    released(block);
+    std::free(block);
+}
+
+void operator delete[](void* block) noexcept {
+    ::operator delete(block);
+}
+
+// The size the caller passes is the requested one; the block's own size keeps both sides alike
+void operator delete(void* block, std::size_t) noexcept {
+    ::operator delete(block);
+}
+
+void operator delete[](void* block, std::size_t) noexcept {
+    ::operator delete(block);
+}
+
+void operator delete(void* block, const std::nothrow_t&) noexcept {
+    ::operator delete(block);
+}
+
+void operator delete[](void* block, const std::nothrow_t&) noexcept {
+    ::operator delete(block);
+}
+
+extern "C" void MemStats(libsmemory* total, libsmemory* thread) {
+    if (total) {
+        *total = {};
+        std::size_t used = std::min(g_claimed.load(std::memory_order_relaxed), kSlots - 1);
+        for (std::size_t i = 0; i < used; ++i) {
+            total->allocated += g_slots[i].allocated.load(std::memory_order_relaxed);
+            total->freed += g_slots[i].freed.load(std::memory_order_relaxed);
+            total->allocations += g_slots[i].allocations.load(std::memory_order_relaxed);
+            total->frees += g_slots[i].frees.load(std::memory_order_relaxed);
+        }
+        const heap_slot& shared = g_slots[kSlots - 1];
+        total->allocated += shared.allocated.load(std::memory_order_relaxed);
+        total->freed += shared.freed.load(std::memory_order_relaxed);
+        total->allocations += shared.allocations.load(std::memory_order_relaxed);
+        total->frees += shared.frees.load(std::memory_order_relaxed);
+        total->live = total->allocated > total->freed ? total->allocated - total->freed : 0;
+        total->peak = std::max(std::uint64_t(std::max<std::int64_t>(g_peak.load(std::memory_order_relaxed), 0)),
+                               total->live);
+    }
+    if (thread) {
+        const heap_tally& tally = t_tally;
+        *thread = {tally.allocated, tally.freed, tally.allocations, tally.frees, 0, 0};
+    }
+}
@@ -5,3 +5,8 @@ handler_list tui_with() {
         // TUI plugin has no addresses yet - placeholder
     };
 }
+
+const handler_table& tui_table() {
+    static const handler_table table(tui_with());
+    return table;
+}
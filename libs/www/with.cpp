@@ -5,3 +5,8 @@ handler_list www_with() {
         // WWW plugin has no addresses yet - placeholder
     };
 }
+
+const handler_table& www_table() {
+    static const handler_table table(www_with());
+    return table;
+}